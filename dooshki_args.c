@@ -13,14 +13,128 @@
  * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
+
+/*
+ * Optional features, enable them by defining the corresponding macro here
+ * or on the compiler's command line:
+ *
+ *   DOOSHKI_ARGS_POSIX     Use POSIX interfaces where they are more capable
+ *                          than their ANSI C counterparts.
+ *
+ *   DOOSHKI_ARGS_THREADS   Process large entry lists on a pthread pool,
+ *                          implies DOOSHKI_ARGS_POSIX and requires linking
+ *                          with -lpthread.
+ *
+ *   DOOSHKI_ARGS_SIMD      Scan option words with SSE2, or AVX2 when the
+ *                          compiler targets it, has no effect on compilers
+ *                          which don't provide the x86 intrinsics.
+ *
+ *   DOOSHKI_ARGS_STATS     Collect parsing statistics into the structure
+ *                          referred to by the `stats' field of dooshki_args,
+ *                          timing uses the monotonic clock on POSIX systems
+ *                          and the processor time otherwise.
+ *
+ *   DOOSHKI_ARGS_NO_STDIO  Don't use stdio, write all output through the
+ *                          dooshki_args_write routine provided by the program.
+ *                          dooshki_args_trace_write is left out, and without
+ *                          DOOSHKI_ARGS_POSIX, file checks and spec image
+ *                          mapping fail as there's no way to reach files.
+ *
+ *   DOOSHKI_ARGS_SIGSAFE   Restrict parsing to async-signal-safe operations,
+ *                          so that it can be done in signal handlers and
+ *                          after vfork(), implies DOOSHKI_ARGS_NO_STDIO and
+ *                          DOOSHKI_ARGS_POSIX.  Numbers are converted without
+ *                          strtol and friends, errno or the locale, output is
+ *                          written with write(2), and the help screen neither
+ *                          allocates its cache nor looks up the terminal size.
+ *
+ *   DOOSHKI_ARGS_NO_HEAP   Leave out everything which allocates memory, so
+ *                          that the library doesn't reference malloc at all:
+ *                          dooshki_args_compile, dooshki_args_spec_free,
+ *                          dooshki_args_print_completion, the help screen
+ *                          layout cache and, without DOOSHKI_ARGS_POSIX,
+ *                          dooshki_args_image_map.
+ *
+ *   DOOSHKI_ARGS_AUTO_INDEX
+ *                          Have dooshki_args_parse compile each option table
+ *                          it's given into a spec the first time it sees it,
+ *                          and look options up through it from then on, see
+ *                          dooshki_args_auto_index_free.  With
+ *                          DOOSHKI_ARGS_THREADS, tables are added to the cache
+ *                          under a mutex, and found without it.  Has no effect
+ *                          with DOOSHKI_ARGS_NO_HEAP or DOOSHKI_ARGS_SIGSAFE.
+ */
+/* #define DOOSHKI_ARGS_POSIX */
+/* #define DOOSHKI_ARGS_THREADS */
+/* #define DOOSHKI_ARGS_SIMD */
+/* #define DOOSHKI_ARGS_STATS */
+/* #define DOOSHKI_ARGS_NO_STDIO */
+/* #define DOOSHKI_ARGS_SIGSAFE */
+/* #define DOOSHKI_ARGS_NO_HEAP */
+/* #define DOOSHKI_ARGS_AUTO_INDEX */
+
+#ifdef DOOSHKI_ARGS_SIGSAFE
+#ifndef DOOSHKI_ARGS_NO_STDIO
+#define DOOSHKI_ARGS_NO_STDIO
+#endif
+#ifndef DOOSHKI_ARGS_POSIX
+#define DOOSHKI_ARGS_POSIX
+#endif
+#endif
+
+#if defined(DOOSHKI_ARGS_AUTO_INDEX) && \
+    (defined(DOOSHKI_ARGS_NO_HEAP) || defined(DOOSHKI_ARGS_SIGSAFE))
+#undef DOOSHKI_ARGS_AUTO_INDEX
+#endif
+
+#if defined(DOOSHKI_ARGS_THREADS) && !defined(DOOSHKI_ARGS_POSIX)
+#define DOOSHKI_ARGS_POSIX
+#endif
+
+#if defined(DOOSHKI_ARGS_POSIX) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#ifndef DOOSHKI_ARGS_NO_STDIO
 #include <stdio.h>
+#endif
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include <limits.h>
+#include <float.h>
 #include <math.h>
 #include <ctype.h>
 #include <errno.h>
+#include <locale.h>
+
+#ifdef DOOSHKI_ARGS_STATS
+#include <time.h>
+#endif
+
+#ifdef DOOSHKI_ARGS_POSIX
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#endif
+
+#ifdef DOOSHKI_ARGS_THREADS
+#include <pthread.h>
+#endif
+
+#if defined(DOOSHKI_ARGS_SIMD) && defined(__GNUC__)
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_AVX2 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SIMD_SSE2 1
+#endif
+#endif
 
 #include "dooshki_args.h"
 
@@ -30,6 +144,15 @@
 #define DESC_START_COL      28
 #define PAGE_WRAP_COL       78
 
+/*
+ * The help screen adapts to the width of the terminal, with PAGE_WRAP_COL
+ * used when it's unknown.  Descriptions start past the widest option names,
+ * at DESC_START_COL or further, but at most MAX_DESC_START_RATIO percent
+ * of the way into the line.
+ */
+#define MIN_PAGE_WIDTH      40
+#define MAX_DESC_START_RATIO 40
+
 /* The hard-coded help and version entries. */
 #define HELP_SHORT_OPT      'h'
 #define HELP_SHORT_OPT_STR  "h"
@@ -41,11 +164,399 @@
 #define VER_LONG_OPT        "version"
 #define VER_DESC            "Display the program's version and quit."
 
+/* Hidden option answering completion queries, see dooshki_args_parse_spec. */
+#define COMPLETE_LONG_OPT   "complete"
+
+/* Number of command-line words classified at once by the parser. */
+#define CLASSIFY_BLOCK      64
+
+/* Number of trace events passed to the trace hook at once. */
+#define TRACE_BATCH         32
+
+/* Number of unsigned longs needed to store the given number of bytes. */
+#define STORAGE_WORDS(bytes) \
+    (((bytes) + sizeof(unsigned long) - 1) / sizeof(unsigned long))
+
+/* Number of option tables whose index is kept by DOOSHKI_ARGS_AUTO_INDEX. */
+#define AUTO_INDEX_SLOTS    64
+
+/*
+ * Entry list processing, lists shorter than BULK_PARALLEL_MIN are always
+ * processed serially, longer ones are split between up to BULK_MAX_THREADS
+ * threads when DOOSHKI_ARGS_THREADS is enabled.
+ */
+#define BULK_PARALLEL_MIN   16384
+#define BULK_MAX_THREADS    8
+
+
+/* Check whether an entry is the terminating entry of an option array. */
+#define IS_LAST_OPT(opt) ((opt)->short_name == NULL && (opt)->long_name == NULL)
+
+/*
+ * The English messages, in the order of enum dooshki_msg_id.
+ *
+ * They're stored as the fields of a single structure, and looked up by their
+ * offsets within it, so that the catalog is one block of read-only text with
+ * no pointers to relocate at startup.
+ */
+#define ENGLISH_MESSAGES(MSG) \
+    MSG(DOOSHKI_MSG_HELP_DESC,          HELP_DESC) \
+    MSG(DOOSHKI_MSG_VER_DESC,           VER_DESC) \
+    MSG(DOOSHKI_MSG_USAGE,              "Usage:") \
+    MSG(DOOSHKI_MSG_SEE_HELP,           "See `%s --%s' for more details.") \
+    MSG(DOOSHKI_MSG_OPTIONS,            "Options:") \
+    MSG(DOOSHKI_MSG_BAD_ARGUMENT,       "Argument `%s' passed to option %s%s %s.") \
+    MSG(DOOSHKI_MSG_BAD_ENTRY,          "Entry %d of %s, `%s', %s.") \
+    MSG(DOOSHKI_MSG_TOO_LARGE,          "is too large") \
+    MSG(DOOSHKI_MSG_TOO_SMALL,          "is too small") \
+    MSG(DOOSHKI_MSG_UNDERFLOW,          "would cause an underflow") \
+    MSG(DOOSHKI_MSG_NOT_INT,            "is not a valid integer") \
+    MSG(DOOSHKI_MSG_NOT_UINT,           "is not a valid unsigned integer") \
+    MSG(DOOSHKI_MSG_NOT_FLOAT,          "is not a valid floating point number") \
+    MSG(DOOSHKI_MSG_NOT_REGULAR,        "`%s' is not a regular file.") \
+    MSG(DOOSHKI_MSG_ACCESS_ERROR,       "Cannot access `%s': %s.") \
+    MSG(DOOSHKI_MSG_NO_ACCESS,          "Cannot access `%s'.") \
+    MSG(DOOSHKI_MSG_UNRECOGNIZED,       "Unrecognized option %s") \
+    MSG(DOOSHKI_MSG_UNRECOGNIZED_SHORT, "Unrecognized option -%c") \
+    MSG(DOOSHKI_MSG_UNEXPECTED_ARG,     "Argument `%s' not expected for option --%s") \
+    MSG(DOOSHKI_MSG_MISSING_ARG_LONG,   "Missing argument for option --%s") \
+    MSG(DOOSHKI_MSG_MISSING_ARG_SHORT,  "Missing argument for option -%s")
+
+#define MESSAGE_FIELD(id, text)     char id[sizeof(text)];
+#define MESSAGE_TEXT(id, text)      text,
+#define MESSAGE_OFFSET(id, text)    offsetof(struct english_catalog, id),
+#define MESSAGE_POSITION(id, text)  POSITION_##id,
+#define MESSAGE_CHECK(id, text) \
+    typedef char check_##id[(POSITION_##id == (int)id)? 1 : -1];
+
+static const struct english_catalog
+{
+    ENGLISH_MESSAGES(MESSAGE_FIELD)
+} english_catalog =
+{
+    ENGLISH_MESSAGES(MESSAGE_TEXT)
+};
+
+static const unsigned short english_offsets[DOOSHKI_MSG_COUNT] =
+{
+    ENGLISH_MESSAGES(MESSAGE_OFFSET)
+};
+
+/* Fail to compile if the list gets out of sync with enum dooshki_msg_id. */
+enum english_positions
+{
+    ENGLISH_MESSAGES(MESSAGE_POSITION)
+    ENGLISH_MESSAGE_COUNT
+};
+ENGLISH_MESSAGES(MESSAGE_CHECK)
+typedef char check_message_count[
+    ((int)ENGLISH_MESSAGE_COUNT == (int)DOOSHKI_MSG_COUNT)? 1 : -1];
+
+/* Look up a message, in the catalog selected by args_ctxt if there is one. */
+static const char *message(const struct dooshki_args *args_ctxt,
+                           enum dooshki_msg_id id)
+{
+    if (args_ctxt->messages != NULL && args_ctxt->messages[id] != NULL)
+        return args_ctxt->messages[id];
+
+    return (const char *)&english_catalog + english_offsets[id];
+}
+
+/*
+ * Output of the library.
+ *
+ * Everything is written through write_out and vformat_out, which use stdio
+ * by default.  With DOOSHKI_ARGS_NO_STDIO, they hand the text over to the
+ * dooshki_args_write routine provided by the program instead, formatting it
+ * with the small formatter below, which supports just the conversions the
+ * library uses: %c, %s, %.*s, %d, %u, %ld, %lu and %%.
+ */
+#ifndef DOOSHKI_ARGS_NO_STDIO
+
+#define STREAM_FILE(stream) ((stream) == DOOSHKI_STREAM_ERR? stderr : stdout)
+
+static void write_out(enum dooshki_stream stream, const char *data, size_t len)
+{
+    fwrite(data, 1, len, STREAM_FILE(stream));
+}
+
+static int vformat_out(enum dooshki_stream stream,
+                       const char *fmt, va_list args)
+{
+    return vfprintf(STREAM_FILE(stream), fmt, args);
+}
+
+static void out_char(char ch)
+{
+    putchar(ch);
+}
+
+/* Format into a buffer large enough for the result. */
+static int format_string(char *buffer, const char *fmt, ...)
+{
+    va_list args;
+    int len;
+
+    va_start(args, fmt);
+    len = vsprintf(buffer, fmt, args);
+    va_end(args);
+
+    return len;
+}
+
+#else /* DOOSHKI_ARGS_NO_STDIO */
+
+/*
+ * Size of the chunks in which formatted text is passed to the write hook,
+ * error messages up to this size are written at once.
+ */
+#define FORMAT_CHUNK        256
+
+/* Destination of the formatter, a buffer or (when it's NULL) a stream. */
+struct format_sink
+{
+    char *buffer;
+    enum dooshki_stream stream;
+    size_t len;
+
+    char chunk[FORMAT_CHUNK];
+    size_t chunk_len;
+};
+
+#ifdef DOOSHKI_ARGS_SIGSAFE
+void dooshki_args_write(enum dooshki_stream stream,
+                        const char *data, unsigned long len)
+{
+    int saved_errno = errno;
+    ssize_t written;
+
+    while (len > 0)
+    {
+        written = write((int)stream, data, len);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        data += written;
+        len  -= (unsigned long)written;
+    }
+    errno = saved_errno;
+}
+#endif
+
+static void write_out(enum dooshki_stream stream, const char *data, size_t len)
+{
+    if (len > 0)
+        dooshki_args_write(stream, data, (unsigned long)len);
+}
+
+/* Start formatting into `buffer', or the stream if it's NULL. */
+static void sink_init(struct format_sink *sink, char *buffer,
+                      enum dooshki_stream stream)
+{
+    sink->buffer    = buffer;
+    sink->stream    = stream;
+    sink->len       = 0;
+    sink->chunk_len = 0;
+}
+
+/* Write out what's left in the chunk of a stream sink. */
+static void sink_flush(struct format_sink *sink)
+{
+    write_out(sink->stream, sink->chunk, sink->chunk_len);
+    sink->chunk_len = 0;
+}
+
+static void sink_put(struct format_sink *sink, const char *data, size_t len)
+{
+    if (sink->buffer != NULL)
+        memcpy(&sink->buffer[sink->len], data, len);
+    else if (sink->chunk_len + len <= FORMAT_CHUNK)
+    {
+        memcpy(&sink->chunk[sink->chunk_len], data, len);
+        sink->chunk_len += len;
+    }
+    else
+    {
+        sink_flush(sink);
+
+        if (len < FORMAT_CHUNK)
+        {
+            memcpy(sink->chunk, data, len);
+            sink->chunk_len = len;
+        }
+        else
+            write_out(sink->stream, data, len);
+    }
+    sink->len += len;
+}
+
+/* Format an integer, returns the start of the digits ending at `end'. */
+static char *format_integer(char *end, unsigned long value, char negative)
+{
+    do
+    {
+        *--end = (char)('0' + value % 10);
+        value /= 10;
+    }
+    while (value > 0);
+
+    if (negative)
+        *--end = '-';
+
+    return end;
+}
+
+static void format_sink(struct format_sink *sink,
+                        const char *fmt, va_list args)
+{
+    char digits[sizeof(long) * CHAR_BIT / 3 + 3];
+    char *digits_end = &digits[sizeof(digits)];
+    const char *run_start = fmt;
+
+    while (*fmt != '\0')
+    {
+        const char *spec_start = fmt;
+        const char *text = NULL;
+        size_t len = 1;
+        int precision = -1;
+        char is_long = 0;
+        char ch;
+        long value;
+        unsigned long uvalue;
+
+        if (*fmt != '%')
+        {
+            fmt++;
+            continue;
+        }
+        sink_put(sink, run_start, (size_t)(fmt - run_start));
+        fmt++;
+
+        if (fmt[0] == '.' && fmt[1] == '*')
+        {
+            precision = va_arg(args, int);
+            fmt += 2;
+        }
+        if (*fmt == 'l')
+        {
+            is_long = 1;
+            fmt++;
+        }
+
+        switch (*fmt)
+        {
+            case 'c':
+                ch = (char)va_arg(args, int);
+                text = &ch;
+                break;
+
+            case 's':
+                text = va_arg(args, const char *);
+                for (len = 0; (precision < 0 || len < (size_t)precision) &&
+                              text[len] != '\0'; len++)
+                    ;
+                break;
+
+            case 'd':
+                value = is_long? va_arg(args, long) : va_arg(args, int);
+                uvalue = (value < 0)? 0UL - (unsigned long)value
+                                    : (unsigned long)value;
+                text = format_integer(digits_end, uvalue, value < 0);
+                len  = (size_t)(digits_end - text);
+                break;
+
+            case 'u':
+                uvalue = is_long? va_arg(args, unsigned long)
+                                : va_arg(args, unsigned int);
+                text = format_integer(digits_end, uvalue, 0);
+                len  = (size_t)(digits_end - text);
+                break;
+
+            case '%':
+                text = "%";
+                break;
+
+            default:
+                /* Unsupported conversion, shown as it is. */
+                run_start = spec_start;
+                continue;
+        }
+        sink_put(sink, text, len);
+        run_start = ++fmt;
+    }
+    sink_put(sink, run_start, (size_t)(fmt - run_start));
+}
+
+static int vformat_out(enum dooshki_stream stream,
+                       const char *fmt, va_list args)
+{
+    struct format_sink sink;
+
+    sink_init(&sink, NULL, stream);
+    format_sink(&sink, fmt, args);
+    sink_flush(&sink);
+
+    return (int)sink.len;
+}
+
+static void out_char(char ch)
+{
+    write_out(DOOSHKI_STREAM_OUT, &ch, 1);
+}
+
+static int format_string(char *buffer, const char *fmt, ...)
+{
+    struct format_sink sink;
+    va_list args;
+
+    sink_init(&sink, buffer, DOOSHKI_STREAM_OUT);
+
+    va_start(args, fmt);
+    format_sink(&sink, fmt, args);
+    va_end(args);
+
+    buffer[sink.len] = '\0';
+    return (int)sink.len;
+}
+
+#endif /* DOOSHKI_ARGS_NO_STDIO */
+
+/* Convenience routine for writing onto stdout, see also out_char. */
+static int out_printf(const char *fmt, ...)
+{
+    va_list args;
+    int len;
+
+    va_start(args, fmt);
+    len = vformat_out(DOOSHKI_STREAM_OUT, fmt, args);
+    va_end(args);
+
+    return len;
+}
 
 /* Convenience routine for printing error messages. */
 static void print_error(const struct dooshki_args *args_ctxt,
                         const char *fmt, ...)
 {
+#ifdef DOOSHKI_ARGS_NO_STDIO
+    struct format_sink sink;
+    va_list args;
+    va_start(args, fmt);
+
+    /* Assembled in one chunk, so that short messages are written at once. */
+    sink_init(&sink, NULL, DOOSHKI_STREAM_ERR);
+    sink_put(&sink, args_ctxt->program_name,
+             strlen(args_ctxt->program_name));
+    sink_put(&sink, ": ", 2);
+    format_sink(&sink, fmt, args);
+    sink_put(&sink, "\n", 1);
+    sink_flush(&sink);
+
+    va_end(args);
+#else
     va_list args;
     va_start(args, fmt);
 
@@ -54,25 +565,30 @@ static void print_error(const struct dooshki_args *args_ctxt,
     fprintf(stderr, "\n");
 
     va_end(args);
+#endif
 }
 
 /* Print usage information, along with a possible suggestion to use --help */
 static void print_usage(const struct dooshki_args *args_ctxt, char is_error)
 {
     if (is_error)
-        fprintf(stderr, "\n");
+        write_out(DOOSHKI_STREAM_ERR, "\n", 1);
 
-    printf("%s %s - %s\n",
-           args_ctxt->program_name,
-           args_ctxt->version,
-           args_ctxt->summary);
+    out_printf("%s %s - %s\n",
+               args_ctxt->program_name,
+               args_ctxt->version,
+               args_ctxt->summary);
 
-    printf("Usage:\n"
-           "    %s %s\n\n", args_ctxt->program_name, args_ctxt->usage);
+    out_printf("%s\n"
+               "    %s %s\n\n", message(args_ctxt, DOOSHKI_MSG_USAGE),
+               args_ctxt->program_name, args_ctxt->usage);
 
     if (is_error)
-        printf("See `%s --%s' for more details.\n",
-               args_ctxt->program_name, HELP_LONG_OPT);
+    {
+        out_printf(message(args_ctxt, DOOSHKI_MSG_SEE_HELP),
+                   args_ctxt->program_name, HELP_LONG_OPT);
+        out_char('\n');
+    }
 }
 
 /* Move to a specified column on the screen. */
@@ -83,12 +599,12 @@ static void set_column(unsigned int new_col, unsigned int *column,
 
     if (new_col < current_col || (space_needed && new_col == current_col))
     {
-        putchar('\n');
+        out_char('\n');
         current_col = 0;
     }
 
     while (current_col < new_col) {
-        putchar(' ');
+        out_char(' ');
         current_col += 1;
     }
 
@@ -102,8 +618,9 @@ static void set_column(unsigned int new_col, unsigned int *column,
  * The search starts at the index w_start, and skips over a potential block
  * of whitespaces until it reaches the first non-whitespace character.
  *
- * A whitespace in this routine is defined as any character for which isspace()
- * returns a non-zero value.
+ * A whitespace in this routine is defined as an ASCII space, tab, newline,
+ * vertical tab, form feed or carriage return.  Unlike isspace(), this never
+ * matches a byte of a multi-byte UTF-8 character, whatever the locale.
  *
  * *w_start will refer to either '\0' (if no word was found) or the first
  * character of a word.
@@ -112,674 +629,4157 @@ static void set_column(unsigned int new_col, unsigned int *column,
  * a whitespace or '\0'.  If no word was found, *w_end will have the same
  * value as *w_start.
  */
+#define IS_SPACE(ch) ((ch) == ' ' || ((ch) >= '\t' && (ch) <= '\r'))
+
 static void find_word(const char *str,
                       unsigned int *w_start,
                       unsigned int *w_end)
 {
-    for (; str[*w_start] != '\0' && isspace(str[*w_start]); *w_start += 1);
+    for (; str[*w_start] != '\0' && IS_SPACE(str[*w_start]); *w_start += 1);
 
-    for (*w_end = *w_start; str[*w_end] != '\0' && !isspace(str[*w_end]);
+    for (*w_end = *w_start; str[*w_end] != '\0' && !IS_SPACE(str[*w_end]);
          *w_end += 1);
 }
 
-/* Print a line-folded description for a command-line option. */
-static void print_opt_desc(const char *desc, unsigned int column)
+/*
+ * Check whether `len' bytes of text are all ASCII.
+ *
+ *
+ * Help texts are mostly ASCII, for which the display width is simply
+ * the number of bytes, so this check lets them skip UTF-8 decoding.
+ */
+static char is_ascii(const char *str, size_t len)
 {
-    unsigned int word_start = 0;
-    unsigned int word_end;
-    char line_first_word;
+    unsigned char high_bits = 0;
+    size_t iter = 0;
 
-    while(desc[word_start] != '\0')
+#if defined(SIMD_AVX2)
+    for (; iter + 32 <= len; iter += 32)
     {
-        set_column(DESC_START_COL, &column, 1);
-        line_first_word = 1;
-
-        find_word(desc, &word_start, &word_end);
-        if (desc[word_start] == '\0')
-            break;
-
-        do
-        {
-            if (!line_first_word)
-            {
-                putchar(' ');
-                column += 1;
-            }
-            column += fwrite(&desc[word_start], 1, word_end - word_start,
-                             stdout);
-            line_first_word = 0;
+        if (_mm256_movemask_epi8(
+                _mm256_loadu_si256((const __m256i *)&str[iter])) != 0)
+            return 0;
+    }
+#elif defined(SIMD_SSE2)
+    for (; iter + 16 <= len; iter += 16)
+    {
+        if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)&str[iter])))
+            return 0;
+    }
+#endif
 
-            word_start = word_end;
-            find_word(desc, &word_start, &word_end);
+    for (; iter < len; iter++)
+        high_bits |= (unsigned char)str[iter];
 
-        } while (desc[word_start] != '\0' &&
-                 column + 1 + (word_end - word_start) < PAGE_WRAP_COL);
-    }
+    return (high_bits & 0x80) == 0;
 }
 
-/* Print information about a command-line option. */
-static void print_option(const char *short_name,
-                         const char *long_name,
-                         const char *argument_template,
-                         const char *description)
+/*
+ * Decode a UTF-8 character of at most `len' bytes, returns the number
+ * of bytes used.  Invalid bytes are decoded one by one, as U+FFFD.
+ */
+static unsigned int utf8_decode(const unsigned char *str, size_t len,
+                                unsigned long *code)
 {
-    unsigned int column = 0;
+    static const unsigned long min_code[4] = { 0, 0x80, 0x800, 0x10000 };
+    unsigned int extra;
+    unsigned int iter;
 
-    if (short_name != NULL)
+    if (str[0] < 0x80)
     {
-        set_column(SHORT_START_COL, &column, 0);
-        column += printf("-%c", short_name[0]);
+        *code = str[0];
+        return 1;
     }
-    if (long_name != NULL)
+
+    if ((str[0] & 0xE0) == 0xC0)
     {
-        if (short_name != NULL)
+        extra = 1;
+        *code = str[0] & 0x1F;
+    }
+    else if ((str[0] & 0xF0) == 0xE0)
+    {
+        extra = 2;
+        *code = str[0] & 0x0F;
+    }
+    else if ((str[0] & 0xF8) == 0xF0)
+    {
+        extra = 3;
+        *code = str[0] & 0x07;
+    }
+    else
+    {
+        *code = 0xFFFD;
+        return 1;
+    }
+
+    for (iter = 1; iter <= extra; iter++)
+    {
+        if (iter >= len || (str[iter] & 0xC0) != 0x80)
         {
-            putchar(',');
-            column += 1;
+            *code = 0xFFFD;
+            return 1;
         }
-        set_column(LONG_START_COL, &column, 1);
-        column += printf("--%s", long_name);
+        *code = (*code << 6) | (str[iter] & 0x3F);
     }
-    if (argument_template != NULL)
+
+    /* Overlong encodings, surrogates and values beyond Unicode. */
+    if (*code < min_code[extra] || *code > 0x10FFFF ||
+        (*code >= 0xD800 && *code <= 0xDFFF))
     {
-        putchar((long_name != NULL)? '=' : ' ');
-        column += 1;
-        column += printf("<%s>", argument_template);
+        *code = 0xFFFD;
+        return 1;
     }
-    if (description != NULL)
-        print_opt_desc(description, column);
-
-    putchar('\n');
+    return extra + 1;
 }
 
-/* Print the help screen. */
-static void print_help(const struct dooshki_args *args_ctxt)
+/*
+ * Number of terminal columns taken up by a character: 0 for combining marks
+ * and zero-width characters, 2 for East Asian wide and fullwidth characters,
+ * 1 otherwise.
+ */
+static unsigned int char_width(unsigned long code)
 {
-    unsigned int opt_iter;
+    static const unsigned long zero_width[][2] =
+    {
+        { 0x0300, 0x036F }, { 0x0483, 0x0489 }, { 0x0591, 0x05BD },
+        { 0x0610, 0x061A }, { 0x064B, 0x065F }, { 0x0E31, 0x0E31 },
+        { 0x0E34, 0x0E3A }, { 0x0E47, 0x0E4E }, { 0x1AB0, 0x1AFF },
+        { 0x1DC0, 0x1DFF }, { 0x200B, 0x200F }, { 0x202A, 0x202E },
+        { 0x2060, 0x2064 }, { 0x20D0, 0x20FF }, { 0x302A, 0x302D },
+        { 0x3099, 0x309A }, { 0xFE00, 0xFE0F }, { 0xFE20, 0xFE2F },
+        { 0xFEFF, 0xFEFF }
+    };
+    static const unsigned long double_width[][2] =
+    {
+        { 0x1100, 0x115F }, { 0x231A, 0x231B }, { 0x2329, 0x232A },
+        { 0x2E80, 0x303E }, { 0x3041, 0x33FF }, { 0x3400, 0x4DBF },
+        { 0x4E00, 0x9FFF }, { 0xA000, 0xA4CF }, { 0xA960, 0xA97F },
+        { 0xAC00, 0xD7A3 }, { 0xF900, 0xFAFF }, { 0xFE10, 0xFE19 },
+        { 0xFE30, 0xFE6F }, { 0xFF00, 0xFF60 }, { 0xFFE0, 0xFFE6 },
+        { 0x1F300, 0x1F64F }, { 0x1F900, 0x1F9FF }, { 0x20000, 0x2FFFD },
+        { 0x30000, 0x3FFFD }
+    };
+    unsigned int iter;
 
-    print_usage(args_ctxt, 0);
-    printf("%s\nOptions:\n", args_ctxt->description);
+    if (code < 0x0300)
+        return 1;
 
-    for (opt_iter = 0;
-         (args_ctxt->opt_desc[opt_iter].short_name != NULL ||
-          args_ctxt->opt_desc[opt_iter].long_name  != NULL);
-         opt_iter++)
+    for (iter = 0; iter < sizeof(zero_width) / sizeof(zero_width[0]); iter++)
     {
-        print_option(args_ctxt->opt_desc[opt_iter].short_name,
-                     args_ctxt->opt_desc[opt_iter].long_name,
-                     args_ctxt->opt_desc[opt_iter].argument_template,
-                     args_ctxt->opt_desc[opt_iter].description);
+        if (code >= zero_width[iter][0] && code <= zero_width[iter][1])
+            return 0;
     }
-
-    print_option(VER_SHORT_OPT_STR, VER_LONG_OPT, NULL, VER_DESC);
-    print_option(HELP_SHORT_OPT_STR, HELP_LONG_OPT, NULL, HELP_DESC);
+    for (iter = 0; iter < sizeof(double_width) / sizeof(double_width[0]);
+         iter++)
+    {
+        if (code >= double_width[iter][0] && code <= double_width[iter][1])
+            return 2;
+    }
+    return 1;
 }
 
-/* Print the program name and version. */
-static void print_version(const struct dooshki_args *args_ctxt)
+/*
+ * Number of terminal columns taken up by `len' bytes of UTF-8 text,
+ * `ascii' tells that the text is known to be pure ASCII.
+ */
+static unsigned int text_width(const char *str, size_t len, char ascii)
 {
-    printf("%s %s\n", args_ctxt->program_name, args_ctxt->version);
-}
+    const unsigned char *bytes = (const unsigned char *)str;
+    unsigned long code;
+    unsigned int width = 0;
+    size_t iter = 0;
 
+    if (ascii)
+        return (unsigned int)len;
 
-/* Collect a string argument. */
-static char process_str_arg(const struct dooshki_opt *option,
-                            const char *argument)
-{
-    const char **dest = option->opt_storage;
-    *dest = argument;
-    return 1;
+    while (iter < len)
+    {
+        iter  += utf8_decode(&bytes[iter], len - iter, &code);
+        width += char_width(code);
+    }
+    return width;
 }
 
-/* Collect an unsigned integer argument. */
-static char process_uint_arg(const struct dooshki_args *args_ctxt,
-                             const struct dooshki_opt  *option,
-                             const char  *opt_prefix,
-                             const char  *opt_name,
-                             const char  *argument)
+/* Number of terminal columns taken up by a string. */
+#define STRING_WIDTH(str) \
+    text_width((str), strlen(str), is_ascii((str), strlen(str)))
+
+/* Layout of the help screen. */
+struct help_layout
 {
-    unsigned long *dest = option->opt_storage;
-    char *test_ptr;
+    unsigned int desc_col;      /* column at which descriptions start */
+    unsigned int wrap_col;      /* descriptions are wrapped before it */
+};
 
-    errno = 0;
-    *dest = strtoul(argument, &test_ptr, 10);
-    if (*test_ptr != '\0' || argument[0] == '-')
-    {
-        print_error(args_ctxt,
-                    "Argument `%s' passed to option %s%s is not "
-                    "a valid unsigned integer.",
-                    argument, opt_prefix, opt_name);
+/*
+ * Help screen layout for a terminal of a given width.
+ *
+ * The descriptions are split into lines, described by the offsets of the
+ * start of the first word and the end of the last word of each line.
+ * The lines of option `i' (with the version and help options following
+ * the options of opt_desc) are those from line_index[i] to line_index[i + 1].
+ */
+struct help_lines
+{
+    unsigned int width;
+    struct help_layout layout;
+
+    unsigned int *line_index;
+    unsigned int *lines;
+
+    unsigned int users;         /* help screens being printed with it */
+};
+
+/*
+ * Cached help screen layout of a compiled spec, NULL if not computed yet.
+ *
+ * A layout is never changed once computed: when the width of the terminal
+ * changes, a new one replaces it, and the old one is released by the last
+ * of its users.
+ */
+struct dooshki_help_cache
+{
+    struct help_lines *current;
+};
+
+/* Determine the width of the terminal. */
+static unsigned int terminal_width(void)
+{
+#ifndef DOOSHKI_ARGS_SIGSAFE
+    const char *columns;
+    char *end;
+    long width;
+
+#if defined(DOOSHKI_ARGS_POSIX) && defined(TIOCGWINSZ)
+    struct winsize size;
+
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0)
+        return size.ws_col;
+#endif
+
+    columns = getenv("COLUMNS");
+    if (columns != NULL)
+    {
+        width = strtol(columns, &end, 10);
+        if (end != columns && *end == '\0' && width > 0 && width <= 4096)
+            return (unsigned int)width;
+    }
+#endif
+    return PAGE_WRAP_COL + 2;
+}
+
+/* Width of the names and argument template of an option on the help screen. */
+static unsigned int option_width(const char *long_name,
+                                 const char *argument_template)
+{
+    unsigned int width;
+
+    if (long_name != NULL)
+        width = LONG_START_COL + 2 + STRING_WIDTH(long_name);
+    else
+        width = SHORT_START_COL + 2;
+
+    if (argument_template != NULL)
+        width += 3 + STRING_WIDTH(argument_template);
+
+    return width;
+}
+
+/*
+ * Compute the layout of the help screen for a terminal of the given width.
+ *
+ *
+ * Descriptions are wrapped two columns before the edge of the terminal.
+ * They start past the widest option names, unless that would take up more
+ * than MAX_DESC_START_RATIO of the line, longer option names then get
+ * a line of their own.
+ */
+static void compute_layout(const struct dooshki_args *args_ctxt,
+                           unsigned int width, struct help_layout *layout)
+{
+    const struct dooshki_opt *option;
+    unsigned int max_desc_col;
+    unsigned int desc_col;
+
+    if (width < MIN_PAGE_WIDTH)
+        width = MIN_PAGE_WIDTH;
+
+    layout->wrap_col = width - 2;
+    max_desc_col     = layout->wrap_col * MAX_DESC_START_RATIO / 100;
+    layout->desc_col = (DESC_START_COL < max_desc_col)?
+                       DESC_START_COL : max_desc_col;
+
+    for (option = args_ctxt->opt_desc; ! IS_LAST_OPT(option); option++)
+    {
+        desc_col = option_width(option->long_name,
+                                option->argument_template) + 2;
+
+        if (desc_col > layout->desc_col && desc_col <= max_desc_col)
+            layout->desc_col = desc_col;
+    }
+}
+
+/*
+ * Find the next line of a line-folded description.
+ *
+ *
+ * The search starts at *word_start, which is moved past the line.  Returns 0
+ * if there are no more words, otherwise *line_start and *line_end are set to
+ * the start of the first and the end of the last word of the line.  `ascii'
+ * tells that the description is known to be pure ASCII.
+ */
+static char next_desc_line(const char *desc, char ascii,
+                           const struct help_layout *layout,
+                           unsigned int *word_start,
+                           unsigned int *line_start, unsigned int *line_end)
+{
+    unsigned int column = layout->desc_col;
+    unsigned int word_end;
+
+    find_word(desc, word_start, &word_end);
+    if (desc[*word_start] == '\0')
+        return 0;
+
+    *line_start = *word_start;
+    do
+    {
+        if (*word_start != *line_start)
+            column += 1;
+        column += text_width(&desc[*word_start], word_end - *word_start, ascii);
+
+        *line_end   = word_end;
+        *word_start = word_end;
+        find_word(desc, word_start, &word_end);
+
+    } while (desc[*word_start] != '\0' &&
+             column + 1 + text_width(&desc[*word_start],
+                                     word_end - *word_start, ascii)
+             < layout->wrap_col);
+
+    return 1;
+}
+
+/* Print a line of a description, returns the number of columns taken. */
+static unsigned int print_desc_line(const char *desc, char ascii,
+                                    unsigned int line_start,
+                                    unsigned int line_end)
+{
+    unsigned int word_start = line_start;
+    unsigned int word_end;
+    unsigned int columns = 0;
+
+    for (;;)
+    {
+        find_word(desc, &word_start, &word_end);
+        write_out(DOOSHKI_STREAM_OUT, &desc[word_start],
+                  word_end - word_start);
+        columns += text_width(&desc[word_start], word_end - word_start, ascii);
+
+        word_start = word_end;
+        if (word_start >= line_end)
+            break;
+
+        out_char(' ');
+        columns += 1;
+    }
+    return columns;
+}
+
+/*
+ * Print a line-folded description for a command-line option, either using
+ * the lines of option `opt_index' from the cache, or if it's NULL, splitting
+ * the description into lines on the way.
+ */
+static void print_opt_desc(const char *desc, unsigned int column,
+                           const struct help_layout *layout,
+                           const struct help_lines *cache,
+                           unsigned int opt_index)
+{
+    char ascii = is_ascii(desc, strlen(desc));
+    unsigned int word_start = 0;
+    unsigned int line_start;
+    unsigned int line_end;
+    unsigned int line_iter = 0;
+    unsigned int line_last = 0;
+
+    if (cache != NULL)
+    {
+        line_iter = cache->line_index[opt_index];
+        line_last = cache->line_index[opt_index + 1];
+    }
+
+    for (;;)
+    {
+        if (cache != NULL)
+        {
+            if (line_iter == line_last)
+                break;
+
+            line_start = cache->lines[line_iter * 2];
+            line_end   = cache->lines[line_iter * 2 + 1];
+            line_iter++;
+        }
+        else if (! next_desc_line(desc, ascii, layout, &word_start,
+                                  &line_start, &line_end))
+            break;
+
+        set_column(layout->desc_col, &column, 1);
+        column += print_desc_line(desc, ascii, line_start, line_end);
+    }
+}
+
+/* Print information about a command-line option. */
+static void print_option(const char *short_name,
+                         const char *long_name,
+                         const char *argument_template,
+                         const char *description,
+                         const struct help_layout *layout,
+                         const struct help_lines *cache,
+                         unsigned int opt_index)
+{
+    unsigned int column = 0;
+
+    if (short_name != NULL)
+    {
+        set_column(SHORT_START_COL, &column, 0);
+        column += out_printf("-%c", short_name[0]);
+    }
+    if (long_name != NULL)
+    {
+        if (short_name != NULL)
+        {
+            out_char(',');
+            column += 1;
+        }
+        set_column(LONG_START_COL, &column, 1);
+        out_printf("--%s", long_name);
+        column += 2 + STRING_WIDTH(long_name);
+    }
+    if (argument_template != NULL)
+    {
+        out_char((long_name != NULL)? '=' : ' ');
+        column += 1;
+        out_printf("<%s>", argument_template);
+        column += 2 + STRING_WIDTH(argument_template);
+    }
+    if (description != NULL)
+        print_opt_desc(description, column, layout, cache, opt_index);
+
+    out_char('\n');
+}
+
+/*
+ * The help cache is allocated, and after vfork() it would be shared with
+ * the parent, so it's not used in async-signal-safe builds.
+ */
+#if !defined(DOOSHKI_ARGS_SIGSAFE) && !defined(DOOSHKI_ARGS_NO_HEAP)
+#define HELP_CACHE 1
+#endif
+
+#ifndef DOOSHKI_ARGS_NO_HEAP
+/* Release the memory held by a help screen layout. */
+static void free_help_lines(struct help_lines *cache)
+{
+    if (cache != NULL)
+    {
+        free(cache->line_index);
+        free(cache->lines);
+        free(cache);
+    }
+}
+#endif
+
+#ifdef HELP_CACHE
+
+/*
+ * Threads sharing a spec may show help at the same time, the cache and the
+ * user counts of its layouts are updated under this mutex, which is not
+ * held while printing.
+ */
+#ifdef DOOSHKI_ARGS_THREADS
+static pthread_mutex_t help_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define HELP_CACHE_LOCK()   pthread_mutex_lock(&help_cache_mutex)
+#define HELP_CACHE_UNLOCK() pthread_mutex_unlock(&help_cache_mutex)
+#else
+#define HELP_CACHE_LOCK()
+#define HELP_CACHE_UNLOCK()
+#endif
+
+/* Description of the option with the given index, see dooshki_help_cache. */
+static const char *help_desc(const struct dooshki_args_spec *spec,
+                             unsigned int opt_index)
+{
+    if (opt_index < spec->opt_count)
+        return spec->args_ctxt->opt_desc[opt_index].description;
+
+    return message(spec->args_ctxt, (opt_index == spec->opt_count)?
+                   DOOSHKI_MSG_VER_DESC : DOOSHKI_MSG_HELP_DESC);
+}
+
+/*
+ * Get the help screen layout of a spec for a terminal of the given width,
+ * computing it if it's not cached yet, returns NULL if that's not possible.
+ * Has to be called under HELP_CACHE_LOCK, along with release_help_lines,
+ * which has to be called once done with the layout.
+ */
+static struct help_lines *get_help_lines(const struct dooshki_args_spec *spec,
+                                         unsigned int width)
+{
+    unsigned int desc_count = spec->opt_count + 2;
+    unsigned int line_count = 0;
+    unsigned int word_start;
+    unsigned int line_start;
+    unsigned int line_end;
+    struct help_lines *cache;
+    struct help_lines *old;
+    unsigned int iter;
+    const char *desc;
+    char ascii;
+
+    /* Specs compiled into the caller's storage have no cache. */
+    if (spec->help_cache == NULL)
+        return NULL;
+
+    cache = spec->help_cache->current;
+    if (cache != NULL && cache->width == width)
+    {
+        cache->users++;
+        return cache;
+    }
+
+    cache = malloc(sizeof(*cache));
+    if (cache == NULL)
+        return NULL;
+
+    compute_layout(spec->args_ctxt, width, &cache->layout);
+
+    for (iter = 0; iter < desc_count; iter++)
+    {
+        desc = help_desc(spec, iter);
+        if (desc == NULL)
+            continue;
+
+        ascii = is_ascii(desc, strlen(desc));
+        for (word_start = 0;
+             next_desc_line(desc, ascii, &cache->layout, &word_start,
+                            &line_start, &line_end);)
+            line_count++;
+    }
+
+    cache->line_index = malloc((desc_count + 1) * sizeof(*cache->line_index));
+    cache->lines      = malloc((line_count * 2 + 1) * sizeof(*cache->lines));
+    if (cache->line_index == NULL || cache->lines == NULL)
+    {
+        free_help_lines(cache);
+        return NULL;
+    }
+
+    for (line_count = 0, iter = 0; iter < desc_count; iter++)
+    {
+        desc = help_desc(spec, iter);
+        cache->line_index[iter] = line_count;
+        if (desc == NULL)
+            continue;
+
+        ascii = is_ascii(desc, strlen(desc));
+        for (word_start = 0;
+             next_desc_line(desc, ascii, &cache->layout, &word_start,
+                            &cache->lines[line_count * 2],
+                            &cache->lines[line_count * 2 + 1]);)
+            line_count++;
+    }
+    cache->line_index[desc_count] = line_count;
+    cache->width = width;
+    cache->users = 1;
+
+    old = spec->help_cache->current;
+    spec->help_cache->current = cache;
+    if (old != NULL && old->users == 0)
+        free_help_lines(old);
+
+    return cache;
+}
+
+/* Release a layout returned by get_help_lines, see there. */
+static void release_help_lines(const struct dooshki_args_spec *spec,
+                               struct help_lines *cache)
+{
+    cache->users--;
+    if (cache->users == 0 && cache != spec->help_cache->current)
+        free_help_lines(cache);
+}
+#endif /* HELP_CACHE */
+
+/* Print the help screen, using the layout cached in the spec if possible. */
+static void print_help(const struct dooshki_args *args_ctxt,
+                       const struct dooshki_args_spec *spec)
+{
+    struct help_lines *cache = NULL;
+    struct help_layout layout;
+    unsigned int width = terminal_width();
+    unsigned int opt_iter;
+
+#ifdef HELP_CACHE
+    if (spec != NULL)
+    {
+        HELP_CACHE_LOCK();
+        cache = get_help_lines(spec, width);
+        HELP_CACHE_UNLOCK();
+    }
+    if (cache != NULL)
+        layout = cache->layout;
+    else
+#else
+    (void)spec;
+#endif
+        compute_layout(args_ctxt, width, &layout);
+
+    print_usage(args_ctxt, 0);
+    out_printf("%s\n%s\n", args_ctxt->description,
+               message(args_ctxt, DOOSHKI_MSG_OPTIONS));
+
+    for (opt_iter = 0;
+         (args_ctxt->opt_desc[opt_iter].short_name != NULL ||
+          args_ctxt->opt_desc[opt_iter].long_name  != NULL);
+         opt_iter++)
+    {
+        print_option(args_ctxt->opt_desc[opt_iter].short_name,
+                     args_ctxt->opt_desc[opt_iter].long_name,
+                     args_ctxt->opt_desc[opt_iter].argument_template,
+                     args_ctxt->opt_desc[opt_iter].description,
+                     &layout, cache, opt_iter);
+    }
+
+    print_option(VER_SHORT_OPT_STR, VER_LONG_OPT, NULL,
+                 message(args_ctxt, DOOSHKI_MSG_VER_DESC),
+                 &layout, cache, opt_iter);
+    print_option(HELP_SHORT_OPT_STR, HELP_LONG_OPT, NULL,
+                 message(args_ctxt, DOOSHKI_MSG_HELP_DESC),
+                 &layout, cache, opt_iter + 1);
+
+#ifdef HELP_CACHE
+    if (cache != NULL)
+    {
+        HELP_CACHE_LOCK();
+        release_help_lines(spec, cache);
+        HELP_CACHE_UNLOCK();
+    }
+#endif
+}
+
+/* Print the program name and version. */
+static void print_version(const struct dooshki_args *args_ctxt)
+{
+    out_printf("%s %s\n", args_ctxt->program_name, args_ctxt->version);
+}
+
+/* Check whether options of the given type take an argument. */
+#define TAKES_ARGUMENT(type) ((type) != DOOSHKI_OPT_BOOL    && \
+                              (type) != DOOSHKI_OPT_NEGBOOL && \
+                              (type) != DOOSHKI_OPT_CB_NOARG)
+
+#ifndef DOOSHKI_ARGS_NO_HEAP
+
+/* Write a string onto stdout. */
+static void out_string(const char *str)
+{
+    write_out(DOOSHKI_STREAM_OUT, str, strlen(str));
+}
+
+/* Compare two strings referred to by pointers, for qsort. */
+static int compare_words(const void *word_a, const void *word_b)
+{
+    return strcmp(*(char * const *)word_a, *(char * const *)word_b);
+}
+
+/* Print a character within a single-quoted string of the given shell. */
+static void print_quoted_char(enum dooshki_shell shell, char ch)
+{
+    if (ch == '\'')
+        out_string((shell == DOOSHKI_SHELL_FISH)? "\\'" : "'\\''");
+    else if (ch == '\\' && shell == DOOSHKI_SHELL_FISH)
+        out_string("\\\\");
+    else
+        out_char(ch);
+}
+
+/* Print `len' characters of a string in single quotes. */
+static void print_quoted(enum dooshki_shell shell, const char *str,
+                         size_t len)
+{
+    size_t iter;
+
+    out_char('\'');
+    for (iter = 0; iter < len; iter++)
+        print_quoted_char(shell, str[iter]);
+    out_char('\'');
+}
+
+/*
+ * Print the choices listed by an argument template such as "GOOD|BAD|UGLY",
+ * returns 0 without printing anything if the template doesn't list choices.
+ *
+ * Fish takes the choices as a single string, other shells as separate words.
+ */
+static char print_choices(enum dooshki_shell shell, const char *template)
+{
+    const char *choice;
+    size_t len;
+
+    if (template == NULL || strchr(template, '|') == NULL)
         return 0;
+
+    if (shell == DOOSHKI_SHELL_FISH)
+    {
+        out_char('\'');
+        for (; *template != '\0'; template++)
+            print_quoted_char(shell, (*template == '|')? ' ' : *template);
+        out_char('\'');
+        return 1;
+    }
+
+    for (choice = template; ; choice += len + 1)
+    {
+        len = strcspn(choice, "|");
+        out_char(' ');
+        print_quoted(shell, choice, len);
+
+        if (choice[len] == '\0')
+            break;
+    }
+    return 1;
+}
+
+/* Print a shell case pattern matching the names of an option. */
+static void print_opt_pattern(enum dooshki_shell shell,
+                              const struct dooshki_opt *option)
+{
+    if (option->short_name != NULL)
+    {
+        out_char('-');
+        print_quoted(shell, option->short_name, 1);
+    }
+    if (option->short_name != NULL && option->long_name != NULL)
+        out_char('|');
+
+    if (option->long_name != NULL)
+    {
+        out_string("--");
+        print_quoted(shell, option->long_name, strlen(option->long_name));
+    }
+}
+
+/*
+ * Print the case branches completing option arguments, for bash or zsh.
+ *
+ * Options with a list of choices get a branch each, all of the other options
+ * taking an argument share one, which falls back to completing file names.
+ */
+static void print_arg_cases(const struct dooshki_args *args_ctxt,
+                            enum dooshki_shell shell, const char *ident)
+{
+    const struct dooshki_opt *option;
+    char first = 1;
+
+    for (option = args_ctxt->opt_desc; ! IS_LAST_OPT(option); option++)
+    {
+        if (! TAKES_ARGUMENT(option->type) ||
+            option->argument_template == NULL ||
+            strchr(option->argument_template, '|') == NULL)
+            continue;
+
+        out_string("        ");
+        print_opt_pattern(shell, option);
+
+        if (shell == DOOSHKI_SHELL_BASH)
+            out_printf(")\n            _dooshki_%s_match", ident);
+        else
+            out_printf(")\n            compadd --");
+
+        print_choices(shell, option->argument_template);
+        out_printf("\n            return ;;\n");
+    }
+
+    for (option = args_ctxt->opt_desc; ! IS_LAST_OPT(option); option++)
+    {
+        if (! TAKES_ARGUMENT(option->type) ||
+            (option->argument_template != NULL &&
+             strchr(option->argument_template, '|') != NULL))
+            continue;
+
+        out_string(first? "        " : "|");
+        print_opt_pattern(shell, option);
+        first = 0;
+    }
+
+    if (! first)
+    {
+        out_printf(")\n%s            return ;;\n",
+                   (shell == DOOSHKI_SHELL_BASH)? "" : "            _files\n");
+    }
+}
+
+
+/*
+ * Collect the names of all options, including the dashes, sorted by strcmp
+ * and without duplicates.  The array and the names are allocated as a single
+ * block, to be released with free().  Returns NULL on failure.
+ */
+static char **sorted_opt_words(const struct dooshki_args *args_ctxt,
+                               unsigned int *word_count)
+{
+    static const char *const builtin_words[] =
+    {
+        "-" HELP_SHORT_OPT_STR, "--" HELP_LONG_OPT,
+        "-" VER_SHORT_OPT_STR,  "--" VER_LONG_OPT
+    };
+    const struct dooshki_opt *option;
+    unsigned int count = 4;
+    unsigned int unique;
+    unsigned int iter;
+    size_t text_size = 0;
+    char **words;
+    char *text;
+
+    for (option = args_ctxt->opt_desc; ! IS_LAST_OPT(option); option++)
+    {
+        if (option->short_name != NULL)
+        {
+            count     += 1;
+            text_size += 3;
+        }
+        if (option->long_name != NULL)
+        {
+            count     += 1;
+            text_size += strlen(option->long_name) + 3;
+        }
+    }
+
+    words = malloc(count * sizeof(*words) + text_size);
+    if (words == NULL)
+        return NULL;
+
+    text  = (char *)&words[count];
+    count = 0;
+    for (option = args_ctxt->opt_desc; ! IS_LAST_OPT(option); option++)
+    {
+        if (option->short_name != NULL)
+        {
+            words[count++] = text;
+            text[0] = '-';
+            text[1] = option->short_name[0];
+            text[2] = '\0';
+            text += 3;
+        }
+        if (option->long_name != NULL)
+        {
+            words[count++] = text;
+            text[0] = '-';
+            text[1] = '-';
+            strcpy(&text[2], option->long_name);
+            text += strlen(text) + 1;
+        }
+    }
+    for (iter = 0; iter < 4; iter++)
+        words[count++] = (char *)builtin_words[iter];
+
+    qsort(words, count, sizeof(*words), compare_words);
+
+    for (unique = 0, iter = 0; iter < count; iter++)
+    {
+        if (unique == 0 || strcmp(words[unique - 1], words[iter]) != 0)
+            words[unique++] = words[iter];
+    }
+
+    *word_count = unique;
+    return words;
+}
+
+/* Print a table of words as the contents of a shell array. */
+static void print_word_table(enum dooshki_shell shell, const char *ident,
+                             char **words, unsigned int word_count)
+{
+    unsigned int iter;
+
+    out_printf("_dooshki_%s_opts=(\n", ident);
+    for (iter = 0; iter < word_count; iter++)
+    {
+        out_string("    ");
+        print_quoted(shell, words[iter], strlen(words[iter]));
+        out_char('\n');
+    }
+    out_printf(")\n\n");
+}
+
+/* Print a bash completion script. */
+static void print_bash_completion(const struct dooshki_args *args_ctxt,
+                                  const char *ident,
+                                  char **words, unsigned int word_count)
+{
+    out_printf("# bash completion for %s, generated by dooshki_args.\n\n",
+               args_ctxt->program_name);
+
+    print_word_table(DOOSHKI_SHELL_BASH, ident, words, word_count);
+
+    out_printf("_dooshki_%s_match()\n"
+               "{\n"
+               "    local word\n"
+               "\n"
+               "    for word in \"$@\"; do\n"
+               "        [[ $word == \"$cur\"* ]] && COMPREPLY+=( \"$word\" )\n"
+               "    done\n"
+               "}\n"
+               "\n", ident);
+
+    out_printf("_dooshki_%s()\n"
+               "{\n"
+               "    local cur=${COMP_WORDS[COMP_CWORD]}"
+               " prev=${COMP_WORDS[COMP_CWORD-1]}\n"
+               "    local LC_ALL=C lo=0 hi=${#_dooshki_%s_opts[@]} mid\n"
+               "\n"
+               "    COMPREPLY=()\n"
+               "    if [[ $cur == = ]]; then\n"
+               "        cur=\n"
+               "    elif [[ $prev == = ]]; then\n"
+               "        prev=${COMP_WORDS[COMP_CWORD-2]}\n"
+               "    fi\n"
+               "\n"
+               "    case $prev in\n", ident, ident);
+
+    print_arg_cases(args_ctxt, DOOSHKI_SHELL_BASH, ident);
+
+    out_printf("    esac\n"
+               "\n"
+               "    [[ $cur == -* ]] || return\n"
+               "\n"
+               "    # Find the first name not sorting before the current word.\n"
+               "    while (( lo < hi )); do\n"
+               "        mid=$(( (lo + hi) / 2 ))\n"
+               "        if [[ ${_dooshki_%s_opts[mid]} < $cur ]]; then\n"
+               "            lo=$(( mid + 1 ))\n"
+               "        else\n"
+               "            hi=$mid\n"
+               "        fi\n"
+               "    done\n"
+               "\n", ident);
+
+    out_printf("    hi=${#_dooshki_%s_opts[@]}\n"
+               "    while (( lo < hi )) &&"
+               " [[ ${_dooshki_%s_opts[lo]} == \"$cur\"* ]]; do\n"
+               "        COMPREPLY+=( \"${_dooshki_%s_opts[lo]}\" )\n"
+               "        lo=$(( lo + 1 ))\n"
+               "    done\n"
+               "}\n"
+               "\n", ident, ident, ident);
+
+    out_printf("complete -o default -F _dooshki_%s ", ident);
+    print_quoted(DOOSHKI_SHELL_BASH, args_ctxt->program_name,
+                 strlen(args_ctxt->program_name));
+    out_char('\n');
+}
+
+/* Print a zsh completion script. */
+static void print_zsh_completion(const struct dooshki_args *args_ctxt,
+                                 const char *ident,
+                                 char **words, unsigned int word_count)
+{
+    out_printf("#compdef %s\n"
+               "# zsh completion for %s, generated by dooshki_args.\n\n",
+               args_ctxt->program_name, args_ctxt->program_name);
+
+    print_word_table(DOOSHKI_SHELL_ZSH, ident, words, word_count);
+
+    out_printf("_dooshki_%s()\n"
+               "{\n"
+               "    local prev=${words[CURRENT-1]}\n"
+               "\n"
+               "    if compset -P '--*='; then\n"
+               "        prev=${IPREFIX%%=}\n"
+               "    fi\n"
+               "\n"
+               "    case $prev in\n", ident);
+
+    print_arg_cases(args_ctxt, DOOSHKI_SHELL_ZSH, ident);
+
+    out_printf("    esac\n"
+               "\n"
+               "    if [[ $PREFIX == -* ]]; then\n"
+               "        compadd -- $_dooshki_%s_opts\n"
+               "    else\n"
+               "        _files\n"
+               "    fi\n"
+               "}\n"
+               "\n"
+               "compdef _dooshki_%s ", ident, ident);
+    print_quoted(DOOSHKI_SHELL_ZSH, args_ctxt->program_name,
+                 strlen(args_ctxt->program_name));
+    out_char('\n');
+}
+
+/* Print a fish completion command for a single option. */
+static void print_fish_option(const char *program_name,
+                              const char *short_name, const char *long_name,
+                              const char *template, enum dooshki_opt_type type,
+                              const char *description)
+{
+    out_string("complete -c ");
+    print_quoted(DOOSHKI_SHELL_FISH, program_name, strlen(program_name));
+
+    if (short_name != NULL)
+    {
+        out_string(" -s ");
+        print_quoted(DOOSHKI_SHELL_FISH, short_name, 1);
+    }
+    if (long_name != NULL)
+    {
+        out_string(" -l ");
+        print_quoted(DOOSHKI_SHELL_FISH, long_name, strlen(long_name));
+    }
+    if (TAKES_ARGUMENT(type))
+    {
+        if (template != NULL && strchr(template, '|') != NULL)
+        {
+            out_string(" -x -a ");
+            print_choices(DOOSHKI_SHELL_FISH, template);
+        }
+        else
+            out_string(" -r");
+    }
+    if (description != NULL)
+    {
+        out_string(" -d ");
+        print_quoted(DOOSHKI_SHELL_FISH, description, strlen(description));
+    }
+    out_char('\n');
+}
+
+/* Print a fish completion script. */
+static void print_fish_completion(const struct dooshki_args *args_ctxt)
+{
+    const struct dooshki_opt *option;
+
+    out_printf("# fish completion for %s, generated by dooshki_args.\n\n",
+               args_ctxt->program_name);
+
+    for (option = args_ctxt->opt_desc; ! IS_LAST_OPT(option); option++)
+    {
+        print_fish_option(args_ctxt->program_name, option->short_name,
+                          option->long_name, option->argument_template,
+                          option->type, option->description);
+    }
+    print_fish_option(args_ctxt->program_name, VER_SHORT_OPT_STR,
+                      VER_LONG_OPT, NULL, DOOSHKI_OPT_BOOL,
+                      message(args_ctxt, DOOSHKI_MSG_VER_DESC));
+    print_fish_option(args_ctxt->program_name, HELP_SHORT_OPT_STR,
+                      HELP_LONG_OPT, NULL, DOOSHKI_OPT_BOOL,
+                      message(args_ctxt, DOOSHKI_MSG_HELP_DESC));
+}
+
+#endif /* DOOSHKI_ARGS_NO_HEAP */
+
+/* State of a single run of the parser. */
+struct parse_state
+{
+    int *argc;
+    char ***argv;
+
+    const struct dooshki_args *args_ctxt;
+    const struct dooshki_args_spec *spec;   /* NULL if not compiled */
+    const struct dooshki_args_image *image; /* NULL if not given */
+
+    char show_help;
+    char show_version;
+    char errors_found;
+
+    /* Events not yet passed to the trace hook, if there is one. */
+    struct dooshki_trace_event trace_events[TRACE_BATCH];
+    unsigned int trace_count;
+
+#ifdef DOOSHKI_ARGS_STATS
+    struct dooshki_args_stats *stats;       /* NULL if not requested */
+    unsigned long phase_start;
+#endif
+};
+
+#ifdef DOOSHKI_ARGS_STATS
+/* Current time in nanoseconds, for measuring the duration of phases. */
+static unsigned long stats_clock(void)
+{
+#ifdef DOOSHKI_ARGS_POSIX
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long)now.tv_sec * 1000000000UL +
+           (unsigned long)now.tv_nsec;
+#else
+    return (unsigned long)((double)clock() * (1e9 / CLOCKS_PER_SEC));
+#endif
+}
+
+#define STATS_COUNT(state, field, amount) \
+    do { \
+        if ((state)->stats != NULL) \
+            (state)->stats->field += (amount); \
+    } while (0)
+
+#define STATS_PHASE_BEGIN(state) \
+    do { \
+        if ((state)->stats != NULL) \
+            (state)->phase_start = stats_clock(); \
+    } while (0)
+
+#define STATS_PHASE_END(state, phase) \
+    do { \
+        if ((state)->stats != NULL) \
+            (state)->stats->phase_ns[phase] += \
+                stats_clock() - (state)->phase_start; \
+    } while (0)
+#else
+#define STATS_COUNT(state, field, amount)
+#define STATS_PHASE_BEGIN(state)
+#define STATS_PHASE_END(state, phase)
+#endif
+
+/* Pass the buffered trace events to the trace hook. */
+static void trace_flush(struct parse_state *state)
+{
+    if (state->trace_count > 0)
+    {
+        state->args_ctxt->trace_hook(state->args_ctxt, state->trace_events,
+                                     state->trace_count,
+                                     state->args_ctxt->trace_data);
+        state->trace_count = 0;
+    }
+}
+
+/*
+ * Add an event to the trace buffer, only to be called if there is a trace
+ * hook.  The argument of the most recent event may be filled in later.
+ */
+static void trace_event(struct parse_state *state, int opt_index,
+                        int argv_index, const char *argument)
+{
+    struct dooshki_trace_event *event;
+
+    if (state->trace_count == TRACE_BATCH)
+        trace_flush(state);
+
+    event = &state->trace_events[state->trace_count++];
+    event->opt_index  = opt_index;
+    event->argv_index = argv_index;
+    event->argument   = argument;
+}
+
+/* Collect a string argument. */
+static char process_str_arg(const struct dooshki_opt *option,
+                            const char *argument)
+{
+    const char **dest = option->opt_storage;
+    *dest = argument;
+    return 1;
+}
+
+/* Outcome of a numeric conversion. */
+enum conv_status
+{
+    CONV_OK,
+    CONV_INVALID,
+    CONV_TOO_LARGE,
+    CONV_TOO_SMALL,
+    CONV_UNDERFLOW
+};
+
+#ifndef DOOSHKI_ARGS_SIGSAFE
+
+/* Convert an unsigned integer, the result is stored even on failure. */
+static enum conv_status convert_uint(const char *text, unsigned long *dest)
+{
+    char *test_ptr;
+
+    errno = 0;
+    *dest = strtoul(text, &test_ptr, 10);
+    if (*test_ptr != '\0' || text[0] == '-')
+        return CONV_INVALID;
+
+    if (*dest == ULONG_MAX && errno == ERANGE)
+        return CONV_TOO_LARGE;
+
+    return CONV_OK;
+}
+
+/* Convert a signed integer, the result is stored even on failure. */
+static enum conv_status convert_int(const char *text, long *dest)
+{
+    char *test_ptr;
+
+    errno = 0;
+    *dest = strtol(text, &test_ptr, 10);
+    if (*test_ptr != '\0')
+        return CONV_INVALID;
+
+    if (*dest == LONG_MAX && errno == ERANGE)
+        return CONV_TOO_LARGE;
+
+    if (*dest == LONG_MIN && errno == ERANGE)
+        return CONV_TOO_SMALL;
+
+    return CONV_OK;
+}
+
+/* Convert a floating point number, the result is stored even on failure. */
+static enum conv_status convert_float(const char *text, double *dest)
+{
+    char *test_ptr;
+
+    errno = 0;
+    *dest = strtod(text, &test_ptr);
+    if (*test_ptr != '\0')
+        return CONV_INVALID;
+
+    if (*dest == HUGE_VAL && errno == ERANGE)
+        return CONV_TOO_LARGE;
+
+    if (*dest == -HUGE_VAL && errno == ERANGE)
+        return CONV_TOO_SMALL;
+
+    if (*dest == 0 && errno == ERANGE)
+        return CONV_UNDERFLOW;
+
+    return CONV_OK;
+}
+
+#else /* DOOSHKI_ARGS_SIGSAFE */
+
+/*
+ * Number conversion without strtol and friends, which aren't async-signal
+ * safe, use errno and depend on the locale.  The syntax is that of the C
+ * locale, except that floating point numbers have to be decimal, or one of
+ * "inf", "infinity" and "nan" (in any case).
+ */
+
+/* Skip leading white space and a sign, returns 1 for a minus sign. */
+static char scan_sign(const char **text)
+{
+    while (IS_SPACE(**text))
+        (*text)++;
+
+    if (**text == '+' || **text == '-')
+        return (*(*text)++ == '-');
+
+    return 0;
+}
+
+/*
+ * Scan the digits of an integer, saturating at `limit'.  Returns CONV_OK,
+ * CONV_TOO_LARGE if the limit is exceeded, or CONV_INVALID if there are
+ * no digits or anything follows them.
+ */
+static enum conv_status scan_integer(const char *text, unsigned long limit,
+                                     unsigned long *dest)
+{
+    enum conv_status status = CONV_OK;
+    unsigned long value = 0;
+    unsigned int digit;
+
+    *dest = 0;
+    if (*text < '0' || *text > '9')
+        return CONV_INVALID;
+
+    for (; *text >= '0' && *text <= '9'; text++)
+    {
+        digit = (unsigned int)(*text - '0');
+        if (value > (limit - digit) / 10)
+        {
+            value  = limit;
+            status = CONV_TOO_LARGE;
+        }
+        else if (status == CONV_OK)
+            value = value * 10 + digit;
+    }
+    *dest = value;
+
+    return (*text != '\0')? CONV_INVALID : status;
+}
+
+/* Convert an unsigned integer, the result is stored even on failure. */
+static enum conv_status convert_uint(const char *text, unsigned long *dest)
+{
+    *dest = 0;
+    if (scan_sign(&text))
+        return CONV_INVALID;
+
+    return scan_integer(text, ULONG_MAX, dest);
+}
+
+/* Convert a signed integer, the result is stored even on failure. */
+static enum conv_status convert_int(const char *text, long *dest)
+{
+    enum conv_status status;
+    unsigned long magnitude;
+    char negative = scan_sign(&text);
+
+    /* LONG_MIN, written so that it doesn't overflow. */
+    status = scan_integer(text, negative? (unsigned long)LONG_MAX + 1
+                                        : (unsigned long)LONG_MAX,
+                          &magnitude);
+
+    if (! negative)
+        *dest = (long)magnitude;
+    else if (magnitude > (unsigned long)LONG_MAX)
+        *dest = LONG_MIN;
+    else
+        *dest = -(long)magnitude;
+
+    if (status == CONV_TOO_LARGE && negative)
+        return CONV_TOO_SMALL;
+
+    return status;
+}
+
+/* Compare the start of a text with a lowercase word, ignoring case. */
+static char match_word(const char *text, const char *word)
+{
+    for (; *word != '\0'; text++, word++)
+    {
+        if (*text != *word && *text != *word - 'a' + 'A')
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Collect a digit of a floating point number, see convert_float.  Up to 19
+ * significant digits are kept, `*exponent' accounts for the digits past
+ * the decimal point and for those which are dropped.
+ */
+static void collect_digit(char digit, char fraction, long double *value,
+                          int *digits, long *exponent)
+{
+    if (*digits < 19)
+    {
+        if (*digits > 0 || digit != '0')
+        {
+            *value = *value * 10 + (digit - '0');
+            (*digits)++;
+        }
+        *exponent -= fraction;
+    }
+    else
+        *exponent += ! fraction;
+}
+
+/*
+ * Convert a floating point number, the result is stored even on failure.
+ *
+ * The significant digits are scaled by the power of ten in steps of at
+ * most 1e22, which are exact.  Numbers with up to 15 significant digits
+ * and a power of ten within 1e22 are converted exactly, like with strtod,
+ * others may differ from what strtod returns in the last bit.
+ */
+static enum conv_status convert_float(const char *text, double *dest)
+{
+    static const double powers[23] =
+    {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10,
+        1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21,
+        1e22
+    };
+    const char *digits_start;
+    long double value = 0;
+    long exponent = 0;
+    long exp_value = 0;
+    int digits = 0;
+    char negative = scan_sign(&text);
+    char exp_negative;
+
+    *dest = 0;
+
+    if (match_word(text, "inf"))
+    {
+        text += match_word(text, "infinity")? 8 : 3;
+        *dest = negative? -HUGE_VAL : HUGE_VAL;
+        return (*text != '\0')? CONV_INVALID : CONV_OK;
+    }
+    if (match_word(text, "nan"))
+    {
+        *dest = HUGE_VAL - HUGE_VAL;
+        return (text[3] != '\0')? CONV_INVALID : CONV_OK;
+    }
+
+    digits_start = text;
+    for (; *text >= '0' && *text <= '9'; text++)
+        collect_digit(*text, 0, &value, &digits, &exponent);
+
+    if (*text == '.')
+    {
+        for (text++; *text >= '0' && *text <= '9'; text++)
+            collect_digit(*text, 1, &value, &digits, &exponent);
+    }
+    /* No digits, at most a decimal point. */
+    if (text - digits_start == (*digits_start == '.'))
+        return CONV_INVALID;
+
+    if (*text == 'e' || *text == 'E')
+    {
+        text++;
+        exp_negative = scan_sign(&text);
+        if (*text < '0' || *text > '9')
+            return CONV_INVALID;
+
+        for (; *text >= '0' && *text <= '9'; text++)
+        {
+            if (exp_value < 100000)
+                exp_value = exp_value * 10 + (*text - '0');
+        }
+        exponent += exp_negative? -exp_value : exp_value;
+    }
+    if (*text != '\0')
+        return CONV_INVALID;
+
+    if (digits == 0)
+    {
+        *dest = negative? -0.0 : 0.0;
+        return CONV_OK;
+    }
+
+    /* With at most 19 digits, these are out of the range of double. */
+    if (exponent > 400)
+        value = HUGE_VAL;
+    else if (exponent < -400)
+        value = 0;
+    else if (digits <= 15 && exponent >= -22 && exponent <= 22)
+    {
+        /* Both operands are exact, so the result is correctly rounded. */
+        if (exponent >= 0)
+            *dest = (double)value * powers[exponent];
+        else
+            *dest = (double)value / powers[-exponent];
+
+        *dest = negative? -*dest : *dest;
+        return CONV_OK;
+    }
+    else
+    {
+        for (; exponent > 22; exponent -= 22)
+            value *= powers[22];
+        for (; exponent < -22; exponent += 22)
+            value /= powers[22];
+
+        if (exponent >= 0)
+            value *= powers[exponent];
+        else
+            value /= powers[-exponent];
+    }
+
+    if (value > DBL_MAX)
+    {
+        *dest = negative? -HUGE_VAL : HUGE_VAL;
+        return negative? CONV_TOO_SMALL : CONV_TOO_LARGE;
+    }
+
+    *dest = (double)(negative? -value : value);
+    return (*dest == 0)? CONV_UNDERFLOW : CONV_OK;
+}
+
+#endif /* DOOSHKI_ARGS_SIGSAFE */
+
+
+/* Convert a number of one of the numeric option types. */
+static enum conv_status convert_number(enum dooshki_opt_type type,
+                                       const char *text, void *dest)
+{
+    switch (type)
+    {
+        case DOOSHKI_OPT_INT:
+            return convert_int(text, dest);
+
+        case DOOSHKI_OPT_UINT:
+            return convert_uint(text, dest);
+
+        case DOOSHKI_OPT_FLOAT:
+            return convert_float(text, dest);
+
+        default:
+            return CONV_INVALID;
+    }
+}
+
+/* Describe a conversion failure, to be used as the end of a sentence. */
+static const char *conv_problem(const struct dooshki_args *args_ctxt,
+                                enum conv_status status,
+                                enum dooshki_opt_type type)
+{
+    switch (status)
+    {
+        case CONV_TOO_LARGE:
+            return message(args_ctxt, DOOSHKI_MSG_TOO_LARGE);
+
+        case CONV_TOO_SMALL:
+            return message(args_ctxt, DOOSHKI_MSG_TOO_SMALL);
+
+        case CONV_UNDERFLOW:
+            return message(args_ctxt, DOOSHKI_MSG_UNDERFLOW);
+
+        default:
+            break;
+    }
+
+    switch (type)
+    {
+        case DOOSHKI_OPT_INT:
+            return message(args_ctxt, DOOSHKI_MSG_NOT_INT);
+
+        case DOOSHKI_OPT_UINT:
+            return message(args_ctxt, DOOSHKI_MSG_NOT_UINT);
+
+        default:
+            return message(args_ctxt, DOOSHKI_MSG_NOT_FLOAT);
+    }
+}
+
+/* Collect a numeric argument. */
+static char process_num_arg(const struct dooshki_args *args_ctxt,
+                            const struct dooshki_opt  *option,
+                            const char  *opt_prefix,
+                            const char  *opt_name,
+                            const char  *argument)
+{
+    enum conv_status status;
+
+    status = convert_number(option->type, argument, option->opt_storage);
+    if (status != CONV_OK)
+    {
+        print_error(args_ctxt,
+                    message(args_ctxt, DOOSHKI_MSG_BAD_ARGUMENT),
+                    argument, opt_prefix, opt_name,
+                    conv_problem(args_ctxt, status, option->type));
+        return 0;
+    }
+    return 1;
+}
+
+/* Process the argument of an option, returns 1 on success, 0 on failure. */
+static char process_opt_arg(struct parse_state *state,
+                            const struct dooshki_opt *option,
+                            char         opt_is_long,
+                            const char  *argument)
+{
+    const struct dooshki_args *args_ctxt = state->args_ctxt;
+    const char *opt_prefix;
+    const char *opt_name;
+    char retval = 1;
+
+    if (opt_is_long)
+    {
+        opt_prefix = "--";
+        opt_name   = option->long_name;
+    }
+    else
+    {
+        opt_prefix = "-";
+        opt_name   = option->short_name;
+    }
+
+    if (args_ctxt->trace_hook != NULL)
+        state->trace_events[state->trace_count - 1].argument = argument;
+
+    STATS_PHASE_BEGIN(state);
+
+    switch (option->type)
+    {
+        case DOOSHKI_OPT_STR:
+            if (! process_str_arg(option, argument))
+                retval = 0;
+
+            STATS_PHASE_END(state, DOOSHKI_PHASE_CONVERSION);
+            break;
+
+        case DOOSHKI_OPT_INT:
+        case DOOSHKI_OPT_UINT:
+        case DOOSHKI_OPT_FLOAT:
+            if (! process_num_arg(args_ctxt, option, opt_prefix, opt_name,
+                                  argument))
+                retval = 0;
+
+            STATS_PHASE_END(state, DOOSHKI_PHASE_CONVERSION);
+            break;
+
+        case DOOSHKI_OPT_CB:
+            if (! option->callback(argument, option->opt_storage, opt_prefix,
+                                   opt_name, option->callback_data))
+                retval = 0;
+
+            STATS_COUNT(state, callbacks, 1);
+            STATS_PHASE_END(state, DOOSHKI_PHASE_CALLBACKS);
+            break;
+
+        default:
+            print_error(args_ctxt,
+                        "Bug: Unknown argument type %u for option %s%s",
+                         (unsigned int)option->type, opt_prefix, opt_name);
+            retval = 0;
+    }
+    return retval;
+}
+
+/*
+ * Process a range of entries in a list, from `from' up to, but not including
+ * `to'.
+ *
+ * If `report' is zero, processing stops at the first failed entry, otherwise
+ * all of the entries are processed and an error is printed for each failure.
+ *
+ * Returns the index of the first failed entry, or `to' if none failed.
+ */
+typedef int (*bulk_range_fn)(void *bulk_data, int from, int to, char report);
+
+#ifdef DOOSHKI_ARGS_THREADS
+struct bulk_job
+{
+    bulk_range_fn range_fn;
+    void *bulk_data;
+
+    int from;
+    int to;
+    int first_failure;
+
+    pthread_t thread;
+    char thread_started;
+};
+
+static void *bulk_worker(void *job_ptr)
+{
+    struct bulk_job *job = job_ptr;
+
+    job->first_failure = job->range_fn(job->bulk_data, job->from, job->to, 0);
+    return NULL;
+}
+
+/* Determine how many threads to split a list of entries between. */
+static int bulk_thread_count(int count)
+{
+    int threads = count / (BULK_PARALLEL_MIN / 2);
+
+#ifdef _SC_NPROCESSORS_ONLN
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (cpus > 0 && threads > cpus)
+        threads = (int)cpus;
+#endif
+    if (threads > BULK_MAX_THREADS)
+        threads = BULK_MAX_THREADS;
+
+    return threads;
+}
+#endif
+
+/*
+ * Process a list of entries, returns 1 on success, 0 on failure.
+ *
+ * Long lists are split into chunks which are processed in parallel, each
+ * chunk which failed is then re-processed serially starting with its first
+ * failed entry, so that errors are reported in the order of the entries
+ * regardless of how the work was scheduled.
+ */
+static char bulk_process(bulk_range_fn range_fn, void *bulk_data, int count)
+{
+#ifdef DOOSHKI_ARGS_THREADS
+    if (count >= BULK_PARALLEL_MIN && bulk_thread_count(count) > 1)
+    {
+        struct bulk_job jobs[BULK_MAX_THREADS];
+        int threads = bulk_thread_count(count);
+        int job_iter;
+        char retval = 1;
+
+        for (job_iter = 0; job_iter < threads; job_iter++)
+        {
+            jobs[job_iter].range_fn  = range_fn;
+            jobs[job_iter].bulk_data = bulk_data;
+            jobs[job_iter].from = (int)((double)count * job_iter / threads);
+            jobs[job_iter].to   = (int)((double)count * (job_iter + 1) /
+                                        threads);
+            jobs[job_iter].thread_started = 0;
+
+            /* The first chunk is processed by the calling thread. */
+            if (job_iter > 0 &&
+                pthread_create(&jobs[job_iter].thread, NULL,
+                               bulk_worker, &jobs[job_iter]) == 0)
+                jobs[job_iter].thread_started = 1;
+        }
+        for (job_iter = 0; job_iter < threads; job_iter++)
+        {
+            if (jobs[job_iter].thread_started)
+                pthread_join(jobs[job_iter].thread, NULL);
+            else
+                bulk_worker(&jobs[job_iter]);
+        }
+
+        for (job_iter = 0; job_iter < threads; job_iter++)
+        {
+            if (jobs[job_iter].first_failure != jobs[job_iter].to)
+            {
+                range_fn(bulk_data, jobs[job_iter].first_failure,
+                         jobs[job_iter].to, 1);
+                retval = 0;
+            }
+        }
+        return retval;
+    }
+#endif
+    return (range_fn(bulk_data, 0, count, 1) == count)? 1 : 0;
+}
+
+/* Context of a numeric list conversion. */
+struct conv_list
+{
+    const struct dooshki_args *args_ctxt;
+    enum dooshki_opt_type type;
+    const char *list_name;
+
+    char **entries;
+    void *values;
+};
+
+/* Convert a range of a numeric list, see bulk_range_fn. */
+static int conv_list_range(void *bulk_data, int from, int to, char report)
+{
+    struct conv_list *list = bulk_data;
+    int first_failure = to;
+    int iter;
+
+    for (iter = from; iter < to; iter++)
+    {
+        enum conv_status status;
+
+        switch (list->type)
+        {
+            case DOOSHKI_OPT_INT:
+                status = convert_int(list->entries[iter],
+                                     &((long *)list->values)[iter]);
+                break;
+
+            case DOOSHKI_OPT_UINT:
+                status = convert_uint(list->entries[iter],
+                                      &((unsigned long *)list->values)[iter]);
+                break;
+
+            default:
+                status = convert_float(list->entries[iter],
+                                       &((double *)list->values)[iter]);
+                break;
+        }
+
+        if (status != CONV_OK)
+        {
+            if (!report)
+                return iter;
+
+            if (first_failure == to)
+                first_failure = iter;
+
+            print_error(list->args_ctxt,
+                        message(list->args_ctxt, DOOSHKI_MSG_BAD_ENTRY),
+                        iter + 1, list->list_name, list->entries[iter],
+                        conv_problem(list->args_ctxt, status, list->type));
+        }
+    }
+    return first_failure;
+}
+
+/* Context of a file list check. */
+struct file_list
+{
+    const struct dooshki_args *args_ctxt;
+    unsigned int checks;
+
+    char **entries;
+    enum dooshki_file_status *statuses;
+};
+
+/* Check a single file, `*error_code' is set to an errno value on failure. */
+static enum dooshki_file_status check_file(const char *path,
+                                           unsigned int checks,
+                                           int *error_code)
+{
+#ifdef DOOSHKI_ARGS_POSIX
+    struct stat file_info;
+    int fd;
+
+    if (stat(path, &file_info) != 0)
+    {
+        *error_code = errno;
+        return (errno == ENOENT || errno == ENOTDIR)?
+               DOOSHKI_FILE_MISSING : DOOSHKI_FILE_UNREADABLE;
+    }
+
+    if ((checks & DOOSHKI_FILE_REGULAR) && !S_ISREG(file_info.st_mode))
+    {
+        *error_code = 0;
+        return DOOSHKI_FILE_NOT_REGULAR;
+    }
+
+    if (checks & DOOSHKI_FILE_READABLE)
+    {
+        /* O_NONBLOCK prevents hanging on FIFOs without a writer. */
+        fd = open(path, O_RDONLY | O_NOCTTY | O_NONBLOCK);
+        if (fd < 0)
+        {
+            *error_code = errno;
+            return DOOSHKI_FILE_UNREADABLE;
+        }
+        close(fd);
+    }
+#elif !defined(DOOSHKI_ARGS_NO_STDIO)
+    FILE *file;
+
+    /* ANSI C can only tell whether a file can be opened. */
+    (void)checks;
+
+    errno = 0;
+    file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        *error_code = errno;
+        return DOOSHKI_FILE_UNREADABLE;
+    }
+    fclose(file);
+#else
+    /* Neither POSIX nor stdio, there's no way to reach the file. */
+    (void)path;
+    (void)checks;
+
+    *error_code = 0;
+    return DOOSHKI_FILE_UNREADABLE;
+#endif
+    *error_code = 0;
+    return DOOSHKI_FILE_OK;
+}
+
+/* Check a range of a file list, see bulk_range_fn. */
+static int file_list_range(void *bulk_data, int from, int to, char report)
+{
+    struct file_list *list = bulk_data;
+    int first_failure = to;
+    int iter;
+
+    for (iter = from; iter < to; iter++)
+    {
+        enum dooshki_file_status status;
+        int error_code;
+
+        status = check_file(list->entries[iter], list->checks, &error_code);
+        if (list->statuses != NULL)
+            list->statuses[iter] = status;
+
+        if (status != DOOSHKI_FILE_OK)
+        {
+            if (!report)
+                return iter;
+
+            if (first_failure == to)
+                first_failure = iter;
+
+            if (status == DOOSHKI_FILE_NOT_REGULAR)
+                print_error(list->args_ctxt,
+                            message(list->args_ctxt,
+                                    DOOSHKI_MSG_NOT_REGULAR),
+                            list->entries[iter]);
+
+            else if (error_code != 0)
+                print_error(list->args_ctxt,
+                            message(list->args_ctxt,
+                                    DOOSHKI_MSG_ACCESS_ERROR),
+                            list->entries[iter], strerror(error_code));
+
+            else
+                print_error(list->args_ctxt,
+                            message(list->args_ctxt, DOOSHKI_MSG_NO_ACCESS),
+                            list->entries[iter]);
+        }
+    }
+    return first_failure;
+}
+
+/* Classes of command-line words. */
+enum word_class
+{
+    WORD_POSITIONAL,
+    WORD_SHORT_OPTS,    /* -abc, also a lone dash */
+    WORD_LONG_OPT,      /* --option, --option=argument */
+    WORD_STOPPER        /* -- */
+};
+
+/*
+ * Find the first '=' or '\0' in a string, returns its offset.
+ *
+ *
+ * The vectorized variants only perform aligned loads, which never cross
+ * a page boundary, so the bytes read beyond the end of the string are
+ * always accessible.
+ */
+static unsigned int find_eq_or_end(const char *str)
+{
+#if defined(SIMD_AVX2)
+    const char *block = (const char *)((size_t)str & ~(size_t)31);
+    const __m256i eq_sign = _mm256_set1_epi8('=');
+    const __m256i nul = _mm256_setzero_si256();
+    __m256i chunk = _mm256_load_si256((const __m256i *)block);
+    unsigned int mask;
+
+    mask = (unsigned int)(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, eq_sign)) |
+                          _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, nul)));
+    mask &= ~0U << (str - block);
+
+    while (mask == 0)
+    {
+        block += 32;
+        chunk = _mm256_load_si256((const __m256i *)block);
+        mask = (unsigned int)(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, eq_sign)) |
+                              _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, nul)));
+    }
+    return (unsigned int)(block + __builtin_ctz(mask) - str);
+
+#elif defined(SIMD_SSE2)
+    const char *block = (const char *)((size_t)str & ~(size_t)15);
+    const __m128i eq_sign = _mm_set1_epi8('=');
+    const __m128i nul = _mm_setzero_si128();
+    __m128i chunk = _mm_load_si128((const __m128i *)block);
+    unsigned int mask;
+
+    mask = (unsigned int)(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, eq_sign)) |
+                          _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, nul)));
+    mask &= ~0U << (str - block);
+
+    while (mask == 0)
+    {
+        block += 16;
+        chunk = _mm_load_si128((const __m128i *)block);
+        mask = (unsigned int)(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, eq_sign)) |
+                              _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, nul)));
+    }
+    return (unsigned int)(block + __builtin_ctz(mask) - str);
+
+#else
+    unsigned int iter;
+
+    for (iter = 0; str[iter] != '\0' && str[iter] != '='; iter++);
+    return iter;
+#endif
+}
+
+/*
+ * Classify the words argv[from] to argv[to - 1].
+ *
+ *
+ * classes[i] receives the class of argv[from + i], and for long options,
+ * name_lengths[i] receives the length of the option name, without the dashes
+ * and a potential `=argument' part.
+ */
+static void classify_words(char **argv, int from, int to,
+                           unsigned char *classes,
+                           unsigned int *name_lengths)
+{
+    int iter;
+
+    for (iter = from; iter < to; iter++)
+    {
+        const char *word = argv[iter];
+        unsigned char word_class;
+
+        if (word == NULL || word[0] != '-')
+            word_class = WORD_POSITIONAL;
+
+        else if (word[1] != '-')
+            word_class = WORD_SHORT_OPTS;
+
+        else if (word[2] == '\0')
+            word_class = WORD_STOPPER;
+
+        else
+        {
+            word_class = WORD_LONG_OPT;
+            name_lengths[iter - from] = find_eq_or_end(word + 2);
+        }
+        classes[iter - from] = word_class;
+    }
+}
+
+/* Hash a long option name (32-bit FNV-1a). */
+static unsigned long hash_name(const char *name, unsigned int name_len)
+{
+    unsigned long hash = 2166136261UL;
+    unsigned int iter;
+
+    for (iter = 0; iter < name_len; iter++)
+    {
+        hash ^= (unsigned char)name[iter];
+        hash  = (hash * 16777619UL) & 0xFFFFFFFFUL;
+    }
+    return hash;
+}
+
+/*
+ * Find the range of the sorted long name index of a spec holding the names
+ * which start with the given prefix, the range is [*first, *last).
+ */
+static void spec_prefix_range(const struct dooshki_args_spec *spec,
+                              const char *prefix, unsigned int prefix_len,
+                              unsigned int *first, unsigned int *last)
+{
+    const struct dooshki_opt *opt_desc = spec->args_ctxt->opt_desc;
+    unsigned int low = 0;
+    unsigned int high = spec->long_count;
+    unsigned int middle;
+
+    while (low < high)
+    {
+        middle = low + (high - low) / 2;
+        if (strncmp(opt_desc[spec->long_order[middle]].long_name,
+                    prefix, prefix_len) < 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    *first = low;
+
+    high = spec->long_count;
+    while (low < high)
+    {
+        middle = low + (high - low) / 2;
+        if (strncmp(opt_desc[spec->long_order[middle]].long_name,
+                    prefix, prefix_len) == 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    *last = low;
+}
+
+/*
+ * Find a long option using a compiled spec, see find_long_opt.
+ *
+ *
+ * Exact matches are found through the hash table of the long names, which
+ * only refers to the packed hash and length arrays, the option descriptors
+ * are only accessed to confirm a match.  Abbreviations are resolved through
+ * the sorted long name index.  If `matches' is non-NULL, it receives
+ * the number of options matched, see dooshki_args_spec_find_long.
+ */
+static int spec_find_long_opt(const struct dooshki_args_spec *spec,
+                              const char *name, unsigned int name_len,
+                              unsigned int *matches)
+{
+    unsigned long hash = hash_name(name, name_len);
+    unsigned int slot = (unsigned int)hash & (spec->slot_count - 1);
+    unsigned int iter;
+    unsigned int first;
+    unsigned int last;
+    int found = -1;
+
+    while (spec->name_slots[slot] != 0)
+    {
+        iter = spec->name_slots[slot] - 1;
+        if (spec->name_hash[iter] == hash &&
+            spec->name_len[iter]  == name_len &&
+            strncmp(spec->args_ctxt->opt_desc[iter].long_name, name,
+                    name_len) == 0)
+        {
+            if (matches != NULL)
+                *matches = 1;
+
+            return (int)iter;
+        }
+        slot = (slot + 1) & (spec->slot_count - 1);
+    }
+
+    if (matches != NULL)
+        *matches = 0;
+
+    if (name_len == 0)
+        return -1;
+
+    /* Like the parser without a spec, the first match in opt_desc wins. */
+    spec_prefix_range(spec, name, name_len, &first, &last);
+    for (iter = first; iter < last; iter++)
+    {
+        if (found < 0 || spec->long_order[iter] < (unsigned int)found)
+            found = (int)spec->long_order[iter];
+    }
+    if (matches != NULL)
+        *matches = last - first;
+
+    return found;
+}
+
+/*
+ * Record a successful lookup of the option at position `pos' of the adaptive
+ * lookup order, moving it ahead of all options which were used less often.
+ */
+static void note_lookup_hit(struct dooshki_lookup_order *lookup_order,
+                            unsigned int pos)
+{
+    unsigned int opt_index = lookup_order->order[pos];
+    unsigned long hits = ++lookup_order->hits[opt_index];
+
+    while (pos > 0 && lookup_order->hits[lookup_order->order[pos - 1]] < hits)
+    {
+        lookup_order->order[pos] = lookup_order->order[pos - 1];
+        pos -= 1;
+    }
+    lookup_order->order[pos] = opt_index;
+}
+
+/* Record a successful lookup of the option with the given index. */
+static void note_lookup_index(struct dooshki_lookup_order *lookup_order,
+                              unsigned int opt_index)
+{
+    unsigned int pos;
+
+    for (pos = 0; lookup_order->order[pos] != opt_index; pos++);
+    note_lookup_hit(lookup_order, pos);
+}
+
+/*
+ * Find a long option by name, returns its index in opt_desc, or -1.
+ *
+ *
+ * An exact match is preferred, otherwise the first option in the table whose
+ * name begins with the given text is returned, which allows for long option
+ * names to be abbreviated.
+ */
+static int find_long_opt(const struct parse_state *state,
+                         const char *name, unsigned int name_len)
+{
+    const struct dooshki_opt *opt_desc = state->args_ctxt->opt_desc;
+    struct dooshki_lookup_order *lookup_order = state->args_ctxt->lookup_order;
+    unsigned int pos;
+
+    if (state->spec != NULL)
+        return spec_find_long_opt(state->spec, name, name_len, NULL);
+    if (state->image != NULL)
+        return dooshki_args_image_find_long(state->image, name, name_len);
+
+    for (pos = 0; !IS_LAST_OPT(&opt_desc[pos]); pos++)
+    {
+        unsigned int opt_index = (lookup_order != NULL)?
+                                 lookup_order->order[pos] : pos;
+        const char *long_name = opt_desc[opt_index].long_name;
+
+        if (long_name != NULL && strncmp(long_name, name, name_len) == 0 &&
+            long_name[name_len] == '\0')
+        {
+            if (lookup_order != NULL)
+                note_lookup_hit(lookup_order, pos);
+
+            return (int)opt_index;
+        }
+    }
+
+    if (name_len == 0)
+        return -1;
+
+    for (pos = 0; !IS_LAST_OPT(&opt_desc[pos]); pos++)
+    {
+        if (opt_desc[pos].long_name != NULL &&
+            strncmp(opt_desc[pos].long_name, name, name_len) == 0)
+        {
+            if (lookup_order != NULL)
+                note_lookup_index(lookup_order, pos);
+
+            return (int)pos;
+        }
+    }
+    return -1;
+}
+
+/* Find a short option, returns its index in opt_desc, or -1. */
+static int find_short_opt(const struct parse_state *state, char name)
+{
+    const struct dooshki_opt *opt_desc = state->args_ctxt->opt_desc;
+    struct dooshki_lookup_order *lookup_order = state->args_ctxt->lookup_order;
+    unsigned int pos;
+
+    if (state->spec != NULL)
+        return (int)state->spec->short_index[(unsigned char)name] - 1;
+    if (state->image != NULL)
+        return dooshki_args_image_find_short(state->image, name);
+
+    for (pos = 0; !IS_LAST_OPT(&opt_desc[pos]); pos++)
+    {
+        unsigned int opt_index = (lookup_order != NULL)?
+                                 lookup_order->order[pos] : pos;
+        const char *short_name = opt_desc[opt_index].short_name;
+
+        if (short_name != NULL && short_name[0] == name)
+        {
+            if (lookup_order != NULL)
+                note_lookup_hit(lookup_order, pos);
+
+            return (int)opt_index;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Take the next unprocessed word after argv[opt_argi] as an option argument,
+ * returns NULL if there's none before the end of argv or the stopper.
+ */
+static const char *take_next_word(struct parse_state *state,
+                                  unsigned int opt_argi)
+{
+    char **argv = *state->argv;
+    const char *argument = NULL;
+    int arg_iter;
+
+    for (arg_iter = opt_argi + 1; arg_iter < *state->argc; arg_iter++)
+    {
+        if (argv[arg_iter] != NULL)
+        {
+            if (strcmp(argv[arg_iter], "--") != 0)
+            {
+                argument = argv[arg_iter];
+                argv[arg_iter] = NULL;
+            }
+            break;
+        }
+    }
+    return argument;
+}
+
+static void process_long_opt(struct parse_state *state, unsigned int opt_argi,
+                             unsigned int opt_len)
+{
+    const struct dooshki_args *args_ctxt = state->args_ctxt;
+    const struct dooshki_opt *opt_entry;
+    int opt_index;
+
+    const char *option = (*state->argv)[opt_argi];
+    const char *argument = NULL;
+
+    if (strcmp(option, "--" HELP_LONG_OPT) == 0)
+    {
+        if (args_ctxt->trace_hook != NULL)
+            trace_event(state, DOOSHKI_TRACE_HELP, opt_argi, NULL);
+
+        if (! state->show_version)
+            state->show_help = 1;
+        return;
+    }
+
+    if (strcmp(option, "--" VER_LONG_OPT) == 0)
+    {
+        if (args_ctxt->trace_hook != NULL)
+            trace_event(state, DOOSHKI_TRACE_VERSION, opt_argi, NULL);
+
+        if (! state->show_help)
+            state->show_version = 1;
+        return;
+    }
+
+    if (option[opt_len + 2] == '=')
+        argument = &option[opt_len + 3];
+
+    STATS_COUNT(state, lookups, 1);
+    STATS_COUNT(state, bytes_scanned, opt_len + 2);
+    STATS_PHASE_BEGIN(state);
+
+    opt_index = find_long_opt(state, option + 2, opt_len);
+
+    STATS_PHASE_END(state, DOOSHKI_PHASE_LOOKUP);
+
+    if (opt_index < 0)
+    {
+        print_error(args_ctxt, message(args_ctxt, DOOSHKI_MSG_UNRECOGNIZED),
+                    option);
+        state->errors_found = 1;
+        return;
+    }
+    opt_entry = &args_ctxt->opt_desc[opt_index];
+    STATS_COUNT(state, options_matched, 1);
+
+    if (args_ctxt->trace_hook != NULL)
+        trace_event(state, opt_index, opt_argi, argument);
+
+    if (opt_entry->opt_found != NULL)
+        *(opt_entry->opt_found) = 1;
+
+    if (opt_entry->type == DOOSHKI_OPT_BOOL ||
+        opt_entry->type == DOOSHKI_OPT_NEGBOOL ||
+        opt_entry->type == DOOSHKI_OPT_CB_NOARG)
+    {
+        if (argument != NULL)
+        {
+            print_error(args_ctxt,
+                        message(args_ctxt, DOOSHKI_MSG_UNEXPECTED_ARG),
+                        argument, opt_entry->long_name);
+            state->errors_found = 1;
+            return;
+        }
+
+        if (opt_entry->type == DOOSHKI_OPT_CB_NOARG)
+        {
+            STATS_PHASE_BEGIN(state);
+
+            if (! opt_entry->callback(NULL, opt_entry->opt_storage, "--",
+                                      opt_entry->long_name,
+                                      opt_entry->callback_data))
+                state->errors_found = 1;
+
+            STATS_COUNT(state, callbacks, 1);
+            STATS_PHASE_END(state, DOOSHKI_PHASE_CALLBACKS);
+        }
+        else
+        {
+            char *bool_ptr = opt_entry->opt_storage;
+            *bool_ptr = (opt_entry->type == DOOSHKI_OPT_BOOL)? 1 : 0;
+        }
+    }
+    else
+    {
+        if (argument == NULL)
+        {
+            argument = take_next_word(state, opt_argi);
+            if (argument == NULL)
+            {
+                print_error(args_ctxt,
+                            message(args_ctxt, DOOSHKI_MSG_MISSING_ARG_LONG),
+                            opt_entry->long_name);
+                state->errors_found = 1;
+                return;
+            }
+        }
+        if (! process_opt_arg(state, opt_entry, 1, argument))
+            state->errors_found = 1;
+    }
+}
+
+static void process_short_opts(struct parse_state *state,
+                               unsigned int opt_argi)
+{
+    const struct dooshki_args *args_ctxt = state->args_ctxt;
+    const struct dooshki_opt *opt_entry;
+    unsigned int in_iter;
+    int opt_index;
+    char direct_arg;
+
+    const char *options = (*state->argv)[opt_argi];
+
+    for (in_iter = 1, direct_arg = 0;
+         options[in_iter] != '\0' && !direct_arg;
+         in_iter++)
+    {
+        if (options[in_iter] == HELP_SHORT_OPT)
+        {
+            if (args_ctxt->trace_hook != NULL)
+                trace_event(state, DOOSHKI_TRACE_HELP, opt_argi, NULL);
+
+            if (! state->show_version)
+                state->show_help = 1;
+
+            continue;
+        }
+        if (options[in_iter] == VER_SHORT_OPT)
+        {
+            if (args_ctxt->trace_hook != NULL)
+                trace_event(state, DOOSHKI_TRACE_VERSION, opt_argi, NULL);
+
+            if (! state->show_help)
+                state->show_version = 1;
+
+            continue;
+        }
+
+        STATS_COUNT(state, lookups, 1);
+        STATS_COUNT(state, bytes_scanned, 1);
+        STATS_PHASE_BEGIN(state);
+
+        opt_index = find_short_opt(state, options[in_iter]);
+
+        STATS_PHASE_END(state, DOOSHKI_PHASE_LOOKUP);
+
+        if (opt_index < 0)
+        {
+            print_error(args_ctxt,
+                        message(args_ctxt, DOOSHKI_MSG_UNRECOGNIZED_SHORT),
+                        options[in_iter]);
+            state->errors_found = 1;
+            continue;
+        }
+        opt_entry = &args_ctxt->opt_desc[opt_index];
+        STATS_COUNT(state, options_matched, 1);
+
+        if (args_ctxt->trace_hook != NULL)
+            trace_event(state, opt_index, opt_argi, NULL);
+
+        if (opt_entry->opt_found != NULL)
+            *(opt_entry->opt_found) = 1;
+
+        if (opt_entry->type == DOOSHKI_OPT_BOOL ||
+            opt_entry->type == DOOSHKI_OPT_NEGBOOL)
+        {
+            char *bool_ptr = opt_entry->opt_storage;
+            *bool_ptr = (opt_entry->type == DOOSHKI_OPT_BOOL)? 1 : 0;
+        }
+        else if (opt_entry->type == DOOSHKI_OPT_CB_NOARG)
+        {
+            STATS_PHASE_BEGIN(state);
+
+            if (! opt_entry->callback(NULL, opt_entry->opt_storage, "-",
+                                      opt_entry->short_name,
+                                      opt_entry->callback_data))
+                state->errors_found = 1;
+
+            STATS_COUNT(state, callbacks, 1);
+            STATS_PHASE_END(state, DOOSHKI_PHASE_CALLBACKS);
+        }
+        else if (options[in_iter + 1] == '\0')
+        {
+            const char *argument = take_next_word(state, opt_argi);
+
+            if (argument == NULL)
+            {
+                print_error(args_ctxt,
+                            message(args_ctxt, DOOSHKI_MSG_MISSING_ARG_SHORT),
+                            opt_entry->short_name);
+                state->errors_found = 1;
+            }
+            else if (! process_opt_arg(state, opt_entry, 0, argument))
+            {
+                state->errors_found = 1;
+            }
+        }
+        else
+        {
+            direct_arg = 1;
+
+            if (options[in_iter + 1] == '=')
+            {
+                in_iter += 1;
+                if (options[in_iter + 1] == '\0')
+                {
+                    print_error(args_ctxt,
+                                message(args_ctxt,
+                                        DOOSHKI_MSG_MISSING_ARG_SHORT),
+                                opt_entry->short_name);
+
+                    state->errors_found = 1;
+                    direct_arg = 0;
+                }
+            }
+            if (direct_arg)
+            {
+                if (! process_opt_arg(state, opt_entry, 0,
+                                      &options[in_iter + 1]))
+                {
+                    state->errors_found = 1;
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Remove NULL entries from argc/argv.
+ *
+ * The remaining words are moved down in a single pass, keeping their order,
+ * and the entries left over at the end are set to NULL.
+ */
+static void deflate_args_list(int *argc, char ***argv)
+{
+    int fill_iter = 1;
+    int pull_iter;
+
+    for (pull_iter = 1; pull_iter < *argc; pull_iter++)
+    {
+        if ((*argv)[pull_iter] != NULL)
+            (*argv)[fill_iter++] = (*argv)[pull_iter];
+    }
+    for (pull_iter = fill_iter; pull_iter < *argc; pull_iter++)
+        (*argv)[pull_iter] = NULL;
+
+    *argc = fill_iter;
+}
+
+/*
+ * Find the option which takes the word following `word' as its argument,
+ * returns NULL if there's no such option.
+ */
+static const struct dooshki_opt *completion_pending_opt(
+                                    const struct dooshki_args_spec *spec,
+                                    const char *word)
+{
+    const struct dooshki_opt *opt_desc = spec->args_ctxt->opt_desc;
+    const struct dooshki_opt *option;
+    int opt_index;
+
+    if (word[0] != '-' || word[1] == '\0')
+        return NULL;
+
+    if (word[1] == '-')
+    {
+        if (strchr(word, '=') != NULL)
+            return NULL;
+
+        opt_index = spec_find_long_opt(spec, &word[2],
+                                       (unsigned int)strlen(&word[2]), NULL);
+        if (opt_index < 0 || ! TAKES_ARGUMENT(opt_desc[opt_index].type))
+            return NULL;
+
+        return &opt_desc[opt_index];
+    }
+
+    for (word++; *word != '\0'; word++)
+    {
+        opt_index = (int)spec->short_index[(unsigned char)*word] - 1;
+        if (opt_index < 0)
+            return NULL;
+
+        option = &opt_desc[opt_index];
+        if (TAKES_ARGUMENT(option->type))
+            return (word[1] == '\0')? option : NULL;
+    }
+    return NULL;
+}
+
+/*
+ * Print the choices listed by the argument template of an option which start
+ * with `partial', each preceded by `lead'.
+ */
+static void complete_choices(const struct dooshki_opt *option,
+                             const char *lead, unsigned int lead_len,
+                             const char *partial)
+{
+    const char *choice;
+    size_t partial_len = strlen(partial);
+    size_t len;
+
+    if (option->argument_template == NULL ||
+        strchr(option->argument_template, '|') == NULL)
+        return;
+
+    for (choice = option->argument_template; ; choice += len + 1)
+    {
+        len = strcspn(choice, "|");
+        if (len >= partial_len && strncmp(choice, partial, partial_len) == 0)
+            out_printf("%.*s%.*s\n", (int)lead_len, lead, (int)len, choice);
+
+        if (choice[len] == '\0')
+            break;
+    }
+}
+
+/* Print the option names starting with `partial', a word starting with `-'. */
+static void complete_opt_names(const struct dooshki_args_spec *spec,
+                               const char *partial)
+{
+    static const char *const builtin_names[] =
+    {
+        HELP_LONG_OPT, VER_LONG_OPT
+    };
+    const struct dooshki_opt *opt_desc = spec->args_ctxt->opt_desc;
+    const char *prefix = "";
+    unsigned int prefix_len;
+    unsigned int first;
+    unsigned int last;
+    unsigned int iter;
+
+    if (partial[1] == '-')
+        prefix = &partial[2];
+
+    else if (partial[1] == '\0')
+    {
+        /* A lone dash also offers the short options. */
+        for (iter = 0; iter < 256; iter++)
+        {
+            if (spec->short_index[iter] != 0 || iter == HELP_SHORT_OPT ||
+                iter == VER_SHORT_OPT)
+                out_printf("-%c\n", (char)iter);
+        }
+    }
+    else
+        return;
+
+    prefix_len = (unsigned int)strlen(prefix);
+    spec_prefix_range(spec, prefix, prefix_len, &first, &last);
+    for (iter = first; iter < last; iter++)
+        out_printf("--%s\n", opt_desc[spec->long_order[iter]].long_name);
+
+    for (iter = 0; iter < 2; iter++)
+    {
+        if (strncmp(builtin_names[iter], prefix, prefix_len) == 0)
+            out_printf("--%s\n", builtin_names[iter]);
+    }
+}
+
+/*
+ * Answer a completion query.
+ *
+ *
+ * `words' are the words of the command line being completed, without the
+ * program name, `cursor_text' is the index of the word being completed.
+ * The candidates are printed onto stdout, one per line.
+ */
+static void complete_words(const struct dooshki_args_spec *spec,
+                           const char *cursor_text, int count, char **words)
+{
+    const struct dooshki_opt *pending = NULL;
+    const char *partial;
+    const char *equals;
+    long cursor;
+    int iter;
+
+    if (convert_int(cursor_text, &cursor) != CONV_OK || cursor < 0 ||
+        cursor > count)
+        return;
+
+    partial = (cursor < count)? words[cursor] : "";
+
+    for (iter = 0; iter < cursor; iter++)
+    {
+        if (pending != NULL)
+            pending = NULL;
+        else if (strcmp(words[iter], "--") == 0)
+            return;
+        else
+            pending = completion_pending_opt(spec, words[iter]);
+    }
+
+    if (pending != NULL)
+        complete_choices(pending, "", 0, partial);
+
+    else if (partial[0] == '-' && partial[1] == '-' &&
+             (equals = strchr(partial, '=')) != NULL)
+    {
+        int opt_index = spec_find_long_opt(spec, &partial[2],
+                                    (unsigned int)(equals - &partial[2]),
+                                    NULL);
+        if (opt_index >= 0)
+            complete_choices(&spec->args_ctxt->opt_desc[opt_index], partial,
+                             (unsigned int)(equals - partial + 1),
+                             equals + 1);
+    }
+    else if (partial[0] == '-')
+        complete_opt_names(spec, partial);
+}
+
+/*
+ * Parse the command line, with or without a compiled spec.
+ *
+ *
+ * Without a spec, `index' or a spec image may still be used to look up
+ * the options, which doesn't enable any of the other features of a spec.
+ */
+static enum dooshki_args_ret parse_args(int *argc, char ***argv,
+                                        const struct dooshki_args *args_ctxt,
+                                        const struct dooshki_args_spec *spec,
+                                        const struct dooshki_args_spec *index,
+                                        const struct dooshki_args_image *image)
+{
+    struct parse_state state;
+    unsigned char word_classes[CLASSIFY_BLOCK];
+    unsigned int  name_lengths[CLASSIFY_BLOCK];
+    int block_start;
+    int block_end;
+    int arg_iter;
+
+    char stopper_reached = 0;
+
+    state.argc         = argc;
+    state.argv         = argv;
+    state.args_ctxt    = args_ctxt;
+    state.spec         = (spec != NULL)? spec : index;
+    state.image        = image;
+    state.show_help    = 0;
+    state.show_version = 0;
+    state.errors_found = 0;
+    state.trace_count  = 0;
+
+    /* Completion queries are answered before anything else is done. */
+    if (spec != NULL && *argc >= 3 &&
+        strcmp((*argv)[1], "--" COMPLETE_LONG_OPT) == 0)
+    {
+        complete_words(spec, (*argv)[2], *argc - 3, &(*argv)[3]);
+        return DOOSHKI_ARGS_COMPLETION_SHOWN;
+    }
+
+#ifdef DOOSHKI_ARGS_STATS
+    state.stats = args_ctxt->stats;
+    if (state.stats != NULL)
+        memset(state.stats, 0, sizeof(*state.stats));
+#endif
+
+    /* Where scanning stopped, past the stopper if there's one. */
+    arg_iter = (*argc > 1)? 1 : *argc;
+
+    for (block_start = 1; block_start < *argc && !stopper_reached;
+         block_start = block_end)
+    {
+        block_end = (*argc - block_start > CLASSIFY_BLOCK)?
+                    block_start + CLASSIFY_BLOCK : *argc;
+
+        STATS_PHASE_BEGIN(&state);
+        classify_words(*argv, block_start, block_end,
+                       word_classes, name_lengths);
+        STATS_PHASE_END(&state, DOOSHKI_PHASE_CLASSIFICATION);
+
+        for (arg_iter = block_start;
+             arg_iter < block_end && !stopper_reached; arg_iter++)
+        {
+            /* Words consumed as arguments of earlier options are NULL. */
+            if ((*argv)[arg_iter] == NULL)
+                continue;
+
+            switch (word_classes[arg_iter - block_start])
+            {
+                case WORD_POSITIONAL:
+                    if (args_ctxt->trace_hook != NULL)
+                        trace_event(&state, DOOSHKI_TRACE_POSITIONAL,
+                                    arg_iter, (*argv)[arg_iter]);
+                    continue;
+
+                case WORD_STOPPER:
+                    stopper_reached = 1;
+                    break;
+
+                case WORD_LONG_OPT:
+                    process_long_opt(&state, arg_iter,
+                                     name_lengths[arg_iter - block_start]);
+                    break;
+
+                default:
+                    process_short_opts(&state, arg_iter);
+                    break;
+            }
+            (*argv)[arg_iter] = NULL;
+        }
+    }
+    if (args_ctxt->trace_hook != NULL)
+    {
+        /* Everything after the stopper is a positional argument. */
+        for (; arg_iter < *argc; arg_iter++)
+        {
+            if ((*argv)[arg_iter] != NULL)
+                trace_event(&state, DOOSHKI_TRACE_POSITIONAL, arg_iter,
+                            (*argv)[arg_iter]);
+        }
+        trace_flush(&state);
+    }
+
+    STATS_PHASE_BEGIN(&state);
+    deflate_args_list(argc, argv);
+    STATS_PHASE_END(&state, DOOSHKI_PHASE_COMPACTION);
+
+    if (state.show_help)
+    {
+        if (state.errors_found)
+            write_out(DOOSHKI_STREAM_ERR, "\n", 1);
+
+        STATS_PHASE_BEGIN(&state);
+        print_help(args_ctxt, spec);
+        STATS_PHASE_END(&state, DOOSHKI_PHASE_HELP);
+
+        return DOOSHKI_ARGS_HELP_SHOWN;
+    }
+
+    if (state.show_version)
+    {
+        if (state.errors_found)
+            write_out(DOOSHKI_STREAM_ERR, "\n", 1);
+
+        STATS_PHASE_BEGIN(&state);
+        print_version(args_ctxt);
+        STATS_PHASE_END(&state, DOOSHKI_PHASE_HELP);
+
+        return DOOSHKI_ARGS_VER_SHOWN;
+    }
+
+    if (state.errors_found)
+    {
+        STATS_PHASE_BEGIN(&state);
+        print_usage(args_ctxt, 1);
+        STATS_PHASE_END(&state, DOOSHKI_PHASE_HELP);
+
+        return DOOSHKI_ARGS_PARSE_ERROR;
+    }
+
+    return DOOSHKI_ARGS_PARSE_OK;
+}
+
+/*
+ * Output buffer of the JSON dump.  `length' counts all of the output, even
+ * the part which didn't fit into the buffer.
+ */
+struct json_out
+{
+    char *buffer;
+    unsigned long size;
+    unsigned long length;
+};
+
+/* Append `count' characters to the JSON dump. */
+static void json_put(struct json_out *out, const char *text,
+                     unsigned long count)
+{
+    if (out->length < out->size)
+    {
+        unsigned long room = out->size - out->length - 1;
+
+        memcpy(&out->buffer[out->length], text, (count < room)? count : room);
+    }
+    out->length += count;
+}
+
+#define JSON_PUT_LITERAL(out, text) json_put((out), (text), sizeof(text) - 1)
+
+/* Append a string to the JSON dump, as a quoted and escaped JSON string. */
+static void json_put_string(struct json_out *out, const char *text)
+{
+    static const char hex_digits[] = "0123456789abcdef";
+    const char *run_start = text;
+    char escape[6];
+
+    JSON_PUT_LITERAL(out, "\"");
+    for (; *text != '\0'; text++)
+    {
+        unsigned char ch = (unsigned char)*text;
+
+        if (ch >= 0x20 && ch != '"' && ch != '\\')
+            continue;
+
+        /* Copy the run of characters which don't need escaping at once. */
+        json_put(out, run_start, (unsigned long)(text - run_start));
+        run_start = text + 1;
+
+        escape[0] = '\\';
+        switch (ch)
+        {
+            case '"':  escape[1] = '"';  break;
+            case '\\': escape[1] = '\\'; break;
+            case '\b': escape[1] = 'b';  break;
+            case '\f': escape[1] = 'f';  break;
+            case '\n': escape[1] = 'n';  break;
+            case '\r': escape[1] = 'r';  break;
+            case '\t': escape[1] = 't';  break;
+
+            default:
+                escape[1] = 'u';
+                escape[2] = '0';
+                escape[3] = '0';
+                escape[4] = hex_digits[ch >> 4];
+                escape[5] = hex_digits[ch & 0x0F];
+                json_put(out, escape, 6);
+                continue;
+        }
+        json_put(out, escape, 2);
+    }
+    json_put(out, run_start, (unsigned long)(text - run_start));
+    JSON_PUT_LITERAL(out, "\"");
+}
+
+/*
+ * Convert a number formatted with a `.' decimal point back, strtod expects
+ * the decimal point of the current locale (LC_NUMERIC) instead.
+ */
+static double read_float(const char *text)
+{
+    const char *point = localeconv()->decimal_point;
+    const char *dot = strchr(text, '.');
+    char local_text[64];
+
+    if (dot == NULL || strcmp(point, ".") == 0 ||
+        strlen(text) + strlen(point) >= sizeof(local_text))
+    {
+        return strtod(text, NULL);
+    }
+    memcpy(local_text, text, (size_t)(dot - text));
+    strcpy(&local_text[dot - text], point);
+    strcat(local_text, dot + 1);
+
+    return strtod(local_text, NULL);
+}
+
+#ifndef DOOSHKI_ARGS_NO_STDIO
+/*
+ * Format a number with `precision' significant digits, with a `.' decimal
+ * point whatever the locale, as sprintf uses the one of LC_NUMERIC.
+ */
+static void format_float(char *text, int precision, double value)
+{
+    const char *point = localeconv()->decimal_point;
+    size_t point_len = strlen(point);
+    char *found;
+
+    sprintf(text, "%.*g", precision, value);
+
+    if (point_len > 0 && strcmp(point, ".") != 0 &&
+        (found = strstr(text, point)) != NULL)
+    {
+        *found = '.';
+        memmove(found + 1, found + point_len, strlen(found + point_len) + 1);
+    }
+}
+#else
+
+/*
+ * Write out `count' digits as a number in exponential notation, trailing
+ * zeros are left out like with the `%g' conversion of sprintf.
+ */
+static void put_float_digits(char *text, const char *digits, int count,
+                             int exponent)
+{
+    int iter;
+
+    for (; count > 1 && digits[count - 1] == 0; count--);
+
+    for (iter = 0; iter < count; iter++)
+    {
+        *text++ = (char)('0' + digits[iter]);
+        if (iter == 0 && count > 1)
+            *text++ = '.';
+    }
+    format_string(text, "e%d", exponent);
+}
+
+/* Add one (`step' == 1) or subtract one (-1) from the last of the digits. */
+static void step_float_digits(char *digits, int count, int *exponent,
+                              int step)
+{
+    int iter;
+
+    for (iter = count - 1; iter >= 0; iter--)
+    {
+        digits[iter] = (char)(digits[iter] + step);
+        if (digits[iter] >= 0 && digits[iter] <= 9)
+            break;
+        digits[iter] = (step > 0)? 0 : 9;
+    }
+
+    if (iter < 0 || digits[0] == 0)
+    {
+        /* Carried into, or borrowed from, the leading digit. */
+        memset(digits, (step > 0)? 0 : 9, (size_t)count);
+        digits[0] = (step > 0)? 1 : 9;
+        *exponent += step;
+    }
+}
+
+/*
+ * Format a finite number with `precision' (at most 17) significant digits,
+ * in exponential notation.  The digits are extracted by repeated scaling,
+ * which may be off in the last digits, so with all 17 of them, they're
+ * adjusted until the text converts back to the same number.
+ */
+static void format_float(char *text, int precision, double value)
+{
+    char digits[18];
+    long double scaled = value;
+    int exponent = 0;
+    int iter;
+
+    if (value < 0)
+    {
+        *text++ = '-';
+        scaled = -scaled;
+        value  = -value;
     }
-    if (*dest == ULONG_MAX && errno == ERANGE)
+    if (value == 0)
     {
-        print_error(args_ctxt,
-                    "Argument `%s' passed to option %s%s is too large.",
-                    argument, opt_prefix, opt_name);
-        return 0;
+        strcpy(text, "0");
+        return;
+    }
+
+    while (scaled >= 10)
+    {
+        scaled /= 10;
+        exponent++;
+    }
+    while (scaled < 1)
+    {
+        scaled *= 10;
+        exponent--;
+    }
+
+    /* One more digit than needed, for rounding. */
+    for (iter = 0; iter <= precision; iter++)
+    {
+        int digit = (int)scaled;
+
+        digit = (digit > 9)? 9 : digit;
+        digits[iter] = (char)digit;
+        scaled = (scaled - digit) * 10;
+    }
+    if (digits[precision] >= 5)
+        step_float_digits(digits, precision, &exponent, 1);
+
+    put_float_digits(text, digits, precision, exponent);
+
+    for (iter = 0; precision == 17 && iter < 64; iter++)
+    {
+        double converted = read_float(text);
+
+        if (converted == value)
+            break;
+
+        step_float_digits(digits, precision, &exponent,
+                          (converted < value)? 1 : -1);
+        put_float_digits(text, digits, precision, exponent);
     }
-    return 1;
 }
+#endif
 
-/* Collect a signed integer argument. */
-static char process_int_arg(const struct dooshki_args *args_ctxt,
-                            const struct dooshki_opt  *option,
-                            const char  *opt_prefix,
-                            const char  *opt_name,
-                            const char  *argument)
+/*
+ * Append a floating point number to the JSON dump, using the shortest
+ * representation which converts back to the same value.  JSON has no
+ * representation for infinities and NaNs, those become null.
+ *
+ * Any decimal number of at most 15 significant digits survives the round
+ * trip through an IEEE 754 double, so formatting with 15 digits, trailing
+ * zeros left out, already gives the shortest text when there is one that
+ * short, and at most 16 and 17 digits have to be tried after that.  That
+ * doesn't hold for subnormal numbers, which have fewer bits of precision,
+ * those are tried with any number of digits.
+ */
+static void json_put_float(struct json_out *out, double value)
 {
-    long *dest = option->opt_storage;
-    char *test_ptr;
+    char text[32];
+    int precision;
 
-    errno = 0;
-    *dest = strtol(argument, &test_ptr, 10);
-    if (*test_ptr != '\0')
+    if (value != value || value > DBL_MAX || value < -DBL_MAX)
     {
-        print_error(args_ctxt,
-                    "Argument `%s' passed to option %s%s is not "
-                    "a valid integer.",
-                    argument, opt_prefix, opt_name);
-        return 0;
+        JSON_PUT_LITERAL(out, "null");
+        return;
     }
-    if (*dest == LONG_MAX && errno == ERANGE)
+
+    precision = (value < DBL_MIN && value > -DBL_MIN)? 1 : 15;
+    for (; precision < 17; precision++)
     {
-        print_error(args_ctxt,
-                    "Argument `%s' passed to option %s%s is too large.",
-                    argument, opt_prefix, opt_name);
-        return 0;
+        format_float(text, precision, value);
+        if (read_float(text) == value)
+            break;
     }
-    if (*dest == LONG_MIN && errno == ERANGE)
+    if (precision == 17)
+        format_float(text, 17, value);
+
+    json_put(out, text, (unsigned long)strlen(text));
+}
+
+/* Append the value of an option to the JSON dump. */
+static void json_put_value(struct json_out *out,
+                           const struct dooshki_opt *option)
+{
+    char text[32];
+
+    if (option->opt_storage == NULL)
     {
-        print_error(args_ctxt,
-                    "Argument `%s' passed to option %s%s is too small.",
-                    argument, opt_prefix, opt_name);
+        JSON_PUT_LITERAL(out, "null");
+        return;
+    }
+
+    switch (option->type)
+    {
+        case DOOSHKI_OPT_BOOL:
+        case DOOSHKI_OPT_NEGBOOL:
+            if (*(char *)option->opt_storage)
+                JSON_PUT_LITERAL(out, "true");
+            else
+                JSON_PUT_LITERAL(out, "false");
+            break;
+
+        case DOOSHKI_OPT_STR:
+            if (*(const char **)option->opt_storage != NULL)
+                json_put_string(out, *(const char **)option->opt_storage);
+            else
+                JSON_PUT_LITERAL(out, "null");
+            break;
+
+        case DOOSHKI_OPT_INT:
+            format_string(text, "%ld", *(long *)option->opt_storage);
+            json_put(out, text, (unsigned long)strlen(text));
+            break;
+
+        case DOOSHKI_OPT_UINT:
+            format_string(text, "%lu", *(unsigned long *)option->opt_storage);
+            json_put(out, text, (unsigned long)strlen(text));
+            break;
+
+        case DOOSHKI_OPT_FLOAT:
+            json_put_float(out, *(double *)option->opt_storage);
+            break;
+
+        default:
+            /* The storage of callback options is opaque to the library. */
+            JSON_PUT_LITERAL(out, "null");
+            break;
+    }
+}
+
+/*
+ * Layout of an exported spec image.
+ *
+ * All numbers are 32-bit little-endian, so that an image can be used on any
+ * machine.  The image consists of:
+ *
+ *   header        magic, version, option count, slot count, size of the
+ *                 string area and size of the whole image
+ *   short index   opt_desc index + 1 for each short option character
+ *   slots         hash table of opt_desc index + 1 for each long name,
+ *                 a power of two slots, probed linearly, 0 if unused
+ *   entries       per option: name hash, name length, offsets of the long
+ *                 name, short name, argument template and description within
+ *                 the string area (IMAGE_NONE if missing) and the type
+ *   strings       null-terminated strings
+ */
+#define IMAGE_MAGIC         "DOAS"
+#define IMAGE_VERSION       1
+#define IMAGE_HEADER_SIZE   24
+#define IMAGE_SHORT_INDEX   IMAGE_HEADER_SIZE
+#define IMAGE_SLOTS         (IMAGE_SHORT_INDEX + 256 * 4)
+#define IMAGE_ENTRY_SIZE    28
+#define IMAGE_NONE          0xFFFFFFFFUL
+
+/* Store a 32-bit number into an image. */
+static void image_put(unsigned char *ptr, unsigned long value)
+{
+    ptr[0] = (unsigned char)(value & 0xFF);
+    ptr[1] = (unsigned char)((value >> 8)  & 0xFF);
+    ptr[2] = (unsigned char)((value >> 16) & 0xFF);
+    ptr[3] = (unsigned char)((value >> 24) & 0xFF);
+}
+
+/* Load a 32-bit number from an image. */
+static unsigned long image_get(const unsigned char *ptr)
+{
+    return  (unsigned long)ptr[0]        | ((unsigned long)ptr[1] << 8) |
+           ((unsigned long)ptr[2] << 16) | ((unsigned long)ptr[3] << 24);
+}
+
+/* Size taken up by a string in the string area of an image. */
+static unsigned long image_string_size(const char *str)
+{
+    return (str != NULL)? (unsigned long)strlen(str) + 1 : 0;
+}
+
+/* Copy a string into the string area of an image, returns its offset. */
+static unsigned long image_add_string(unsigned char *strings,
+                                      unsigned long *strings_used,
+                                      const char *str)
+{
+    unsigned long offset = *strings_used;
+
+    if (str == NULL)
+        return IMAGE_NONE;
+
+    memcpy(&strings[offset], str, strlen(str) + 1);
+    *strings_used += strlen(str) + 1;
+
+    return offset;
+}
+
+/* Check that a string offset of an image entry is valid. */
+#define IMAGE_STRING_OK(offset, strings_size) \
+    ((offset) == IMAGE_NONE || (offset) < (strings_size))
+
+/* Check the contents of an image entry, returns 1 if valid, 0 if not. */
+static char image_entry_ok(const unsigned char *entry, const char *strings,
+                           unsigned long strings_size)
+{
+    unsigned long long_name = image_get(&entry[8]);
+    unsigned long name_len  = image_get(&entry[4]);
+
+    if (! IMAGE_STRING_OK(long_name, strings_size) ||
+        ! IMAGE_STRING_OK(image_get(&entry[12]), strings_size) ||
+        ! IMAGE_STRING_OK(image_get(&entry[16]), strings_size) ||
+        ! IMAGE_STRING_OK(image_get(&entry[20]), strings_size) ||
+        image_get(&entry[24]) > DOOSHKI_OPT_CB_NOARG)
+        return 0;
+
+    if (long_name == IMAGE_NONE)
+        return (name_len == 0);
+
+    return (name_len < strings_size - long_name &&
+            strings[long_name + name_len] == '\0');
+}
+
+/*
+ * Check a slot of the long name hash table of an image, returns 1 if valid,
+ * 0 if not.
+ *
+ *
+ * The entry the slot refers to has to have a long name with the stored
+ * hash, and has to be reached by probing from the slot its hash leads to,
+ * lookups would otherwise compare names which aren't there.
+ */
+static char image_slot_ok(const unsigned char *slots, unsigned long slot_count,
+                          const unsigned char *entries, const char *strings,
+                          unsigned long slot)
+{
+    unsigned long index = image_get(&slots[slot * 4]);
+    const unsigned char *entry;
+    unsigned long long_name;
+    unsigned long name_len;
+    unsigned long probe;
+
+    if (index == 0)
+        return 1;
+
+    entry     = &entries[(index - 1) * IMAGE_ENTRY_SIZE];
+    long_name = image_get(&entry[8]);
+    name_len  = image_get(&entry[4]);
+    if (long_name == IMAGE_NONE ||
+        strlen(&strings[long_name]) != name_len ||
+        hash_name(&strings[long_name], (unsigned int)name_len) !=
+        image_get(&entry[0]))
         return 0;
+
+    for (probe = image_get(&entry[0]) & (slot_count - 1); probe != slot;
+         probe = (probe + 1) & (slot_count - 1))
+    {
+        if (image_get(&slots[probe * 4]) == 0)
+            return 0;
     }
     return 1;
 }
 
-/* Collect a floating point argument. */
-static char process_float_arg(const struct dooshki_args *args_ctxt,
-                              const struct dooshki_opt  *option,
-                              const char  *opt_prefix,
-                              const char  *opt_name,
-                              const char  *argument)
+/* Check that an entry of an image has the given short name character. */
+static char image_short_ok(const unsigned char *entry, const char *strings,
+                           unsigned int name)
 {
-    double *dest = option->opt_storage;
-    char *test_ptr;
+    unsigned long short_name = image_get(&entry[12]);
 
-    errno = 0;
-    *dest = strtod(argument, &test_ptr);
-    if (*test_ptr != '\0')
+    return (short_name != IMAGE_NONE &&
+            (unsigned char)strings[short_name] == name);
+}
+
+/*
+ * Number of slots in the long name hash table of a spec, a power of two,
+ * at least twice the number of options.
+ */
+static unsigned int spec_slot_count(unsigned int opt_count)
+{
+    unsigned int slot_count = 2;
+
+    while (slot_count < 2 * opt_count)
+        slot_count *= 2;
+
+    return slot_count;
+}
+
+/* Check whether an option's long name sorts before another one's. */
+static char long_name_before(const struct dooshki_args_spec *spec,
+                             unsigned int opt_a, unsigned int opt_b)
+{
+    const struct dooshki_opt *opt_desc = spec->args_ctxt->opt_desc;
+
+    return strcmp(opt_desc[opt_a].long_name, opt_desc[opt_b].long_name) < 0;
+}
+
+/*
+ * Restore the heap order of the long_order subtree rooted at `root', which
+ * is `count' entries long.
+ */
+static void sift_long_order(struct dooshki_args_spec *spec,
+                            unsigned int root, unsigned int count)
+{
+    unsigned int *order = spec->long_order;
+    unsigned int child;
+    unsigned int opt_index;
+
+    while ((child = 2 * root + 1) < count)
     {
-        print_error(args_ctxt,
-                    "Argument `%s' passed to option %s%s is not "
-                    "a valid floating point number.",
-                    argument, opt_prefix, opt_name);
-        return 0;
+        if (child + 1 < count &&
+            long_name_before(spec, order[child], order[child + 1]))
+            child++;
+
+        if (! long_name_before(spec, order[root], order[child]))
+            break;
+
+        opt_index    = order[root];
+        order[root]  = order[child];
+        order[child] = opt_index;
+        root = child;
     }
-    if (*dest == HUGE_VAL && errno == ERANGE)
+}
+
+/* Sort the long name index of a spec by the names, in place (heapsort). */
+static void sort_long_order(struct dooshki_args_spec *spec)
+{
+    unsigned int *order = spec->long_order;
+    unsigned int count = spec->long_count;
+    unsigned int iter;
+    unsigned int opt_index;
+
+    for (iter = count / 2; iter-- > 0;)
+        sift_long_order(spec, iter, count);
+
+    for (iter = count; iter-- > 1;)
     {
-        print_error(args_ctxt,
-                    "Argument `%s' passed to option %s%s is too large.",
-                    argument, opt_prefix, opt_name);
+        opt_index   = order[0];
+        order[0]    = order[iter];
+        order[iter] = opt_index;
+        sift_long_order(spec, 0, iter);
+    }
+}
+
+#ifdef DOOSHKI_ARGS_AUTO_INDEX
+/*
+ * Option tables compiled by dooshki_args_parse, see DOOSHKI_ARGS_AUTO_INDEX.
+ *
+ *
+ * An open-addressed hash table keyed by the address of the option table.
+ * Each entry has its own copy of the dooshki_args structure the spec refers
+ * to, as the caller's one may be a temporary with the same options.  Tables
+ * which fail to compile are remembered with a NULL spec, and looked up
+ * linearly, just like the ones which don't fit into the cache anymore.
+ *
+ * Entries are added under a mutex, and published by storing `ready' last,
+ * so that tables which are already compiled are found without locking.
+ */
+struct auto_index
+{
+    const struct dooshki_opt *opt_desc;     /* NULL for unused slots */
+    struct dooshki_args args_ctxt;
+    struct dooshki_args_spec *spec;
+
+    const struct dooshki_opt *ready;        /* opt_desc once spec is set */
+};
+
+static struct auto_index auto_indexes[AUTO_INDEX_SLOTS];
+
+/*
+ * The lock-free lookup needs acquire and release ordering, which C89 can't
+ * express, the atomic builtins of GCC and Clang are used where available,
+ * other compilers always take the mutex.
+ */
+#ifdef DOOSHKI_ARGS_THREADS
+static pthread_mutex_t auto_index_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define AUTO_INDEX_LOCK()   pthread_mutex_lock(&auto_index_mutex)
+#define AUTO_INDEX_UNLOCK() pthread_mutex_unlock(&auto_index_mutex)
+
+#ifdef __ATOMIC_ACQUIRE
+#define AUTO_INDEX_LOAD(ptr)    __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define AUTO_INDEX_PUBLISH(ptr, value) \
+    __atomic_store_n((ptr), (value), __ATOMIC_RELEASE)
+#else
+#define AUTO_INDEX_PUBLISH(ptr, value) (*(ptr) = (value))
+#endif
+
+#else
+#define AUTO_INDEX_LOCK()
+#define AUTO_INDEX_UNLOCK()
+#define AUTO_INDEX_LOAD(ptr)            (*(ptr))
+#define AUTO_INDEX_PUBLISH(ptr, value)  (*(ptr) = (value))
+#endif
+
+/* Find the index of an option table, compiling it when first seen. */
+static const struct dooshki_args_spec *auto_index_find(
+                                    const struct dooshki_args *args_ctxt)
+{
+    const struct dooshki_opt *opt_desc = args_ctxt->opt_desc;
+    struct auto_index *entry = NULL;
+    unsigned int slot;
+    unsigned int iter;
+
+    slot = (unsigned int)(((size_t)opt_desc / sizeof(*opt_desc)) %
+                          AUTO_INDEX_SLOTS);
+
+#ifdef AUTO_INDEX_LOAD
+    /* Published entries, up to the first free or unfinished one. */
+    for (iter = 0; iter < AUTO_INDEX_SLOTS; iter++)
+    {
+        const struct dooshki_opt *ready;
+
+        entry = &auto_indexes[(slot + iter) % AUTO_INDEX_SLOTS];
+        ready = AUTO_INDEX_LOAD(&entry->ready);
+
+        if (ready == opt_desc)
+            return entry->spec;
+        if (ready == NULL)
+            break;
+    }
+    if (iter == AUTO_INDEX_SLOTS)
+        return NULL;
+#endif
+
+    AUTO_INDEX_LOCK();
+    for (iter = 0; iter < AUTO_INDEX_SLOTS; iter++)
+    {
+        entry = &auto_indexes[(slot + iter) % AUTO_INDEX_SLOTS];
+        if (entry->opt_desc == opt_desc || entry->opt_desc == NULL)
+            break;
+    }
+
+    if (iter == AUTO_INDEX_SLOTS)
+        entry = NULL;
+
+    else if (entry->opt_desc == NULL)
+    {
+        memset(&entry->args_ctxt, 0, sizeof(entry->args_ctxt));
+        entry->args_ctxt.program_name = args_ctxt->program_name;
+        entry->args_ctxt.opt_desc     = opt_desc;
+
+        entry->opt_desc = opt_desc;
+        entry->spec     = dooshki_args_compile(&entry->args_ctxt);
+        AUTO_INDEX_PUBLISH(&entry->ready, opt_desc);
+    }
+    AUTO_INDEX_UNLOCK();
+
+    return (entry != NULL)? entry->spec : NULL;
+}
+#endif
+
+enum dooshki_args_ret dooshki_args_parse(int *argc, char ***argv,
+                                         const struct dooshki_args *args_ctxt)
+{
+#ifdef DOOSHKI_ARGS_AUTO_INDEX
+    /* The adaptive lookup order would be bypassed by an index. */
+    if (args_ctxt->lookup_order == NULL)
+        return parse_args(argc, argv, args_ctxt, NULL,
+                          auto_index_find(args_ctxt), NULL);
+#endif
+    return parse_args(argc, argv, args_ctxt, NULL, NULL, NULL);
+}
+
+enum dooshki_args_ret dooshki_args_parse_spec(int *argc, char ***argv,
+                                        const struct dooshki_args_spec *spec)
+{
+    return parse_args(argc, argv, spec->args_ctxt, spec, NULL, NULL);
+}
+
+enum dooshki_args_ret dooshki_args_parse_image(
+                                    int *argc, char ***argv,
+                                    const struct dooshki_args *args_ctxt,
+                                    const struct dooshki_args_image *image)
+{
+    /* Indexes from another table would refer to the wrong options. */
+    if (! dooshki_args_image_check(image, args_ctxt))
+        return DOOSHKI_ARGS_PARSE_ERROR;
+
+    return parse_args(argc, argv, args_ctxt, NULL, NULL, image);
+}
+
+void dooshki_args_auto_index_free(void)
+{
+#ifdef DOOSHKI_ARGS_AUTO_INDEX
+    unsigned int iter;
+
+    AUTO_INDEX_LOCK();
+    for (iter = 0; iter < AUTO_INDEX_SLOTS; iter++)
+    {
+        dooshki_args_spec_free(auto_indexes[iter].spec);
+        auto_indexes[iter].spec     = NULL;
+        auto_indexes[iter].opt_desc = NULL;
+        auto_indexes[iter].ready    = NULL;
+    }
+    AUTO_INDEX_UNLOCK();
+#endif
+}
+
+void dooshki_args_err_usage(const struct dooshki_args *args_ctxt)
+{
+    print_usage(args_ctxt, 1);
+}
+
+int dooshki_args_spec_find_long(const struct dooshki_args_spec *spec,
+                                const char *name, unsigned int name_len,
+                                unsigned int *matches)
+{
+    return spec_find_long_opt(spec, name, name_len, matches);
+}
+
+int dooshki_args_spec_find_short(const struct dooshki_args_spec *spec,
+                                 char name)
+{
+    return (int)spec->short_index[(unsigned char)name] - 1;
+}
+
+unsigned long dooshki_args_spec_storage(unsigned int opt_count)
+{
+    return STORAGE_WORDS(opt_count * sizeof(unsigned long)) +
+           STORAGE_WORDS(opt_count * sizeof(unsigned int)) +
+           STORAGE_WORDS(spec_slot_count(opt_count) * sizeof(unsigned int)) +
+           STORAGE_WORDS(opt_count * sizeof(unsigned short));
+}
+
+char dooshki_args_compile_into(struct dooshki_args_spec *spec,
+                               const struct dooshki_args *args_ctxt,
+                               unsigned long *storage,
+                               unsigned long storage_size)
+{
+    const struct dooshki_opt *opt_desc = args_ctxt->opt_desc;
+    unsigned int opt_count;
+    unsigned int iter;
+    unsigned long slot;
+    size_t name_len;
+
+    for (opt_count = 0; !IS_LAST_OPT(&opt_desc[opt_count]); opt_count++);
+
+    if (storage_size < dooshki_args_spec_storage(opt_count))
         return 0;
+
+    spec->args_ctxt  = args_ctxt;
+    spec->opt_count  = opt_count;
+    spec->long_count = 0;
+    spec->slot_count = spec_slot_count(opt_count);
+    spec->help_cache = NULL;
+
+    /* The arrays are laid out in the order of dooshki_args_spec_storage. */
+    spec->name_hash  = (unsigned long *)storage;
+    storage += STORAGE_WORDS(opt_count * sizeof(unsigned long));
+    spec->long_order = (unsigned int *)storage;
+    storage += STORAGE_WORDS(opt_count * sizeof(unsigned int));
+    spec->name_slots = (unsigned int *)storage;
+    storage += STORAGE_WORDS(spec->slot_count * sizeof(unsigned int));
+    spec->name_len   = (unsigned short *)storage;
+
+    for (iter = 0; iter < spec->slot_count; iter++)
+        spec->name_slots[iter] = 0;
+
+    for (iter = 0; iter < 256; iter++)
+        spec->short_index[iter] = 0;
+
+    /* Filled in reverse, so that the first of duplicate names wins. */
+    for (iter = opt_count; iter-- > 0;)
+    {
+        if (opt_desc[iter].short_name != NULL)
+            spec->short_index[(unsigned char)opt_desc[iter].short_name[0]] =
+                iter + 1;
     }
-    if (*dest == -HUGE_VAL && errno == ERANGE)
+
+    for (iter = 0; iter < opt_count; iter++)
+    {
+        if (opt_desc[iter].long_name != NULL)
+        {
+            name_len = strlen(opt_desc[iter].long_name);
+            if (name_len > DOOSHKI_ARGS_MAX_NAME_LEN)
+            {
+                print_error(args_ctxt,
+                            "Bug: Name of option --%s is too long",
+                            opt_desc[iter].long_name);
+                return 0;
+            }
+            spec->name_hash[iter] = hash_name(opt_desc[iter].long_name,
+                                              (unsigned int)name_len);
+            spec->name_len[iter]  = (unsigned short)name_len;
+
+            /* Inserted in order, so that the first of duplicate names wins. */
+            slot = spec->name_hash[iter] & (spec->slot_count - 1);
+            while (spec->name_slots[slot] != 0)
+                slot = (slot + 1) & (spec->slot_count - 1);
+
+            spec->name_slots[slot] = iter + 1;
+            spec->long_order[spec->long_count++] = iter;
+        }
+        else
+        {
+            spec->name_hash[iter] = 0;
+            spec->name_len[iter]  = 0;
+        }
+    }
+
+    sort_long_order(spec);
+    return 1;
+}
+
+#ifndef DOOSHKI_ARGS_NO_HEAP
+struct dooshki_args_spec *dooshki_args_compile(
+                                    const struct dooshki_args *args_ctxt)
+{
+    struct dooshki_args_spec *spec;
+    struct dooshki_help_cache *help_cache;
+    unsigned long *storage;
+    unsigned long storage_size;
+    unsigned int opt_count;
+
+    for (opt_count = 0; !IS_LAST_OPT(&args_ctxt->opt_desc[opt_count]);
+         opt_count++);
+
+    storage_size = dooshki_args_spec_storage(opt_count);
+
+    spec       = malloc(sizeof(*spec));
+    storage    = malloc(storage_size * sizeof(*storage));
+    help_cache = malloc(sizeof(*help_cache));
+
+    if (spec == NULL || storage == NULL || help_cache == NULL ||
+        ! dooshki_args_compile_into(spec, args_ctxt, storage, storage_size))
+    {
+        free(spec);
+        free(storage);
+        free(help_cache);
+        return NULL;
+    }
+
+    help_cache->current = NULL;
+    spec->help_cache = help_cache;
+
+    return spec;
+}
+
+void dooshki_args_spec_free(struct dooshki_args_spec *spec)
+{
+    if (spec != NULL)
     {
-        print_error(args_ctxt,
-                    "Argument `%s' passed to option %s%s is too small.",
-                    argument, opt_prefix, opt_name);
-        return 0;
+        /* The storage of the arrays starts with name_hash. */
+        free(spec->name_hash);
+
+        if (spec->help_cache != NULL)
+        {
+            free_help_lines(spec->help_cache->current);
+            free(spec->help_cache);
+        }
+        free(spec);
     }
-    if (*dest == 0 && errno == ERANGE)
+}
+#endif
+
+void dooshki_args_order_reset(const struct dooshki_args *args_ctxt)
+{
+    unsigned int iter;
+
+    for (iter = 0; !IS_LAST_OPT(&args_ctxt->opt_desc[iter]); iter++)
     {
-        print_error(args_ctxt,
-                    "Argument `%s' passed to option %s%s would cause "
-                    "an underflow.",
-                    argument, opt_prefix, opt_name);
-        return 0;
+        args_ctxt->lookup_order->order[iter] = iter;
+        args_ctxt->lookup_order->hits[iter]  = 0;
     }
-    return 1;
 }
 
-/* Process the argument of an option, returns 1 on success, 0 on failure. */
-static char process_opt_arg(const struct dooshki_args *args_ctxt,
-                            const struct dooshki_opt  *option,
-                            char         opt_is_long,
-                            const char  *argument)
+#ifndef DOOSHKI_ARGS_NO_STDIO
+void dooshki_args_trace_write(const struct dooshki_args *args_ctxt,
+                              const struct dooshki_trace_event *events,
+                              unsigned int event_count,
+                              void *trace_data)
 {
-    const char *opt_prefix;
-    const char *opt_name;
-    char retval = 1;
+    const struct dooshki_opt *opt_entry;
+    unsigned int iter;
 
-    if (opt_is_long)
+    for (iter = 0; iter < event_count; iter++)
     {
-        opt_prefix = "--";
-        opt_name   = option->long_name;
+        if (events[iter].opt_index < 0)
+            continue;
+
+        opt_entry = &args_ctxt->opt_desc[events[iter].opt_index];
+        fprintf(trace_data, "%d %s %s\n", events[iter].opt_index,
+                (opt_entry->short_name != NULL)? opt_entry->short_name : "-",
+                (opt_entry->long_name  != NULL)? opt_entry->long_name  : "-");
     }
-    else
+}
+#endif
+
+enum dooshki_args_ret dooshki_args_convert_list(
+                                    const struct dooshki_args *args_ctxt,
+                                    enum dooshki_opt_type type,
+                                    const char *list_name,
+                                    int count, char **entries, void *values)
+{
+    struct conv_list list;
+
+    if (type != DOOSHKI_OPT_INT && type != DOOSHKI_OPT_UINT &&
+        type != DOOSHKI_OPT_FLOAT)
     {
-        opt_prefix = "-";
-        opt_name   = option->short_name;
+        print_error(args_ctxt,
+                    "Bug: Type %u of %s is not a numeric type",
+                    (unsigned int)type, list_name);
+        return DOOSHKI_ARGS_PARSE_ERROR;
     }
 
-    switch (option->type)
+    list.args_ctxt = args_ctxt;
+    list.type      = type;
+    list.list_name = list_name;
+    list.entries   = entries;
+    list.values    = values;
+
+    if (! bulk_process(conv_list_range, &list, count))
+        return DOOSHKI_ARGS_PARSE_ERROR;
+
+    return DOOSHKI_ARGS_PARSE_OK;
+}
+
+enum dooshki_args_ret dooshki_args_check_files(
+                                    const struct dooshki_args *args_ctxt,
+                                    unsigned int checks,
+                                    int count, char **entries,
+                                    enum dooshki_file_status *statuses)
+{
+    struct file_list list;
+
+    list.args_ctxt = args_ctxt;
+    list.checks    = checks;
+    list.entries   = entries;
+    list.statuses  = statuses;
+
+    if (! bulk_process(file_list_range, &list, count))
+        return DOOSHKI_ARGS_PARSE_ERROR;
+
+    return DOOSHKI_ARGS_PARSE_OK;
+}
+
+unsigned long dooshki_args_dump_json(const struct dooshki_args *args_ctxt,
+                                     char *buffer, unsigned long size)
+{
+    static const char *const type_names[] =
     {
-        case DOOSHKI_OPT_STR:
-            if (! process_str_arg(option, argument))
-                retval = 0;
-            break;
+        "bool", "negbool", "str", "int", "uint", "float", "cb", "cb_noarg"
+    };
+    const struct dooshki_opt *option;
+    struct json_out out;
 
-        case DOOSHKI_OPT_INT:
-            if (! process_int_arg(args_ctxt, option, opt_prefix, opt_name,
-                                  argument))
-                retval = 0;
-            break;
+    out.buffer = buffer;
+    out.size   = size;
+    out.length = 0;
 
-        case DOOSHKI_OPT_UINT:
-            if (! process_uint_arg(args_ctxt, option, opt_prefix, opt_name,
-                                   argument))
-                retval = 0;
-            break;
+    JSON_PUT_LITERAL(&out, "[");
+    for (option = args_ctxt->opt_desc; ! IS_LAST_OPT(option); option++)
+    {
+        if (option != args_ctxt->opt_desc)
+            JSON_PUT_LITERAL(&out, ",");
 
-        case DOOSHKI_OPT_FLOAT:
-            if (! process_float_arg(args_ctxt, option, opt_prefix, opt_name,
-                                    argument))
-                retval = 0;
-            break;
+        JSON_PUT_LITERAL(&out, "{\"name\":");
+        json_put_string(&out, (option->long_name != NULL)?
+                              option->long_name : option->short_name);
 
-        case DOOSHKI_OPT_CB:
-            if (! option->callback(argument, option->opt_storage, opt_prefix,
-                                   opt_name, option->callback_data))
-                retval = 0;
-            break;
+        JSON_PUT_LITERAL(&out, ",\"type\":");
+        json_put_string(&out, ((unsigned int)option->type <
+                               sizeof(type_names) / sizeof(type_names[0]))?
+                              type_names[option->type] : "unknown");
 
-        default:
-            print_error(args_ctxt,
-                        "Bug: Unknown argument type %u for option %s%s",
-                         (unsigned int)option->type, opt_prefix, opt_name);
-            retval = 0;
+        JSON_PUT_LITERAL(&out, ",\"value\":");
+        json_put_value(&out, option);
+
+        if (option->opt_found == NULL)
+            JSON_PUT_LITERAL(&out, ",\"found\":null,\"source\":null}");
+        else if (*option->opt_found)
+            JSON_PUT_LITERAL(&out, ",\"found\":true,\"source\":\"argv\"}");
+        else
+            JSON_PUT_LITERAL(&out, ",\"found\":false,\"source\":\"default\"}");
     }
-    return retval;
+    JSON_PUT_LITERAL(&out, "]");
+
+    if (size > 0)
+        buffer[(out.length < size)? out.length : size - 1] = '\0';
+
+    return out.length;
 }
 
-static void process_long_opt(int *argc, char ***argv, unsigned int opt_argi,
-                             const struct dooshki_args *args_ctxt,
-                             char *show_help,
-                             char *show_version,
-                             char *errors_found)
+unsigned long dooshki_args_export(const struct dooshki_args_spec *spec,
+                                  unsigned char *buffer, unsigned long size)
 {
+    const struct dooshki_opt *opt_desc = spec->args_ctxt->opt_desc;
+    unsigned long slot_count = 2;
+    unsigned long strings_size = 0;
+    unsigned long strings_used = 0;
+    unsigned long entries;
+    unsigned long strings;
+    unsigned long total_size;
+    unsigned long slot;
     unsigned int iter;
-    unsigned int opt_len;
-    char opt_recognized;
 
-    const char *option = (*argv)[opt_argi];
-    const char *argument = NULL;
+    while (slot_count < 2UL * spec->opt_count)
+        slot_count *= 2;
 
-    if (strcmp(option, "--" HELP_LONG_OPT) == 0)
+    for (iter = 0; iter < spec->opt_count; iter++)
     {
-        if (! *show_version)
-            *show_help = 1;
-        return;
+        strings_size += image_string_size(opt_desc[iter].long_name) +
+                        image_string_size(opt_desc[iter].short_name) +
+                        image_string_size(opt_desc[iter].argument_template) +
+                        image_string_size(opt_desc[iter].description);
     }
 
-    if (strcmp(option, "--" VER_LONG_OPT) == 0)
-    {
-        if (! *show_help)
-            *show_version = 1;
-        return;
-    }
+    entries    = IMAGE_SLOTS + slot_count * 4;
+    strings    = entries + spec->opt_count * IMAGE_ENTRY_SIZE;
+    total_size = strings + strings_size;
 
-    for (iter = 2; option[iter] != '\0' && option[iter] != '='; iter++);
-    opt_len = iter - 2;
+    if (buffer == NULL || size < total_size)
+        return total_size;
 
-    if (option[iter] == '=')
-        argument = &option[iter+1];
+    memset(buffer, 0, strings);
+    memcpy(buffer, IMAGE_MAGIC, 4);
+    image_put(&buffer[4],  IMAGE_VERSION);
+    image_put(&buffer[8],  spec->opt_count);
+    image_put(&buffer[12], slot_count);
+    image_put(&buffer[16], strings_size);
+    image_put(&buffer[20], total_size);
 
-    for (iter = 0, opt_recognized = 0;
-         (args_ctxt->opt_desc[iter].short_name != NULL ||
-          args_ctxt->opt_desc[iter].long_name  != NULL) && !opt_recognized;
-         iter++)
+    for (iter = 0; iter < 256; iter++)
+        image_put(&buffer[IMAGE_SHORT_INDEX + iter * 4],
+                  spec->short_index[iter]);
+
+    for (iter = 0; iter < spec->opt_count; iter++)
     {
-        if (args_ctxt->opt_desc[iter].long_name == NULL)
-            continue;
+        const struct dooshki_opt *option = &opt_desc[iter];
+        unsigned char *entry = &buffer[entries + iter * IMAGE_ENTRY_SIZE];
+
+        image_put(&entry[0], spec->name_hash[iter]);
+        image_put(&entry[4], spec->name_len[iter]);
+        image_put(&entry[8],  image_add_string(&buffer[strings], &strings_used,
+                                               option->long_name));
+        image_put(&entry[12], image_add_string(&buffer[strings], &strings_used,
+                                               option->short_name));
+        image_put(&entry[16], image_add_string(&buffer[strings], &strings_used,
+                                               option->argument_template));
+        image_put(&entry[20], image_add_string(&buffer[strings], &strings_used,
+                                               option->description));
+        image_put(&entry[24], option->type);
 
-        if (strncmp(option + 2, args_ctxt->opt_desc[iter].long_name,
-                    opt_len) == 0)
+        /* Inserted in order, so that the first of duplicate names wins. */
+        if (option->long_name != NULL)
         {
-            opt_recognized = 1;
+            slot = spec->name_hash[iter] & (slot_count - 1);
+            while (image_get(&buffer[IMAGE_SLOTS + slot * 4]) != 0)
+                slot = (slot + 1) & (slot_count - 1);
+
+            image_put(&buffer[IMAGE_SLOTS + slot * 4], iter + 1);
+        }
+    }
+    return total_size;
+}
 
-            if (args_ctxt->opt_desc[iter].opt_found != NULL)
-                *(args_ctxt->opt_desc[iter].opt_found) = 1;
+char dooshki_args_image_open(struct dooshki_args_image *image,
+                             const void *data, unsigned long size)
+{
+    const unsigned char *bytes = data;
+    unsigned long opt_count;
+    unsigned long slot_count;
+    unsigned long strings_size;
+    unsigned long entries;
+    unsigned long strings;
+    unsigned long index;
+    unsigned long iter;
 
-            if (args_ctxt->opt_desc[iter].type == DOOSHKI_OPT_BOOL)
-            {
-                char *bool_ptr;
+    if (size < IMAGE_SLOTS || memcmp(bytes, IMAGE_MAGIC, 4) != 0 ||
+        image_get(&bytes[4]) != IMAGE_VERSION ||
+        image_get(&bytes[20]) != size)
+        return 0;
 
-                if (argument != NULL)
-                {
-                    print_error(args_ctxt,
-                                "Argument `%s' not expected for option --%s",
-                                argument, args_ctxt->opt_desc[iter].long_name);
-                    *errors_found = 1;
-                    return;
-                }
+    opt_count    = image_get(&bytes[8]);
+    slot_count   = image_get(&bytes[12]);
+    strings_size = image_get(&bytes[16]);
 
-                bool_ptr = args_ctxt->opt_desc[iter].opt_storage;
-                *bool_ptr = 1;
-            }
-            else if (args_ctxt->opt_desc[iter].type == DOOSHKI_OPT_NEGBOOL)
-            {
-                char *bool_ptr;
+    if (slot_count <= opt_count || (slot_count & (slot_count - 1)) != 0 ||
+        slot_count > (size - IMAGE_SLOTS) / 4)
+        return 0;
 
-                if (argument != NULL)
-                {
-                    print_error(args_ctxt,
-                                "Argument `%s' not expected for option --%s",
-                                argument, args_ctxt->opt_desc[iter].long_name);
-                    *errors_found = 1;
-                    return;
-                }
+    entries = IMAGE_SLOTS + slot_count * 4;
+    if (opt_count > (size - entries) / IMAGE_ENTRY_SIZE)
+        return 0;
 
-                bool_ptr = args_ctxt->opt_desc[iter].opt_storage;
-                *bool_ptr = 0;
-            }
-            else if (args_ctxt->opt_desc[iter].type == DOOSHKI_OPT_CB_NOARG)
-            {
-                if (argument != NULL)
-                {
-                    print_error(args_ctxt,
-                                "Argument `%s' not expected for option --%s",
-                                argument, args_ctxt->opt_desc[iter].long_name);
-                    *errors_found = 1;
-                    return;
-                }
+    strings = entries + opt_count * IMAGE_ENTRY_SIZE;
+    if (size - strings != strings_size ||
+        (strings_size > 0 && bytes[size - 1] != '\0'))
+        return 0;
 
-                if (! args_ctxt->opt_desc[iter].callback(NULL,
-                                                         args_ctxt->opt_desc[iter].opt_storage,
-                                                         "--",
-                                                         args_ctxt->opt_desc[iter].long_name,
-                                                         args_ctxt->opt_desc[iter].callback_data))
-                    *errors_found = 1;
-            }
-            else
-            {
-                if (argument == NULL)
-                {
-                    int arg_iter;
-
-                    for (arg_iter = opt_argi + 1; arg_iter < *argc; arg_iter++)
-                    {
-                        if ((*argv)[arg_iter] != NULL)
-                        {
-                            if (strcmp((*argv)[arg_iter], "--") == 0)
-                                break;
-                            else
-                            {
-                                argument = (*argv)[arg_iter];
-                                (*argv)[arg_iter] = NULL;
-                                break;
-                            }
-                        }
-                    }
-                    if (argument == NULL)
-                    {
-                        print_error(args_ctxt,
-                                    "Missing argument for option --%s",
-                                    args_ctxt->opt_desc[iter].long_name);
-                        *errors_found = 1;
-                        return;
-                    }
-                }
-                if (! process_opt_arg(args_ctxt, &args_ctxt->opt_desc[iter],
-                                      1, argument))
-                    *errors_found = 1;
-            }
-        }
+    for (iter = 0; iter < 256; iter++)
+    {
+        if (image_get(&bytes[IMAGE_SHORT_INDEX + iter * 4]) > opt_count)
+            return 0;
+    }
+    for (iter = 0; iter < slot_count; iter++)
+    {
+        if (image_get(&bytes[IMAGE_SLOTS + iter * 4]) > opt_count)
+            return 0;
+    }
+    for (iter = 0; iter < opt_count; iter++)
+    {
+        if (! image_entry_ok(&bytes[entries + iter * IMAGE_ENTRY_SIZE],
+                             (const char *)&bytes[strings], strings_size))
+            return 0;
+    }
+
+    /* The lookup tables may only lead to options with the name looked up. */
+    for (iter = 0; iter < 256; iter++)
+    {
+        index = image_get(&bytes[IMAGE_SHORT_INDEX + iter * 4]);
+        if (index != 0 &&
+            ! image_short_ok(&bytes[entries + (index - 1) * IMAGE_ENTRY_SIZE],
+                             (const char *)&bytes[strings],
+                             (unsigned int)iter))
+            return 0;
     }
-    if (!opt_recognized)
+    for (iter = 0; iter < slot_count; iter++)
     {
-        print_error(args_ctxt, "Unrecognized option %s", option);
-        *errors_found = 1;
+        if (! image_slot_ok(&bytes[IMAGE_SLOTS], slot_count, &bytes[entries],
+                            (const char *)&bytes[strings], iter))
+            return 0;
     }
+
+    image->data       = bytes;
+    image->size       = size;
+    image->opt_count  = (unsigned int)opt_count;
+    image->slot_count = slot_count;
+    image->entries    = &bytes[entries];
+    image->strings    = (const char *)&bytes[strings];
+    image->mapping    = NULL;
+
+    return 1;
 }
 
-static void process_short_opts(int *argc, char ***argv, unsigned int opt_argi,
-                               const struct dooshki_args *args_ctxt,
-                               char *show_help,
-                               char *show_version,
-                               char *errors_found)
+char dooshki_args_image_map(struct dooshki_args_image *image,
+                            const char *path)
 {
-    unsigned int in_iter;
-    unsigned int opt_iter;
-    char opt_recognized;
-    char direct_arg;
+#ifdef DOOSHKI_ARGS_POSIX
+    struct stat file_info;
+    void *mapping;
+    int fd;
 
-    const char *options = (*argv)[opt_argi];
+    fd = open(path, O_RDONLY | O_NOCTTY);
+    if (fd < 0)
+        return 0;
 
-    for (in_iter = 1, direct_arg = 0;
-         options[in_iter] != '\0' && !direct_arg;
-         in_iter++)
+    if (fstat(fd, &file_info) != 0 || file_info.st_size <= 0 ||
+        (unsigned long)file_info.st_size != (size_t)file_info.st_size)
     {
-        if (options[in_iter] == HELP_SHORT_OPT)
-        {
-            if (! *show_version)
-                *show_help = 1;
+        close(fd);
+        return 0;
+    }
 
-            continue;
-        }
-        if (options[in_iter] == VER_SHORT_OPT)
-        {
-            if (! *show_help)
-                *show_version = 1;
+    mapping = mmap(NULL, (size_t)file_info.st_size, PROT_READ, MAP_PRIVATE,
+                   fd, 0);
+    close(fd);
 
-            continue;
-        }
-        for (opt_iter = 0, opt_recognized = 0;
-             (args_ctxt->opt_desc[opt_iter].short_name != NULL ||
-              args_ctxt->opt_desc[opt_iter].long_name  != NULL) &&
-             !opt_recognized; opt_iter++)
-        {
-            if (args_ctxt->opt_desc[opt_iter].short_name == NULL)
-                continue;
+    if (mapping == MAP_FAILED)
+        return 0;
 
-            if (options[in_iter] == (args_ctxt->opt_desc[opt_iter].short_name[0]))
-            {
-                opt_recognized = 1;
+    if (! dooshki_args_image_open(image, mapping,
+                                  (unsigned long)file_info.st_size))
+    {
+        munmap(mapping, (size_t)file_info.st_size);
+        return 0;
+    }
 
-                if (args_ctxt->opt_desc[opt_iter].opt_found != NULL)
-                    *(args_ctxt->opt_desc[opt_iter].opt_found) = 1;
+    image->mapping = mapping;
+    return 1;
+#elif !defined(DOOSHKI_ARGS_NO_STDIO) && !defined(DOOSHKI_ARGS_NO_HEAP)
+    FILE *file;
+    unsigned char *mapping;
+    long size;
 
-                if (args_ctxt->opt_desc[opt_iter].type == DOOSHKI_OPT_BOOL)
-                {
-                    char *bool_ptr;
+    file = fopen(path, "rb");
+    if (file == NULL)
+        return 0;
 
-                    bool_ptr = args_ctxt->opt_desc[opt_iter].opt_storage;
-                    *bool_ptr = 1;
-                }
-                else if (args_ctxt->opt_desc[opt_iter].type == DOOSHKI_OPT_NEGBOOL)
-                {
-                    char *bool_ptr;
+    if (fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) <= 0 ||
+        fseek(file, 0, SEEK_SET) != 0 || (mapping = malloc(size)) == NULL)
+    {
+        fclose(file);
+        return 0;
+    }
 
-                    bool_ptr = args_ctxt->opt_desc[opt_iter].opt_storage;
-                    *bool_ptr = 0;
-                }
-                else if (args_ctxt->opt_desc[opt_iter].type == DOOSHKI_OPT_CB_NOARG)
-                {
+    if (fread(mapping, 1, (size_t)size, file) != (size_t)size ||
+        ! dooshki_args_image_open(image, mapping, (unsigned long)size))
+    {
+        free(mapping);
+        fclose(file);
+        return 0;
+    }
+    fclose(file);
 
-                    if (! args_ctxt->opt_desc[opt_iter].callback(NULL,
-                                                                 args_ctxt->opt_desc[opt_iter].opt_storage,
-                                                                 "-",
-                                                                 args_ctxt->opt_desc[opt_iter].short_name,
-                                                                 args_ctxt->opt_desc[opt_iter].callback_data))
-                        *errors_found = 1;
-                }
-                else
-                {
-                    if (options[in_iter + 1] == '\0')
-                    {
-                        const char *argument;
-                        int arg_iter;
-
-                        for (arg_iter = opt_argi + 1, argument = NULL;
-                             arg_iter < *argc && argument == NULL;
-                             arg_iter++)
-                        {
-                            if ((*argv)[arg_iter] != NULL)
-                            {
-                                if (strcmp((*argv)[arg_iter], "--") == 0)
-                                {
-                                    break;
-                                }
-                                else
-                                {
-                                    argument = (*argv)[arg_iter];
-                                    (*argv)[arg_iter] = NULL;
-                                }
-                            }
-                        }
-                        if (argument == NULL)
-                        {
-                            print_error(args_ctxt,
-                                        "Missing argument for option -%s",
-                                        args_ctxt->opt_desc[opt_iter].short_name);
-                            *errors_found = 1;
-                        }
-                        else if (! process_opt_arg(args_ctxt,
-                                                   &args_ctxt->opt_desc[opt_iter], 0, argument))
-                        {
-                            *errors_found = 1;
-                        }
-
-                    }
-                    else
-                    {
-                        direct_arg = 1;
-
-                        if (options[in_iter + 1] == '=')
-                        {
-                            in_iter += 1;
-                            if (options[in_iter + 1] == '\0')
-                            {
-                                print_error(args_ctxt,
-                                            "Missing argument for option -%s",
-                                            args_ctxt->opt_desc[opt_iter].short_name);
-
-                                *errors_found = 1;
-                                direct_arg = 0;
-                            }
-                        }
-                        if (direct_arg)
-                        {
-                            if (! process_opt_arg(args_ctxt,
-                                                  &args_ctxt->opt_desc[opt_iter], 0,
-                                                  &options[in_iter + 1]))
-                            {
-                                *errors_found = 1;
-                            }
-                        }
-                    }
-                }
-            }
-        }
-        if (!opt_recognized)
-        {
-            print_error(args_ctxt,
-                        "Unrecognized option -%c", options[in_iter]);
-            *errors_found = 1;
-        }
+    image->mapping = mapping;
+    return 1;
+#else
+    /* Neither mmap nor stdio and the heap, there's no way to load the file. */
+    (void)image;
+    (void)path;
+
+    return 0;
+#endif
+}
+
+void dooshki_args_image_unmap(struct dooshki_args_image *image)
+{
+    if (image->mapping != NULL)
+    {
+#if defined(DOOSHKI_ARGS_POSIX)
+        munmap(image->mapping, (size_t)image->size);
+#elif !defined(DOOSHKI_ARGS_NO_HEAP)
+        free(image->mapping);
+#endif
+        image->mapping = NULL;
     }
 }
 
-/* Remove NULL entries from argc/argv. */
-static void deflate_args_list(int *argc, char ***argv)
+int dooshki_args_image_find_long(const struct dooshki_args_image *image,
+                                 const char *name, unsigned int name_len)
 {
-    int fill_iter;
-    int pull_iter;
+    const unsigned char *slots = &image->data[IMAGE_SLOTS];
+    unsigned long hash = hash_name(name, name_len);
+    unsigned long slot = hash & (image->slot_count - 1);
+    const unsigned char *entry;
+    unsigned long index;
+    unsigned long iter;
 
-    for (fill_iter = 1; fill_iter < *argc; fill_iter++)
+    for (iter = 0; iter < image->slot_count; iter++)
     {
-        if ((*argv)[fill_iter] == NULL)
-        {
-            for (pull_iter = fill_iter + 1; pull_iter < *argc; pull_iter++)
-            {
-                if ((*argv)[pull_iter] != NULL)
-                {
-                    (*argv)[fill_iter] = (*argv)[pull_iter];
-                    (*argv)[pull_iter] = NULL;
-                    break;
-                }
-            }
-        }
-
-        if ((*argv)[fill_iter] == NULL)
+        index = image_get(&slots[slot * 4]);
+        if (index == 0)
             break;
+
+        entry = &image->entries[(index - 1) * IMAGE_ENTRY_SIZE];
+        if (image_get(&entry[0]) == hash &&
+            image_get(&entry[4]) == name_len &&
+            strncmp(&image->strings[image_get(&entry[8])], name,
+                    name_len) == 0)
+            return (int)(index - 1);
+
+        slot = (slot + 1) & (image->slot_count - 1);
     }
-    *argc = fill_iter;
+
+    if (name_len == 0)
+        return -1;
+
+    /* Abbreviations are resolved just like by the parser. */
+    for (iter = 0; iter < image->opt_count; iter++)
+    {
+        entry = &image->entries[iter * IMAGE_ENTRY_SIZE];
+        if (image_get(&entry[4]) > name_len &&
+            strncmp(&image->strings[image_get(&entry[8])], name,
+                    name_len) == 0)
+            return (int)iter;
+    }
+    return -1;
 }
 
-enum dooshki_args_ret dooshki_args_parse(int *argc, char ***argv,
-                                         const struct dooshki_args *args_ctxt)
+int dooshki_args_image_find_short(const struct dooshki_args_image *image,
+                                  char name)
 {
-    int arg_iter;
+    return (int)image_get(&image->data[IMAGE_SHORT_INDEX +
+                                       (unsigned char)name * 4]) - 1;
+}
 
-    char stopper_reached = 0;
-    char show_help       = 0;
-    char show_version    = 0;
-    char errors_found    = 0;
+/* Get a string from an image, NULL if missing. */
+#define IMAGE_STRING(image, offset) \
+    (((offset) != IMAGE_NONE)? &(image)->strings[offset] : NULL)
 
+void dooshki_args_image_option(const struct dooshki_args_image *image,
+                               unsigned int index,
+                               struct dooshki_opt *option)
+{
+    const unsigned char *entry = &image->entries[index * IMAGE_ENTRY_SIZE];
 
-    for (arg_iter = 1; arg_iter < *argc && !stopper_reached; arg_iter++)
-    {
-        if ((*argv)[arg_iter] != NULL && ((*argv)[arg_iter])[0] == '-')
-        {
-            if (((*argv)[arg_iter])[1] == '-')
-            {
-                if (((*argv)[arg_iter])[2] == '\0')
-                    stopper_reached = 1;
+    option->long_name         = IMAGE_STRING(image, image_get(&entry[8]));
+    option->short_name        = IMAGE_STRING(image, image_get(&entry[12]));
+    option->argument_template = IMAGE_STRING(image, image_get(&entry[16]));
+    option->description       = IMAGE_STRING(image, image_get(&entry[20]));
+    option->type              = (enum dooshki_opt_type)image_get(&entry[24]);
+    option->opt_storage       = NULL;
+    option->opt_found         = NULL;
+    option->callback          = NULL;
+    option->callback_data     = NULL;
+}
 
-                else
-                    process_long_opt(argc, argv, arg_iter, args_ctxt,
-                                     &show_help, &show_version, &errors_found);
-            }
-            else
-                process_short_opts(argc, argv, arg_iter, args_ctxt,
-                                   &show_help, &show_version, &errors_found);
+/* Check that a string of an image is the given one, both may be missing. */
+static char image_string_is(const struct dooshki_args_image *image,
+                            unsigned long offset, const char *str)
+{
+    if (offset == IMAGE_NONE || str == NULL)
+        return (offset == IMAGE_NONE && str == NULL);
 
-            (*argv)[arg_iter] = NULL;
-        }
-    }
-    deflate_args_list(argc, argv);
+    return (strcmp(&image->strings[offset], str) == 0);
+}
+
+char dooshki_args_image_check(const struct dooshki_args_image *image,
+                              const struct dooshki_args *args_ctxt)
+{
+    const struct dooshki_opt *opt_desc = args_ctxt->opt_desc;
+    const unsigned char *entry;
+    unsigned int iter;
 
-    if (show_help)
+    for (iter = 0; ! IS_LAST_OPT(&opt_desc[iter]); iter++)
     {
-        if (errors_found)
-            fputc('\n', stderr);
+        if (iter >= image->opt_count)
+            return 0;
 
-        print_help(args_ctxt);
-        return DOOSHKI_ARGS_HELP_SHOWN;
+        entry = &image->entries[iter * IMAGE_ENTRY_SIZE];
+        if (! image_string_is(image, image_get(&entry[8]),
+                              opt_desc[iter].long_name) ||
+            ! image_string_is(image, image_get(&entry[12]),
+                              opt_desc[iter].short_name) ||
+            image_get(&entry[24]) != (unsigned long)opt_desc[iter].type)
+            return 0;
     }
+    return (iter == image->opt_count);
+}
 
-    if (show_version)
+#ifndef DOOSHKI_ARGS_NO_HEAP
+char dooshki_args_print_completion(const struct dooshki_args *args_ctxt,
+                                   enum dooshki_shell shell)
+{
+    unsigned int word_count;
+    char **words;
+    char *ident;
+    size_t iter;
+
+    if (shell == DOOSHKI_SHELL_FISH)
     {
-        if (errors_found)
-            fputc('\n', stderr);
+        print_fish_completion(args_ctxt);
+        return 1;
+    }
 
-        print_version(args_ctxt);
-        return DOOSHKI_ARGS_VER_SHOWN;
+    /* The program name, usable within shell function names. */
+    ident = malloc(strlen(args_ctxt->program_name) + 1);
+    if (ident == NULL)
+        return 0;
+
+    for (iter = 0; args_ctxt->program_name[iter] != '\0'; iter++)
+    {
+        ident[iter] = isalnum((unsigned char)args_ctxt->program_name[iter])?
+                      args_ctxt->program_name[iter] : '_';
     }
+    ident[iter] = '\0';
 
-    if (errors_found)
+    words = sorted_opt_words(args_ctxt, &word_count);
+    if (words == NULL)
     {
-        print_usage(args_ctxt, 1);
-        return DOOSHKI_ARGS_PARSE_ERROR;
+        free(ident);
+        return 0;
     }
 
-    return DOOSHKI_ARGS_PARSE_OK;
+    if (shell == DOOSHKI_SHELL_BASH)
+        print_bash_completion(args_ctxt, ident, words, word_count);
+    else
+        print_zsh_completion(args_ctxt, ident, words, word_count);
+
+    free(words);
+    free(ident);
+    return 1;
 }
+#endif
 
-void dooshki_args_err_usage(const struct dooshki_args *args_ctxt)
+const char *const *dooshki_args_find_catalog(
+                                    const struct dooshki_catalog *catalogs,
+                                    const char *locale)
 {
-    print_usage(args_ctxt, 1);
+    static const char *const locale_vars[] =
+    {
+        "LC_ALL", "LC_MESSAGES", "LANG"
+    };
+    const struct dooshki_catalog *catalog;
+    unsigned int iter;
+    size_t locale_len;
+    size_t lang_len;
+
+    for (iter = 0; locale == NULL && iter < 3; iter++)
+    {
+        locale = getenv(locale_vars[iter]);
+        if (locale != NULL && locale[0] == '\0')
+            locale = NULL;
+    }
+    if (locale == NULL)
+        return NULL;
+
+    /* Ignore the codeset and modifier, "sk_SK.UTF-8" is matched as "sk_SK". */
+    locale_len = strcspn(locale, ".@");
+    lang_len   = strcspn(locale, "_.@");
+
+    for (catalog = catalogs; catalog->locale != NULL; catalog++)
+    {
+        if (strlen(catalog->locale) == locale_len &&
+            strncmp(catalog->locale, locale, locale_len) == 0)
+            return catalog->messages;
+    }
+    for (catalog = catalogs; catalog->locale != NULL; catalog++)
+    {
+        if (strlen(catalog->locale) == lang_len &&
+            strncmp(catalog->locale, locale, lang_len) == 0)
+            return catalog->messages;
+    }
+    return NULL;
 }
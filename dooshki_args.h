@@ -24,7 +24,8 @@
  * and tweak it to your liking.  In particular, you can configure the layout
  * of the help screen by modifying the _COL constants in dooshki_args.c,
  * and modify the help and version options (short name, long name, description)
- * by changing the HELP_ and VER_ constants.
+ * by changing the HELP_ and VER_ constants.  The rest of the English messages
+ * are listed in ENGLISH_MESSAGES.
  *
  * You can find this library in https://github.com/dusxmt/dooshki-util
  */
@@ -58,9 +59,20 @@
  * types of options, which can be used to override each other (useful when
  * utilizing FLAGS variables to pass a set of default command-line options).
  *
- * This library performs no string copying or memory allocation, do not free()
+ * Parsing performs no string copying or memory allocation, do not free()
  * any of the data collected by this library, the `const char *' values refer
  * directly to the strings provided by the execution environment (from argv).
+ * The one exception is the help screen of a compiled spec, the layout of which
+ * is cached in memory allocated when it's first shown.  Also note that stdio
+ * may allocate its buffers once help or error messages are printed.
+ *
+ * Memory is otherwise allocated only by dooshki_args_compile, by
+ * dooshki_args_print_completion, without DOOSHKI_ARGS_POSIX by
+ * dooshki_args_image_map and, with DOOSHKI_ARGS_AUTO_INDEX, by the first
+ * parse of each option table.  Building the library with DOOSHKI_ARGS_NO_HEAP
+ * leaves all of these out, so that it doesn't reference malloc at all.
+ * Specs can still be compiled into storage provided by the program, see
+ * dooshki_args_compile_into.
  */
 
 #ifndef DOOSHKI_ARGS_H
@@ -116,6 +128,144 @@ struct dooshki_opt
     void *callback_data;
 };
 
+/*
+ * Adaptive option lookup order.
+ *
+ * Both arrays have one element per entry of opt_desc (not counting the final
+ * all NULL one).  `order' is a permutation of the opt_desc indices in which
+ * options are looked up, and `hits' counts how many times each option was
+ * found, indexed by its opt_desc index.
+ *
+ * Whenever an option is found, its count is incremented and it is moved
+ * ahead of all options which were found less often, so that the most used
+ * options are checked first.  The arrays can be initialized with
+ * dooshki_args_order_reset, or filled with a previously saved state.
+ */
+struct dooshki_lookup_order
+{
+    unsigned int  *order;
+    unsigned long *hits;
+};
+
+/*
+ * Spec image, see dooshki_args_image_open.
+ *
+ * Refers to the data of an image created by dooshki_args_export.
+ * The fields are considered private to the library.
+ */
+struct dooshki_args_image
+{
+    const unsigned char *data;
+    unsigned long size;
+    unsigned int  opt_count;
+    unsigned long slot_count;
+
+    const unsigned char *entries;
+    const char *strings;
+
+    /* Memory to be released by dooshki_args_image_unmap, if any */
+    void *mapping;
+};
+
+/* Special values of the opt_index field of struct dooshki_trace_event. */
+#define DOOSHKI_TRACE_POSITIONAL  (-1)  /* not an option                  */
+#define DOOSHKI_TRACE_HELP        (-2)  /* the built-in help option       */
+#define DOOSHKI_TRACE_VERSION     (-3)  /* the built-in version option    */
+
+/* Entry of a parse trace, see the `trace_hook' field of dooshki_args. */
+struct dooshki_trace_event
+{
+    int opt_index;          /* index within opt_desc, or DOOSHKI_TRACE_*     */
+    int argv_index;         /* position of the word within the original argv */
+    const char *argument;   /* option argument or positional, may be NULL    */
+};
+
+struct dooshki_args;
+
+/* Shells supported by dooshki_args_print_completion. */
+enum dooshki_shell
+{
+    DOOSHKI_SHELL_BASH,
+    DOOSHKI_SHELL_ZSH,
+    DOOSHKI_SHELL_FISH
+};
+
+/*
+ * Messages of the library, see the `messages' field of dooshki_args.
+ *
+ * Translations have to keep the conversion specifications of the English
+ * messages (listed in dooshki_args.c) in the same order.
+ */
+enum dooshki_msg_id
+{
+    DOOSHKI_MSG_HELP_DESC,          /* Display this help screen and quit.   */
+    DOOSHKI_MSG_VER_DESC,           /* Display the program's version and... */
+    DOOSHKI_MSG_USAGE,              /* Usage:                               */
+    DOOSHKI_MSG_SEE_HELP,           /* See `%s --%s' for more details.      */
+    DOOSHKI_MSG_OPTIONS,            /* Options:                             */
+    DOOSHKI_MSG_BAD_ARGUMENT,       /* Argument `%s' passed to option %s... */
+    DOOSHKI_MSG_BAD_ENTRY,          /* Entry %d of %s, `%s', %s.            */
+    DOOSHKI_MSG_TOO_LARGE,          /* is too large                         */
+    DOOSHKI_MSG_TOO_SMALL,          /* is too small                         */
+    DOOSHKI_MSG_UNDERFLOW,          /* would cause an underflow             */
+    DOOSHKI_MSG_NOT_INT,            /* is not a valid integer               */
+    DOOSHKI_MSG_NOT_UINT,           /* is not a valid unsigned integer      */
+    DOOSHKI_MSG_NOT_FLOAT,          /* is not a valid floating point number */
+    DOOSHKI_MSG_NOT_REGULAR,        /* `%s' is not a regular file.          */
+    DOOSHKI_MSG_ACCESS_ERROR,       /* Cannot access `%s': %s.              */
+    DOOSHKI_MSG_NO_ACCESS,          /* Cannot access `%s'.                  */
+    DOOSHKI_MSG_UNRECOGNIZED,       /* Unrecognized option %s               */
+    DOOSHKI_MSG_UNRECOGNIZED_SHORT, /* Unrecognized option -%c              */
+    DOOSHKI_MSG_UNEXPECTED_ARG,     /* Argument `%s' not expected for op... */
+    DOOSHKI_MSG_MISSING_ARG_LONG,   /* Missing argument for option --%s     */
+    DOOSHKI_MSG_MISSING_ARG_SHORT,  /* Missing argument for option -%s      */
+
+    DOOSHKI_MSG_COUNT
+};
+
+/* Translated message catalog, see dooshki_args_find_catalog. */
+struct dooshki_catalog
+{
+    const char *locale;             /* such as "sk" or "pt_BR" */
+    const char *const *messages;    /* see enum dooshki_msg_id */
+};
+
+/* Output streams, numbered like file descriptors, see dooshki_args_write. */
+enum dooshki_stream
+{
+    DOOSHKI_STREAM_OUT = 1,     /* help, version and completion output */
+    DOOSHKI_STREAM_ERR = 2      /* error messages                      */
+};
+
+/* Phases of parsing, see struct dooshki_args_stats. */
+enum dooshki_args_phase
+{
+    DOOSHKI_PHASE_CLASSIFICATION,   /* splitting words into options      */
+    DOOSHKI_PHASE_LOOKUP,           /* finding options by name           */
+    DOOSHKI_PHASE_CONVERSION,       /* processing option arguments       */
+    DOOSHKI_PHASE_CALLBACKS,        /* user-defined option routines      */
+    DOOSHKI_PHASE_COMPACTION,       /* removing processed words from argv */
+    DOOSHKI_PHASE_HELP,             /* help, version and usage screens   */
+
+    DOOSHKI_PHASE_COUNT
+};
+
+/*
+ * Parsing statistics.
+ *
+ * Filled in by dooshki_args_parse when the library is built with
+ * DOOSHKI_ARGS_STATS, otherwise no statistics are collected.
+ */
+struct dooshki_args_stats
+{
+    unsigned long options_matched;  /* options found in opt_desc          */
+    unsigned long lookups;          /* option lookups, including failed   */
+    unsigned long bytes_scanned;    /* bytes of option names looked up    */
+    unsigned long callbacks;        /* user-defined routines invoked      */
+
+    unsigned long phase_ns[DOOSHKI_PHASE_COUNT];   /* time spent, in ns  */
+};
+
 struct dooshki_args
 {
     const char *program_name;   /* name of the executable */
@@ -125,6 +275,105 @@ struct dooshki_args
     const char *description;    /* long description of the program */
 
     const struct dooshki_opt *opt_desc; /* array, last member is all NULL */
+
+    /*
+     * Optional, set to a non-NULL value to have the option lookup order
+     * adapt to the options which are actually used.  The state is updated
+     * by each call to dooshki_args_parse, which thus must not be called
+     * concurrently with the same state.
+     */
+    struct dooshki_lookup_order *lookup_order;
+
+    /*
+     * Optional, if non-NULL, trace_hook receives an event for each option
+     * and positional argument found on the command line, with trace_data
+     * passed through.  The events are passed in batches, in the order
+     * in which they were encountered, all of them before dooshki_args_parse
+     * returns.  This can be used to audit or profile which options are
+     * used, see also dooshki_args_trace_write.
+     */
+    void (*trace_hook)(const struct dooshki_args *args_ctxt,
+                       const struct dooshki_trace_event *events,
+                       unsigned int event_count,
+                       void *trace_data);
+    void *trace_data;
+
+    /*
+     * Optional, if non-NULL and the library is built with DOOSHKI_ARGS_STATS,
+     * each call to dooshki_args_parse resets the referred to structure and
+     * fills it with statistics about the run.
+     */
+    struct dooshki_args_stats *stats;
+
+    /*
+     * Optional, if non-NULL, a message catalog with DOOSHKI_MSG_COUNT entries
+     * indexed by enum dooshki_msg_id, used in place of the built-in English
+     * messages for help screens and error reports.  NULL entries fall back
+     * to English.  See also dooshki_args_find_catalog.
+     */
+    const char *const *messages;
+};
+
+/* Checks performed by dooshki_args_check_files, can be combined. */
+enum dooshki_file_check
+{
+    DOOSHKI_FILE_EXISTS   = 0,  /* the entry exists                   */
+    DOOSHKI_FILE_READABLE = 1,  /* the entry can be opened for reading */
+    DOOSHKI_FILE_REGULAR  = 2   /* the entry is a regular file         */
+};
+
+/* Per-entry result of dooshki_args_check_files. */
+enum dooshki_file_status
+{
+    DOOSHKI_FILE_OK,
+    DOOSHKI_FILE_MISSING,
+    DOOSHKI_FILE_UNREADABLE,
+    DOOSHKI_FILE_NOT_REGULAR
+};
+
+/* Longest long option name supported by a compiled spec. */
+#define DOOSHKI_ARGS_MAX_NAME_LEN 65535
+
+/*
+ * Compiled option specification.
+ *
+ * A lookup index for the options of a dooshki_args structure, created by
+ * dooshki_args_compile.  The data needed to look up an option is kept
+ * in packed arrays separate from the option descriptors, so that scanning
+ * through the options doesn't pull their descriptions and callbacks into
+ * the cache.  The fields are considered private to the library.
+ *
+ * The arrays are kept in a single block of storage, starting with name_hash,
+ * either allocated by dooshki_args_compile or provided to
+ * dooshki_args_compile_into.
+ */
+struct dooshki_help_cache;
+
+struct dooshki_args_spec
+{
+    const struct dooshki_args *args_ctxt;
+    unsigned int opt_count;
+
+    /* Per option, in the order of opt_desc, 0 for options with no long name */
+    unsigned long  *name_hash;
+    unsigned short *name_len;
+
+    /* opt_desc index + 1 for each short option character, 0 if unused */
+    unsigned int short_index[256];
+
+    /* opt_desc indices of the options with a long name, sorted by the name */
+    unsigned int *long_order;
+    unsigned int  long_count;
+
+    /* Hash table of opt_desc index + 1 for each long name, 0 if unused */
+    unsigned int *name_slots;
+    unsigned int  slot_count;
+
+    /*
+     * Help screen layout, computed when the help screen is first shown,
+     * NULL for specs compiled by dooshki_args_compile_into
+     */
+    struct dooshki_help_cache *help_cache;
 };
 
 enum dooshki_args_ret
@@ -132,7 +381,8 @@ enum dooshki_args_ret
     DOOSHKI_ARGS_PARSE_OK,
     DOOSHKI_ARGS_HELP_SHOWN,
     DOOSHKI_ARGS_VER_SHOWN,
-    DOOSHKI_ARGS_PARSE_ERROR
+    DOOSHKI_ARGS_PARSE_ERROR,
+    DOOSHKI_ARGS_COMPLETION_SHOWN
 };
 
 /*
@@ -151,7 +401,9 @@ enum dooshki_args_ret
  * option 'a', -abcd are the short options 'a', 'b', 'c' and 'd'.
  *
  * A long option is recognized as a string beginning with a double dash,
- * eg. --help is an example of a long option.
+ * eg. --help is an example of a long option.  Long options may be abbreviated,
+ * if the name doesn't match any option exactly, the first option whose name
+ * begins with it is used.
  *
  * Both types of options may be configured to require an argument.  In the
  * case of short options, an argument has to be specified right after the
@@ -166,10 +418,156 @@ enum dooshki_args_ret
  * Arguments specified after the stopper will not be touched by the option
  * parsing code.  The stopper itself will be removed from the list of arguments
  * upon parsing completion, just like any other option.
+ *
+ * When the library is built with DOOSHKI_ARGS_AUTO_INDEX, the options are
+ * looked up through an index compiled the first time the opt_desc array is
+ * seen, unless an adaptive lookup order is used, see
+ * dooshki_args_auto_index_free.
  */
 enum dooshki_args_ret dooshki_args_parse(int *argc, char ***argv,
                                          const struct dooshki_args *args_ctxt);
 
+/*
+ * Release the indexes compiled by dooshki_args_parse.
+ *
+ *
+ * With DOOSHKI_ARGS_AUTO_INDEX, dooshki_args_parse keeps an index for each
+ * opt_desc array it's given, identified by its address, so the options have
+ * to stay unchanged once parsed.  Call this routine before changing them or
+ * reusing their memory for other options, or to release the memory before
+ * exiting.  It must not be called while other threads are parsing.
+ *
+ * Does nothing when the library is built without DOOSHKI_ARGS_AUTO_INDEX.
+ */
+void dooshki_args_auto_index_free(void);
+
+/*
+ * Compile an option specification.
+ *
+ *
+ * Builds a lookup index for the options described by args_ctxt, to be used
+ * with dooshki_args_parse_spec, which is worthwhile for programs with many
+ * options or which parse many command lines.  The args_ctxt structure and
+ * its options have to stay unchanged while the spec is in use.
+ *
+ * Threads may parse with a shared spec at the same time, but the help screen
+ * layout cached in it is only guarded when the library is built with
+ * DOOSHKI_ARGS_THREADS, without it, threads which may show help must not
+ * share a spec.
+ *
+ * Unlike the rest of the library, this routine allocates memory, release
+ * the spec by passing it to dooshki_args_spec_free.
+ *
+ * Returns NULL if memory allocation fails or the options can't be compiled.
+ *
+ * Not available when the library is built with DOOSHKI_ARGS_NO_HEAP.
+ */
+struct dooshki_args_spec *dooshki_args_compile(
+                                    const struct dooshki_args *args_ctxt);
+
+/* Release a spec created by dooshki_args_compile. */
+void dooshki_args_spec_free(struct dooshki_args_spec *spec);
+
+/*
+ * Storage needed by a compiled spec.
+ *
+ *
+ * DOOSHKI_ARGS_SPEC_STORAGE is the number of unsigned longs which suffice
+ * for the arrays of a spec of `opt_count' options (not counting the final
+ * all NULL one): the long name hashes, lengths and sorted index, and the
+ * long name hash table.  It's a constant expression when `opt_count' is,
+ * so that it can size static arrays.  The short option table is part
+ * of struct dooshki_args_spec itself.
+ *
+ * dooshki_args_spec_storage returns the exact number needed, as the hash
+ * table is often smaller than the macro allows for.
+ */
+#define DOOSHKI_ARGS_STORAGE_WORDS_(bytes) \
+    (((bytes) + sizeof(unsigned long) - 1) / sizeof(unsigned long))
+
+#define DOOSHKI_ARGS_SPEC_STORAGE(opt_count) \
+    (DOOSHKI_ARGS_STORAGE_WORDS_((opt_count) * sizeof(unsigned long)) + \
+     DOOSHKI_ARGS_STORAGE_WORDS_((opt_count) * sizeof(unsigned int)) + \
+     DOOSHKI_ARGS_STORAGE_WORDS_((4 * (opt_count) + 2) * \
+                                 sizeof(unsigned int)) + \
+     DOOSHKI_ARGS_STORAGE_WORDS_((opt_count) * sizeof(unsigned short)))
+
+unsigned long dooshki_args_spec_storage(unsigned int opt_count);
+
+/*
+ * Compile an option specification into the program's storage.
+ *
+ *
+ * Works like dooshki_args_compile, filling in `spec' and using the
+ * `storage_size' unsigned longs at `storage' for its arrays, without
+ * allocating any memory, so that it's available with DOOSHKI_ARGS_NO_HEAP.
+ * Both have to stay in place while the spec is in use, and the spec must
+ * not be passed to dooshki_args_spec_free.  Such a spec lays the help screen
+ * out each time it's shown, rather than caching the layout.
+ *
+ * Returns 1 on success, 0 if the storage is too small or the options can't
+ * be compiled.
+ *
+ * For example, for an option table `options' declared as an array:
+ *
+ *     #define OPT_COUNT (sizeof(options) / sizeof(options[0]) - 1)
+ *
+ *     static struct dooshki_args_spec spec;
+ *     static unsigned long storage[DOOSHKI_ARGS_SPEC_STORAGE(OPT_COUNT)];
+ *
+ *     dooshki_args_compile_into(&spec, &args_ctxt, storage,
+ *                               sizeof(storage) / sizeof(storage[0]));
+ */
+char dooshki_args_compile_into(struct dooshki_args_spec *spec,
+                               const struct dooshki_args *args_ctxt,
+                               unsigned long *storage,
+                               unsigned long storage_size);
+
+/*
+ * Process command-line arguments using a compiled spec.
+ *
+ *
+ * Works just like dooshki_args_parse, using the spec's lookup index.
+ * The adaptive lookup order of the spec's dooshki_args structure, if any,
+ * is not used.
+ *
+ * In addition, this routine answers completion queries, which allows shell
+ * completion functions to ask the program itself for candidates.  When
+ * the first argument is the hidden option --complete, the next one has to be
+ * the index of the word being completed, followed by the words of the command
+ * line being completed, without the program name:
+ *
+ *     program --complete 1 --quality G
+ *
+ * The candidates for the word are printed onto stdout, one per line, and
+ * DOOSHKI_ARGS_COMPLETION_SHOWN is returned without processing any options,
+ * the program should exit right away.  Option names, abbreviated long names
+ * of options taking an argument and arguments listing choices separated by
+ * `|' (such as "GOOD|BAD|UGLY") are completed.  An argument attached with `='
+ * is completed as the whole word, e.g. `--quality=GOOD'.
+ */
+enum dooshki_args_ret dooshki_args_parse_spec(int *argc, char ***argv,
+                                        const struct dooshki_args_spec *spec);
+
+/*
+ * Find an option within a compiled spec.
+ *
+ *
+ * Looks up a long option name (without the dashes, `name_len' characters
+ * long, which doesn't have to be null-terminated) or a short option
+ * character, the same way dooshki_args_parse_spec does.  Returns the index
+ * of the option in opt_desc, or -1 if there's no match.
+ *
+ * If `matches' is non-NULL, it receives the number of options the long name
+ * matches, 1 for an exact match, otherwise the number of options whose name
+ * begins with it, which lets callers reject ambiguous abbreviations.
+ */
+int dooshki_args_spec_find_long(const struct dooshki_args_spec *spec,
+                                const char *name, unsigned int name_len,
+                                unsigned int *matches);
+int dooshki_args_spec_find_short(const struct dooshki_args_spec *spec,
+                                 char name);
+
 /*
  * Print program usage.
  *
@@ -184,4 +582,279 @@ enum dooshki_args_ret dooshki_args_parse(int *argc, char ***argv,
  */
 void dooshki_args_err_usage(const struct dooshki_args *args_ctxt);
 
+/*
+ * Reset the adaptive lookup order.
+ *
+ *
+ * Sets args_ctxt->lookup_order to the order of the opt_desc array, with all
+ * of the hit counts set to zero.
+ */
+void dooshki_args_order_reset(const struct dooshki_args *args_ctxt);
+
+/*
+ * Trace hook writing to a file.
+ *
+ *
+ * Set this routine as the trace_hook and a `FILE *' opened for writing
+ * as the trace_data of a dooshki_args structure to get a line with
+ * the index, short name and long name of each option from opt_desc found
+ * on the command line, with `-' in place of missing names.  The positional
+ * arguments and the built-in options aren't written.  The dooshki_args_pgo
+ * tool turns such traces into an option ordering for the program.
+ *
+ * Not available when the library is built with DOOSHKI_ARGS_NO_STDIO.
+ */
+void dooshki_args_trace_write(const struct dooshki_args *args_ctxt,
+                              const struct dooshki_trace_event *events,
+                              unsigned int event_count,
+                              void *trace_data);
+
+/*
+ * Convert a list of numbers.
+ *
+ *
+ * This routine is intended for processing long lists of numeric entries,
+ * such as the arguments left in argv after dooshki_args_parse returns.
+ *
+ * `type' has to be one of DOOSHKI_OPT_INT, DOOSHKI_OPT_UINT or
+ * DOOSHKI_OPT_FLOAT, and `values' has to be an array of `count' elements
+ * of the corresponding type.  `list_name' is used in error messages.
+ *
+ * Just like with options, all entries are examined and every invalid one
+ * is reported on stderr, in the order in which they appear in the list.
+ *
+ * When the library is built with DOOSHKI_ARGS_THREADS, long lists are split
+ * into chunks which are converted in parallel.  Shorter lists, as well as
+ * all lists in builds without thread support, are converted serially.
+ *
+ * Returns DOOSHKI_ARGS_PARSE_OK or DOOSHKI_ARGS_PARSE_ERROR.
+ */
+enum dooshki_args_ret dooshki_args_convert_list(
+                                    const struct dooshki_args *args_ctxt,
+                                    enum dooshki_opt_type type,
+                                    const char *list_name,
+                                    int count, char **entries, void *values);
+
+/*
+ * Check a list of file names.
+ *
+ *
+ * This routine is intended to be called after dooshki_args_parse, to verify
+ * that the entries left in argv refer to usable files before the program
+ * starts working with them.
+ *
+ * `checks' is a combination of the dooshki_file_check flags.  Every entry
+ * which fails the checks is reported on stderr, in the order in which they
+ * appear in the list.  If `statuses' is not NULL, it has to be an array of
+ * `count' elements, which receives the result of the check of each entry.
+ *
+ * On POSIX systems (DOOSHKI_ARGS_POSIX), the entries are examined with stat()
+ * and open().  Otherwise, the only available check is whether an entry can
+ * be opened for reading with fopen(), missing entries are then reported as
+ * DOOSHKI_FILE_UNREADABLE and DOOSHKI_FILE_REGULAR is ignored.
+ *
+ * When the library is built with DOOSHKI_ARGS_THREADS, long lists are
+ * checked in parallel, just like in dooshki_args_convert_list.
+ *
+ * Returns DOOSHKI_ARGS_PARSE_OK or DOOSHKI_ARGS_PARSE_ERROR.
+ */
+enum dooshki_args_ret dooshki_args_check_files(
+                                    const struct dooshki_args *args_ctxt,
+                                    unsigned int checks,
+                                    int count, char **entries,
+                                    enum dooshki_file_status *statuses);
+
+/*
+ * Dump the parsed options as JSON.
+ *
+ *
+ * Writes a JSON array with an object for each entry of opt_desc into
+ * `buffer', which can hold `size' characters, including the terminating
+ * null character.  Each object has the following members:
+ *
+ *   name    the long name of the option, or the short one if it has none
+ *   type    the option type, e.g. "int" for DOOSHKI_OPT_INT
+ *   value   the contents of opt_storage, null for callback options
+ *   found   the contents of opt_found, null if the option has none
+ *   source  "argv" if the option was found, "default" if it wasn't, and null
+ *           if the option has no opt_found
+ *
+ * Floating point values are written with as few digits as needed to convert
+ * back to the same value.  Like the rest of the library, this routine
+ * doesn't allocate memory.
+ *
+ * Returns the length of the whole dump, not counting the terminating null
+ * character.  Just like with snprintf, if the return value is not less than
+ * `size', the output was truncated.  A compiled spec's options can be dumped
+ * by passing its args_ctxt.
+ */
+unsigned long dooshki_args_dump_json(const struct dooshki_args *args_ctxt,
+                                     char *buffer, unsigned long size);
+
+/*
+ * Export a compiled spec.
+ *
+ *
+ * Writes a binary image of the options of a compiled spec (names, types,
+ * argument templates and descriptions) along with its lookup index into
+ * `buffer', which can hold `size' bytes.  The image has the same layout
+ * on every machine, and can be used directly as an option lookup index,
+ * either by the program itself, see dooshki_args_parse_image, or by tools
+ * which don't have the C option table, see dooshki_args_image_open.
+ *
+ * Returns the size of the image.  If it's larger than `size', nothing is
+ * written, so the routine can be called with a NULL buffer to find out how
+ * large it has to be.
+ */
+unsigned long dooshki_args_export(const struct dooshki_args_spec *spec,
+                                  unsigned char *buffer, unsigned long size);
+
+/*
+ * Use a spec image held in memory.
+ *
+ *
+ * Checks that the `size' bytes at `data' hold a valid image created by
+ * dooshki_args_export, and sets up `image' to refer to it.  No copies are
+ * made, the data has to stay in place while the image is in use.
+ *
+ * Returns 1 on success, 0 if the data is not a valid image.
+ */
+char dooshki_args_image_open(struct dooshki_args_image *image,
+                             const void *data, unsigned long size);
+
+/*
+ * Use a spec image stored in a file.
+ *
+ *
+ * On POSIX systems (DOOSHKI_ARGS_POSIX), the file is mapped into memory,
+ * so that only the parts of it which are used get loaded.  Otherwise, it is
+ * read into allocated memory, which builds with DOOSHKI_ARGS_NO_STDIO or
+ * DOOSHKI_ARGS_NO_HEAP can't do, the routine always fails in them.  Release
+ * the image with dooshki_args_image_unmap.
+ *
+ * Returns 1 on success, 0 if the file can't be read or is not a valid image.
+ */
+char dooshki_args_image_map(struct dooshki_args_image *image,
+                            const char *path);
+
+/* Release an image opened by dooshki_args_image_map. */
+void dooshki_args_image_unmap(struct dooshki_args_image *image);
+
+/*
+ * Find an option within a spec image.
+ *
+ *
+ * Looks up a long option name (without the dashes, `name_len' characters
+ * long, which doesn't have to be null-terminated) or a short option
+ * character, the same way dooshki_args_parse does, including abbreviated
+ * long names.  Returns the index of the option, or -1 if there's no match.
+ */
+int dooshki_args_image_find_long(const struct dooshki_args_image *image,
+                                 const char *name, unsigned int name_len);
+int dooshki_args_image_find_short(const struct dooshki_args_image *image,
+                                  char name);
+
+/*
+ * Describe an option from a spec image.
+ *
+ *
+ * Fills in `option' with the names, argument template, type and description
+ * of the option with the given index, the strings refer to the image.
+ * The storage and callback fields are set to NULL.
+ */
+void dooshki_args_image_option(const struct dooshki_args_image *image,
+                               unsigned int index,
+                               struct dooshki_opt *option);
+
+/*
+ * Process command-line arguments using a spec image as the lookup index.
+ *
+ *
+ * Works just like dooshki_args_parse, except that the options are looked up
+ * through the image, so that a program with a large option table doesn't
+ * have to compile a spec on every start.  The storage and callbacks of
+ * the options are taken from `args_ctxt', whose option table has to be
+ * the one the exported spec was compiled from, the image only holds their
+ * indexes.  The adaptive lookup order of `args_ctxt', if any, is not used,
+ * and neither are completion queries answered.
+ *
+ * The image is checked against the option table first, see
+ * dooshki_args_image_check, and if it doesn't match, nothing is parsed or
+ * printed and DOOSHKI_ARGS_PARSE_ERROR is returned.
+ */
+/*
+ * Check that a spec image matches an option table.
+ *
+ *
+ * Returns 1 if the image has as many options as args_ctxt->opt_desc, with
+ * the same names and types, in the same order, as an image exported from
+ * a spec compiled from it does, 0 if not.  A program can use this to fall
+ * back to dooshki_args_parse when its image file is stale.
+ */
+char dooshki_args_image_check(const struct dooshki_args_image *image,
+                              const struct dooshki_args *args_ctxt);
+
+enum dooshki_args_ret dooshki_args_parse_image(
+                                    int *argc, char ***argv,
+                                    const struct dooshki_args *args_ctxt,
+                                    const struct dooshki_args_image *image);
+
+/*
+ * Print a shell completion script.
+ *
+ *
+ * Prints a script for the given shell onto stdout, which completes the names
+ * of the options, and the arguments of options whose argument template lists
+ * the allowed choices separated by `|', such as "GOOD|BAD|UGLY".  All of the
+ * data is embedded in the script, so completion doesn't have to run
+ * the program.
+ *
+ * The bash script looks up option names by a binary search through a sorted
+ * table, the zsh script passes a sorted table to compadd, and the fish script
+ * declares each option with the `complete' builtin.  The arguments of other
+ * options are completed as file names.
+ *
+ * Unlike the rest of the library, this routine allocates memory, it returns
+ * 1 on success and 0 if memory allocation fails.
+ *
+ * Not available when the library is built with DOOSHKI_ARGS_NO_HEAP.
+ */
+char dooshki_args_print_completion(const struct dooshki_args *args_ctxt,
+                                   enum dooshki_shell shell);
+
+/*
+ * Select a message catalog.
+ *
+ *
+ * Looks up the catalog for the given locale name within `catalogs', an array
+ * terminated by an entry with a NULL locale.  If `locale' is NULL, it is taken
+ * from the LC_ALL, LC_MESSAGES or LANG environment variable, the first one
+ * which is set.  A catalog for the whole locale ("pt_BR") is preferred over
+ * one for just its language ("pt"), the codeset and modifier are ignored.
+ *
+ * Returns the messages of the matching catalog, to be used as the `messages'
+ * field of dooshki_args, or NULL if there's none, selecting English.
+ */
+const char *const *dooshki_args_find_catalog(
+                                    const struct dooshki_catalog *catalogs,
+                                    const char *locale);
+
+/*
+ * Write hook of stdio-less builds.
+ *
+ *
+ * When the library is built with DOOSHKI_ARGS_NO_STDIO, it doesn't use stdio
+ * at all, and the program has to provide this routine, which is called with
+ * every piece of text the library outputs, `len' bytes at `data' (which are
+ * not NUL-terminated), to be written to the given stream.
+ *
+ * The text comes in small pieces, down to single characters, so the routine
+ * should buffer it if writing is expensive.
+ *
+ * Builds with DOOSHKI_ARGS_SIGSAFE provide this routine themselves, writing
+ * to file descriptors 1 and 2 with write(2).
+ */
+void dooshki_args_write(enum dooshki_stream stream,
+                        const char *data, unsigned long len);
+
 #endif /* DOOSHKI_ARGS_H */
@@ -0,0 +1,359 @@
+/*
+ * Copyright (c) 2020 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "dooshki_args.h"
+
+#define PROG_NAME    "dooshki_args_bench"
+#define PROG_VERSION "0.1"
+#define PROG_USAGE   "[OPTIONS]"
+#define PROG_SUMMARY "Benchmark of the dooshki_args library"
+
+#define PROG_DESCRIPTION \
+                         \
+"This program generates a synthetic option table and a set of command lines\n" \
+"using it, and measures how long it takes to parse them with the plain\n" \
+"option table (linear lookup) and with a compiled spec.\n"
+
+/* Short option names available to the generated options. */
+#define SHORT_NAMES "abcdefgijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUWXYZ"
+
+#define MAX_NAME_LEN 32
+
+
+static const char *program_name = PROG_NAME;
+
+/* Values retrieved from the command line. */
+static unsigned long opt_count = 2000;
+static unsigned long word_count = 32;
+static unsigned long rounds = 10000;
+static unsigned long seed = 1;
+static char show_stats = 0;
+
+static const struct dooshki_opt cli_options[] =
+{
+    { "n", "options", "COUNT", DOOSHKI_OPT_UINT, &opt_count, NULL,
+      "Number of options in the generated table (default: 2000).",
+      NULL, NULL },
+
+    { "w", "words", "COUNT", DOOSHKI_OPT_UINT, &word_count, NULL,
+      "Number of words on each generated command line (default: 32).",
+      NULL, NULL },
+
+    { "r", "rounds", "COUNT", DOOSHKI_OPT_UINT, &rounds, NULL,
+      "Number of times each command line is parsed (default: 10000).",
+      NULL, NULL },
+
+    { "s", "seed", "SEED", DOOSHKI_OPT_UINT, &seed, NULL,
+      "Seed of the random number generator (default: 1).", NULL, NULL },
+
+    { "S", "stats", NULL, DOOSHKI_OPT_BOOL, &show_stats, NULL,
+      "Show a breakdown of a single parse, requires the library to be built "
+      "with DOOSHKI_ARGS_STATS.", NULL, NULL },
+
+    { NULL }
+};
+
+static struct dooshki_args cli_args_context =
+{
+    PROG_NAME,
+    PROG_VERSION,
+    PROG_USAGE,
+    PROG_SUMMARY,
+    PROG_DESCRIPTION,
+
+    cli_options,
+
+    NULL,
+    NULL, NULL,
+    NULL,
+    NULL
+};
+
+
+/* Storage of the generated options. */
+static char *bool_values;
+static long *int_values;
+
+/* Allocate memory, terminating the program on failure. */
+static void *xmalloc(size_t size)
+{
+    void *ptr = malloc((size > 0)? size : 1);
+
+    if (ptr == NULL)
+    {
+        fprintf(stderr, "%s: Out of memory.\n", program_name);
+        exit(1);
+    }
+    return ptr;
+}
+
+/*
+ * Generate an option table with `count' options.
+ *
+ * Every fourth option takes an integer argument, the rest are booleans.
+ * The first options also get a short name, for as long as they last.
+ */
+static struct dooshki_opt *generate_options(unsigned long count)
+{
+    struct dooshki_opt *options = xmalloc((count + 1) * sizeof(*options));
+    char *short_names = xmalloc(sizeof(SHORT_NAMES) * 2);
+    char *long_names  = xmalloc(count * MAX_NAME_LEN);
+    unsigned long iter;
+
+    bool_values = xmalloc(count);
+    int_values  = xmalloc(count * sizeof(long));
+
+    for (iter = 0; iter < count; iter++)
+    {
+        struct dooshki_opt *option = &options[iter];
+
+        if (iter < sizeof(SHORT_NAMES) - 1)
+        {
+            short_names[iter * 2]     = SHORT_NAMES[iter];
+            short_names[iter * 2 + 1] = '\0';
+            option->short_name = &short_names[iter * 2];
+        }
+        else
+            option->short_name = NULL;
+
+        sprintf(&long_names[iter * MAX_NAME_LEN], "option-%lu", iter);
+        option->long_name = &long_names[iter * MAX_NAME_LEN];
+
+        if (iter % 4 == 0)
+        {
+            option->argument_template = "N";
+            option->type              = DOOSHKI_OPT_INT;
+            option->opt_storage       = &int_values[iter];
+        }
+        else
+        {
+            option->argument_template = NULL;
+            option->type              = DOOSHKI_OPT_BOOL;
+            option->opt_storage       = &bool_values[iter];
+        }
+        option->opt_found     = NULL;
+        option->description   = "Generated option.";
+        option->callback      = NULL;
+        option->callback_data = NULL;
+    }
+    memset(&options[count], 0, sizeof(*options));
+
+    return options;
+}
+
+/*
+ * Generate a command line of about `count' words using the given options.
+ *
+ * Long and short options alternate randomly, option arguments are passed
+ * both within the same word and as a separate word.
+ */
+static char **generate_argv(const struct dooshki_opt *options,
+                            unsigned long opt_total,
+                            unsigned long count, int *argc)
+{
+    char **argv = xmalloc((count + 2) * sizeof(*argv));
+    int word_iter = 1;
+
+    argv[0] = PROG_NAME;
+
+    while ((unsigned long)word_iter < count + 1)
+    {
+        unsigned long index = (unsigned long)rand() % opt_total;
+        const struct dooshki_opt *option = &options[index];
+        char *word = xmalloc(MAX_NAME_LEN * 2);
+        char separate_arg = (rand() % 2 == 0);
+
+        if (option->short_name != NULL && rand() % 2 == 0)
+            sprintf(word, "-%s", option->short_name);
+        else
+            sprintf(word, "--%s", option->long_name);
+
+        if (option->type == DOOSHKI_OPT_INT)
+        {
+            if (separate_arg && (unsigned long)word_iter < count)
+            {
+                argv[word_iter++] = word;
+                word = xmalloc(MAX_NAME_LEN);
+                sprintf(word, "%d", rand());
+            }
+            else
+                sprintf(word + strlen(word), "=%d", rand());
+        }
+        argv[word_iter++] = word;
+    }
+    argv[word_iter] = NULL;
+
+    *argc = word_iter;
+    return argv;
+}
+
+/* Parse a command line repeatedly, returns the time taken in seconds. */
+static double time_parsing(const struct dooshki_args *args_ctxt,
+                           const struct dooshki_args_spec *spec,
+                           int argc, char **argv)
+{
+    char **work_argv = xmalloc((argc + 1) * sizeof(*work_argv));
+    clock_t start;
+    clock_t end;
+    unsigned long iter;
+
+    start = clock();
+    for (iter = 0; iter < rounds; iter++)
+    {
+        int work_argc = argc;
+        char **parse_argv = work_argv;
+        enum dooshki_args_ret ret;
+
+        memcpy(work_argv, argv, (argc + 1) * sizeof(*work_argv));
+
+        if (spec != NULL)
+            ret = dooshki_args_parse_spec(&work_argc, &parse_argv, spec);
+        else
+            ret = dooshki_args_parse(&work_argc, &parse_argv, args_ctxt);
+
+        if (ret != DOOSHKI_ARGS_PARSE_OK)
+        {
+            fprintf(stderr, "%s: Failed to parse a generated command line.\n",
+                    program_name);
+            exit(1);
+        }
+    }
+    end = clock();
+
+    free(work_argv);
+    return (double)(end - start) / CLOCKS_PER_SEC;
+}
+
+/* Parse a command line once, and print the collected statistics. */
+static void print_stats(const char *layout,
+                        struct dooshki_args *args_ctxt,
+                        const struct dooshki_args_spec *spec,
+                        int argc, char **argv)
+{
+    static const char *phase_names[DOOSHKI_PHASE_COUNT] =
+    {
+        "classification",
+        "lookup",
+        "conversion",
+        "callbacks",
+        "compaction",
+        "help"
+    };
+    struct dooshki_args_stats stats;
+    char **work_argv = xmalloc((argc + 1) * sizeof(*work_argv));
+    unsigned int iter;
+
+    memcpy(work_argv, argv, (argc + 1) * sizeof(*work_argv));
+    memset(&stats, 0, sizeof(stats));
+    args_ctxt->stats = &stats;
+
+    if (spec != NULL)
+        dooshki_args_parse_spec(&argc, &work_argv, spec);
+    else
+        dooshki_args_parse(&argc, &work_argv, args_ctxt);
+
+    args_ctxt->stats = NULL;
+    free(work_argv);
+
+    printf("\n%s: %lu options matched, %lu lookups, %lu bytes scanned, "
+           "%lu callbacks\n", layout, stats.options_matched, stats.lookups,
+           stats.bytes_scanned, stats.callbacks);
+
+    for (iter = 0; iter < DOOSHKI_PHASE_COUNT; iter++)
+        printf("    %-16s %10lu ns\n", phase_names[iter], stats.phase_ns[iter]);
+}
+
+/* Print a result line. */
+static void print_result(const char *layout, double seconds)
+{
+    printf("%-12s %14.1f %14.1f\n", layout,
+           seconds * 1e9 / rounds,
+           seconds * 1e9 / rounds / word_count);
+}
+
+int main(int argc, char **argv)
+{
+    enum dooshki_args_ret arg_parse_ret;
+    struct dooshki_args bench_args;
+    struct dooshki_args_spec *spec;
+    struct dooshki_opt *options;
+    char **bench_argv;
+    int bench_argc;
+
+    arg_parse_ret = dooshki_args_parse(&argc, &argv, &cli_args_context);
+    switch(arg_parse_ret)
+    {
+        case DOOSHKI_ARGS_PARSE_OK:
+            break;
+
+        case DOOSHKI_ARGS_HELP_SHOWN:
+        case DOOSHKI_ARGS_VER_SHOWN:
+            return 0;
+
+        default:
+            return 1;
+    }
+    if (argc > 1)
+    {
+        fprintf(stderr, "%s: Unexpected argument `%s'.\n",
+                program_name, argv[1]);
+        dooshki_args_err_usage(&cli_args_context);
+        return 1;
+    }
+    if (opt_count == 0 || word_count == 0 || rounds == 0)
+    {
+        fprintf(stderr, "%s: The counts have to be non-zero.\n",
+                program_name);
+        dooshki_args_err_usage(&cli_args_context);
+        return 1;
+    }
+
+    srand((unsigned int)seed);
+    options = generate_options(opt_count);
+    bench_argv = generate_argv(options, opt_count, word_count, &bench_argc);
+
+    bench_args = cli_args_context;
+    bench_args.opt_desc = options;
+
+    spec = dooshki_args_compile(&bench_args);
+    if (spec == NULL)
+    {
+        fprintf(stderr, "%s: Failed to compile the option table.\n",
+                program_name);
+        return 1;
+    }
+
+    printf("options: %lu, words per command line: %lu, rounds: %lu\n\n",
+           opt_count, word_count, rounds);
+    printf("%-12s %14s %14s\n", "layout", "ns/parse", "ns/word");
+
+    print_result("linear",   time_parsing(&bench_args, NULL, bench_argc,
+                                          bench_argv));
+    print_result("compiled", time_parsing(&bench_args, spec, bench_argc,
+                                          bench_argv));
+
+    if (show_stats)
+    {
+        print_stats("linear", &bench_args, NULL, bench_argc, bench_argv);
+        print_stats("compiled", &bench_args, spec, bench_argc, bench_argv);
+    }
+
+    dooshki_args_spec_free(spec);
+    return 0;
+}
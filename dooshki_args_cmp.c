@@ -0,0 +1,1001 @@
+/*
+ * Copyright (c) 2020 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "dooshki_args.h"
+#include "dooshki_getopt.h"
+
+#define PROG_NAME    "dooshki_args_cmp"
+#define PROG_VERSION "0.1"
+#define PROG_USAGE   "[OPTIONS]"
+#define PROG_SUMMARY "Comparison of the dooshki_args library with getopt_long"
+
+#define PROG_DESCRIPTION \
+                         \
+"This program generates random option tables and command lines using them,\n" \
+"parses the command lines with both dooshki_args_parse and getopt_long and\n" \
+"compares the options and arguments they find.  Differences are grouped\n" \
+"by the feature of the command line which most likely causes them, and\n" \
+"the command lines both parsers accept are used to measure throughput.\n" \
+"\n" \
+"The getopt_long compatibility layer in dooshki_getopt.c is checked too,\n" \
+"its results have to match getopt_long exactly.\n"
+
+/*
+ * Short option names available to the generated options, the ones reserved
+ * by dooshki_args for help and version are left out.
+ */
+#define SHORT_NAMES "abcdefgijklmnopqrstuwxyzABCDEFGIJKLMNOPQRSTUWXYZ0123456789"
+
+/* Maximum number of options in a generated table. */
+#define MAX_OPTIONS  48
+
+/* Maximum length of a generated word. */
+#define MAX_WORD_LEN 64
+
+/*
+ * Words long option names are made of, none of them starts with the first
+ * letter of dooshki_args' built-in options, so that their abbreviations
+ * can't be mistaken for those.
+ */
+static const char *name_stems[] =
+{
+    "add", "all", "alpha", "base", "bit", "block", "data", "debug", "depth",
+    "dry", "file", "filter", "force", "group", "input", "item", "jobs", "keep",
+    "level", "limit", "list", "mode", "name", "no", "output", "path", "port",
+    "quiet", "rate", "size", "sort", "time", "user", "width", "zero"
+};
+#define STEM_COUNT (sizeof(name_stems) / sizeof(name_stems[0]))
+
+
+static const char *program_name = PROG_NAME;
+
+/* Values retrieved from the command line. */
+static unsigned long spec_count = 200;
+static unsigned long line_count = 200;
+static unsigned long word_count = 16;
+static unsigned long rounds = 20;
+static unsigned long seed = 1;
+static char verbose = 0;
+
+static const struct dooshki_opt cli_options[] =
+{
+    { "n", "specs", "COUNT", DOOSHKI_OPT_UINT, &spec_count, NULL,
+      "Number of generated option tables (default: 200).", NULL, NULL },
+
+    { "l", "lines", "COUNT", DOOSHKI_OPT_UINT, &line_count, NULL,
+      "Number of command lines generated for each table (default: 200).",
+      NULL, NULL },
+
+    { "w", "words", "COUNT", DOOSHKI_OPT_UINT, &word_count, NULL,
+      "Number of words on each generated command line (default: 16).",
+      NULL, NULL },
+
+    { "r", "rounds", "COUNT", DOOSHKI_OPT_UINT, &rounds, NULL,
+      "Number of times the accepted command lines are parsed for the "
+      "throughput measurement (default: 20).", NULL, NULL },
+
+    { "s", "seed", "SEED", DOOSHKI_OPT_UINT, &seed, NULL,
+      "Seed of the random number generator (default: 1).", NULL, NULL },
+
+    { "v", "verbose", NULL, DOOSHKI_OPT_BOOL, &verbose, NULL,
+      "Show every command line on which the parsers differ.", NULL, NULL },
+
+    { NULL }
+};
+
+static struct dooshki_args cli_args_context =
+{
+    PROG_NAME,
+    PROG_VERSION,
+    PROG_USAGE,
+    PROG_SUMMARY,
+    PROG_DESCRIPTION,
+
+    cli_options,
+
+    NULL,
+    NULL, NULL,
+    NULL,
+    NULL
+};
+
+
+/* An option or argument found by one of the parsers. */
+struct event
+{
+    int opt_index;
+    const char *argument;       /* NULL for options without arguments */
+};
+
+/* What a parser made of a command line. */
+struct outcome
+{
+    char accepted;
+
+    struct event events[MAX_WORD_LEN];
+    unsigned int event_count;
+
+    char **positional;
+    int positional_count;
+};
+
+/* Callback data of the generated options, they record the events. */
+struct recorder
+{
+    struct outcome **outcome;
+    int opt_index;
+};
+
+/* A generated option table, in the form used by both parsers. */
+struct table
+{
+    struct dooshki_opt options[MAX_OPTIONS + 1];
+    struct recorder recorders[MAX_OPTIONS];
+    char short_names[MAX_OPTIONS][2];
+    char long_names[MAX_OPTIONS][MAX_WORD_LEN];
+    unsigned int count;
+
+    struct option long_options[MAX_OPTIONS + 1];
+    struct dooshki_option shim_options[MAX_OPTIONS + 1];
+    char optstring[MAX_OPTIONS * 2 + 1];
+    int short_index[256];
+
+    /* State of dooshki_getopt_long_r, holding the index of the table. */
+    struct dooshki_getopt_state shim_state;
+
+    /* Where the callbacks of the options record their events. */
+    struct outcome *current;
+};
+
+/*
+ * Differences between the parsers, grouped by the feature of the command line
+ * which most likely causes them, in the order in which they are checked.
+ */
+enum feature
+{
+    FEATURE_LONE_DASH,
+    FEATURE_STOPPER_ARGUMENT,
+    FEATURE_AMBIGUOUS,
+    FEATURE_ABBREVIATION,
+    FEATURE_OTHER,
+
+    FEATURE_COUNT
+};
+
+static const char *feature_names[FEATURE_COUNT] =
+{
+    "lone dash (\"-\")",
+    "\"--\" as an option argument",
+    "ambiguous abbreviation",
+    "unique abbreviation",
+    "other"
+};
+
+/* Catalog of the differences found. */
+struct catalog
+{
+    unsigned long counts[FEATURE_COUNT];
+    char examples[FEATURE_COUNT][MAX_WORD_LEN * 16];
+};
+
+/* Allocate memory, terminating the program on failure. */
+static void *xmalloc(size_t size)
+{
+    void *ptr = malloc((size > 0)? size : 1);
+
+    if (ptr == NULL)
+    {
+        fprintf(stderr, "%s: Out of memory.\n", program_name);
+        exit(1);
+    }
+    return ptr;
+}
+
+/* Record an event of the generated options, see struct recorder. */
+static char record_event(const char *argument_text, void *opt_storage,
+                         const char *opt_prefix, const char *opt_name,
+                         void *callback_data)
+{
+    struct recorder *recorder = callback_data;
+    struct outcome *outcome = *recorder->outcome;
+
+    (void)opt_storage;
+    (void)opt_prefix;
+    (void)opt_name;
+
+    if (outcome->event_count < MAX_WORD_LEN)
+    {
+        outcome->events[outcome->event_count].opt_index = recorder->opt_index;
+        outcome->events[outcome->event_count].argument  = argument_text;
+        outcome->event_count++;
+    }
+    return 1;
+}
+
+/* Random number in the range from 0 to `limit' - 1. */
+static unsigned int random_below(unsigned int limit)
+{
+    return (unsigned int)rand() % limit;
+}
+
+/*
+ * Generate an option table.
+ *
+ * About half of the options take an argument, most of them have both a short
+ * and a long name, the rest just one of them.  Long names are made of common
+ * words, so that many of them share prefixes.
+ */
+static void generate_table(struct table *table)
+{
+    char used_shorts[256];
+    char *optstring = table->optstring;
+    unsigned int long_count = 0;
+    unsigned int iter;
+    unsigned int other;
+
+    memset(used_shorts, 0, sizeof(used_shorts));
+    memset(table->short_index, -1, sizeof(table->short_index));
+
+    table->count = 4 + random_below(MAX_OPTIONS - 4);
+    for (iter = 0; iter < table->count; iter++)
+    {
+        struct dooshki_opt *option = &table->options[iter];
+        unsigned int names = random_below(6);
+        char takes_arg = (char)random_below(2);
+        char *long_name = table->long_names[iter];
+
+        option->short_name = NULL;
+        option->long_name  = NULL;
+
+        if (names != 0)
+        {
+            char name = SHORT_NAMES[random_below(sizeof(SHORT_NAMES) - 1)];
+
+            if (! used_shorts[(unsigned char)name])
+            {
+                used_shorts[(unsigned char)name] = 1;
+                table->short_names[iter][0] = name;
+                table->short_names[iter][1] = '\0';
+                option->short_name = table->short_names[iter];
+
+                table->short_index[(unsigned char)name] = (int)iter;
+                *optstring++ = name;
+                if (takes_arg)
+                    *optstring++ = ':';
+            }
+        }
+        if (names != 1)
+        {
+            do
+            {
+                strcpy(long_name, name_stems[random_below(STEM_COUNT)]);
+                if (random_below(2))
+                {
+                    strcat(long_name, "-");
+                    strcat(long_name, name_stems[random_below(STEM_COUNT)]);
+                }
+                for (other = 0; other < iter; other++)
+                {
+                    if (table->options[other].long_name != NULL &&
+                        strcmp(table->options[other].long_name, long_name) == 0)
+                        break;
+                }
+            }
+            while (other < iter);
+            option->long_name = long_name;
+
+            table->long_options[long_count].name    = long_name;
+            table->long_options[long_count].has_arg =
+                takes_arg? required_argument : no_argument;
+            table->long_options[long_count].flag    = NULL;
+            table->long_options[long_count].val     = 256 + (int)iter;
+
+            table->shim_options[long_count].name    = long_name;
+            table->shim_options[long_count].has_arg =
+                takes_arg? dooshki_required_argument : dooshki_no_argument;
+            table->shim_options[long_count].flag    = NULL;
+            table->shim_options[long_count].val     = 256 + (int)iter;
+            long_count++;
+        }
+        if (option->short_name == NULL && option->long_name == NULL)
+        {
+            /* The short name was taken already, retry. */
+            iter--;
+            continue;
+        }
+
+        option->argument_template = takes_arg? "ARG" : NULL;
+        option->type          = takes_arg? DOOSHKI_OPT_CB : DOOSHKI_OPT_CB_NOARG;
+        option->opt_storage   = NULL;
+        option->opt_found     = NULL;
+        option->description   = "Generated option.";
+        option->callback      = record_event;
+        option->callback_data = &table->recorders[iter];
+
+        table->recorders[iter].outcome   = &table->current;
+        table->recorders[iter].opt_index = (int)iter;
+    }
+    memset(&table->options[table->count], 0, sizeof(table->options[0]));
+    memset(&table->long_options[long_count], 0,
+           sizeof(table->long_options[0]));
+    memset(&table->shim_options[long_count], 0,
+           sizeof(table->shim_options[0]));
+    *optstring = '\0';
+}
+
+/* Pick a prefix of a long name, returns its length. */
+static size_t pick_prefix(const char *long_name)
+{
+    size_t len = strlen(long_name);
+
+    return 1 + random_below((unsigned int)len);
+}
+
+/* Generate an argument of an option. */
+static void generate_argument(char *text)
+{
+    switch (random_below(8))
+    {
+        case 0:
+            text[0] = '\0';
+            break;
+
+        case 1:
+            sprintf(text, "-%u", random_below(100));
+            break;
+
+        default:
+            sprintf(text, "v%u", random_below(1000));
+            break;
+    }
+}
+
+/*
+ * Generate a command line of about `count' words using the options of
+ * a table.  Besides valid options and positional arguments, it contains
+ * the occasional unknown option, stopper or lone dash, and option names
+ * are sometimes abbreviated.
+ */
+static char **generate_argv(const struct table *table, unsigned long count,
+                            int *argc)
+{
+    char **argv = xmalloc((count + 2) * sizeof(*argv));
+    int word_iter = 1;
+
+    argv[0] = PROG_NAME;
+
+    while ((unsigned long)word_iter < count + 1)
+    {
+        const struct dooshki_opt *option =
+            &table->options[random_below(table->count)];
+        char *word = xmalloc(MAX_WORD_LEN * 2);
+        char takes_arg = (option->type == DOOSHKI_OPT_CB);
+        unsigned int kind = random_below(100);
+        char separate_arg = 0;
+
+        if (kind < 25)
+            sprintf(word, "p%u", random_below(1000));
+        else if (kind < 27)
+            strcpy(word, "--");
+        else if (kind < 29)
+            strcpy(word, "-");
+        else if (kind < 31)
+            strcpy(word, random_below(2)? "--xunknown" : "-h");
+        else if (option->short_name != NULL &&
+                 (option->long_name == NULL || random_below(2)))
+        {
+            sprintf(word, "-%s", option->short_name);
+            if (takes_arg)
+            {
+                if (random_below(2))
+                    generate_argument(word + strlen(word));
+                else
+                    separate_arg = 1;
+            }
+        }
+        else
+        {
+            size_t len = strlen(option->long_name);
+
+            if (random_below(5) == 0)
+                len = pick_prefix(option->long_name);
+
+            sprintf(word, "--%.*s", (int)len, option->long_name);
+            if (takes_arg)
+            {
+                if (random_below(2))
+                {
+                    strcat(word, "=");
+                    generate_argument(word + strlen(word));
+                }
+                else
+                    separate_arg = 1;
+            }
+        }
+        argv[word_iter++] = word;
+
+        if (separate_arg && (unsigned long)word_iter < count + 1)
+        {
+            word = xmalloc(MAX_WORD_LEN);
+            if (random_below(20) == 0)
+                strcpy(word, "--");
+            else
+                generate_argument(word);
+            argv[word_iter++] = word;
+        }
+    }
+    argv[word_iter] = NULL;
+
+    *argc = word_iter;
+    return argv;
+}
+
+/* Release a generated command line. */
+static void free_argv(int argc, char **argv)
+{
+    int iter;
+
+    for (iter = 1; iter < argc; iter++)
+        free(argv[iter]);
+    free(argv);
+}
+
+/* Parse a command line with dooshki_args, a spec may be NULL. */
+static void run_dooshki(struct table *table, const struct dooshki_args *ctxt,
+                        const struct dooshki_args_spec *spec,
+                        int argc, char **argv, char **work_argv,
+                        struct outcome *outcome)
+{
+    int work_argc = argc;
+    char **parse_argv = work_argv;
+    enum dooshki_args_ret ret;
+
+    memcpy(work_argv, argv, (argc + 1) * sizeof(*work_argv));
+    outcome->event_count = 0;
+    table->current = outcome;
+
+    if (spec != NULL)
+        ret = dooshki_args_parse_spec(&work_argc, &parse_argv, spec);
+    else
+        ret = dooshki_args_parse(&work_argc, &parse_argv, ctxt);
+
+    outcome->accepted = (ret == DOOSHKI_ARGS_PARSE_OK);
+    outcome->positional = &parse_argv[1];
+    outcome->positional_count = work_argc - 1;
+}
+
+/*
+ * Parse a command line with getopt_long, or with its counterpart
+ * in dooshki_getopt.c if `shim' is set.
+ */
+static void run_getopt(struct table *table, char shim, int argc, char **argv,
+                       char **work_argv, struct outcome *outcome)
+{
+    int opt_index;
+    int opt;
+
+    memcpy(work_argv, argv, (argc + 1) * sizeof(*work_argv));
+    outcome->event_count = 0;
+    outcome->accepted = 1;
+
+    opterr = 0;
+    optind = 0;
+    table->shim_state.opterr = 0;
+    table->shim_state.optind = 0;
+
+    for (;;)
+    {
+        if (shim)
+            opt = dooshki_getopt_long_r(argc, work_argv, table->optstring,
+                                        table->shim_options, NULL,
+                                        &table->shim_state);
+        else
+            opt = getopt_long(argc, work_argv, table->optstring,
+                              table->long_options, NULL);
+        if (opt == -1)
+            break;
+
+        if (opt >= 256)
+            opt_index = opt - 256;
+        else if (opt != '?' && opt != ':')
+            opt_index = table->short_index[(unsigned char)opt];
+        else
+        {
+            outcome->accepted = 0;
+            continue;
+        }
+
+        if (outcome->event_count < MAX_WORD_LEN)
+        {
+            outcome->events[outcome->event_count].opt_index = opt_index;
+            outcome->events[outcome->event_count].argument  =
+                shim? table->shim_state.optarg : optarg;
+            outcome->event_count++;
+        }
+    }
+    if (shim)
+        optind = table->shim_state.optind;
+
+    outcome->positional = &work_argv[optind];
+    outcome->positional_count = argc - optind;
+}
+
+/*
+ * Check whether two parsers made the same of a command line, unless `exact'
+ * is set, any two rejections are considered the same.
+ */
+static char same_outcome(const struct outcome *outcome_a,
+                         const struct outcome *outcome_b, char exact)
+{
+    unsigned int iter;
+
+    if (outcome_a->accepted != outcome_b->accepted)
+        return 0;
+
+    /* Both parsers report the errors, what they make of the rest differs. */
+    if (! outcome_a->accepted && ! exact)
+        return 1;
+
+    if (outcome_a->event_count != outcome_b->event_count ||
+        outcome_a->positional_count != outcome_b->positional_count)
+        return 0;
+
+    for (iter = 0; iter < outcome_a->event_count; iter++)
+    {
+        const struct event *event_a = &outcome_a->events[iter];
+        const struct event *event_b = &outcome_b->events[iter];
+
+        if (event_a->opt_index != event_b->opt_index ||
+            (event_a->argument == NULL) != (event_b->argument == NULL) ||
+            (event_a->argument != NULL &&
+             strcmp(event_a->argument, event_b->argument) != 0))
+            return 0;
+    }
+    for (iter = 0; iter < (unsigned int)outcome_a->positional_count; iter++)
+    {
+        if (strcmp(outcome_a->positional[iter], outcome_b->positional[iter]))
+            return 0;
+    }
+    return 1;
+}
+
+/* Count the long options a possibly abbreviated name matches. */
+static unsigned int count_matches(const struct table *table,
+                                  const char *name, size_t name_len)
+{
+    unsigned int matches = 0;
+    unsigned int iter;
+
+    for (iter = 0; iter < table->count; iter++)
+    {
+        const char *long_name = table->options[iter].long_name;
+
+        if (long_name == NULL || strncmp(long_name, name, name_len) != 0)
+            continue;
+
+        /* An exact match wins over abbreviations. */
+        if (long_name[name_len] == '\0')
+            return 1;
+
+        matches++;
+    }
+    return matches;
+}
+
+/* Determine the feature of a command line most likely causing a difference. */
+static enum feature find_feature(const struct table *table,
+                                 int argc, char **argv)
+{
+    enum feature feature = FEATURE_OTHER;
+    int iter;
+
+    for (iter = 1; iter < argc; iter++)
+    {
+        const char *word = argv[iter];
+        enum feature word_feature = FEATURE_OTHER;
+
+        if (strcmp(word, "-") == 0)
+            word_feature = FEATURE_LONE_DASH;
+
+        else if (strcmp(word, "--") == 0 && iter > 1 &&
+                 argv[iter - 1][0] == '-' && argv[iter - 1][1] != '\0')
+            word_feature = FEATURE_STOPPER_ARGUMENT;
+
+        else if (word[0] == '-' && word[1] == '-' && word[2] != '\0')
+        {
+            size_t name_len = strcspn(word + 2, "=");
+            unsigned int matches = count_matches(table, word + 2, name_len);
+            unsigned int opt_iter;
+
+            for (opt_iter = 0; opt_iter < table->count; opt_iter++)
+            {
+                const char *long_name = table->options[opt_iter].long_name;
+
+                if (long_name != NULL &&
+                    strncmp(long_name, word + 2, name_len) == 0 &&
+                    long_name[name_len] == '\0')
+                    break;
+            }
+            if (matches > 1)
+                word_feature = FEATURE_AMBIGUOUS;
+            else if (matches == 1 && opt_iter == table->count)
+                word_feature = FEATURE_ABBREVIATION;
+        }
+
+        if (word_feature < feature)
+            feature = word_feature;
+    }
+    return feature;
+}
+
+/* Format a command line into a buffer of MAX_WORD_LEN * 16 characters. */
+static void format_argv(char *text, int argc, char **argv)
+{
+    size_t len = 0;
+    int iter;
+
+    text[0] = '\0';
+    for (iter = 1; iter < argc; iter++)
+    {
+        size_t word_len = strlen(argv[iter]);
+
+        if (len + word_len + 4 >= MAX_WORD_LEN * 16)
+            break;
+
+        sprintf(&text[len], "%s'%s'", (iter > 1)? " " : "", argv[iter]);
+        len += word_len + 2 + (iter > 1);
+    }
+}
+
+/* Print what a parser made of a command line. */
+static void print_outcome(const char *parser, const struct table *table,
+                          const struct outcome *outcome)
+{
+    unsigned int iter;
+
+    printf("    %-8s %s:", parser, outcome->accepted? "accepted" : "rejected");
+    for (iter = 0; iter < outcome->event_count; iter++)
+    {
+        const struct dooshki_opt *option =
+            &table->options[outcome->events[iter].opt_index];
+
+        if (option->long_name != NULL)
+            printf(" --%s", option->long_name);
+        else
+            printf(" -%s", option->short_name);
+
+        if (outcome->events[iter].argument != NULL)
+            printf("='%s'", outcome->events[iter].argument);
+    }
+    printf(" |");
+    for (iter = 0; iter < (unsigned int)outcome->positional_count; iter++)
+        printf(" '%s'", outcome->positional[iter]);
+    printf("\n");
+}
+
+/* Silence the output of dooshki_args, or bring it back. */
+static void silence_output(char silence)
+{
+    static int saved_stdout = -1;
+    static int saved_stderr = -1;
+    int null_fd;
+
+    fflush(stdout);
+    fflush(stderr);
+
+    if (silence)
+    {
+        null_fd = open("/dev/null", O_WRONLY);
+        if (null_fd < 0)
+            return;
+
+        saved_stdout = dup(STDOUT_FILENO);
+        saved_stderr = dup(STDERR_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        close(null_fd);
+    }
+    else if (saved_stdout >= 0)
+    {
+        dup2(saved_stdout, STDOUT_FILENO);
+        dup2(saved_stderr, STDERR_FILENO);
+        close(saved_stdout);
+        close(saved_stderr);
+        saved_stdout = saved_stderr = -1;
+    }
+}
+
+/* Time taken by the parsers over the accepted command lines. */
+struct timings
+{
+    double linear;
+    double compiled;
+    double getopt;
+    double shim;
+    unsigned long lines;
+    unsigned long words;
+};
+
+/* Parse command lines repeatedly with each parser, adding up the time. */
+static void time_parsers(struct table *table, const struct dooshki_args *ctxt,
+                         const struct dooshki_args_spec *spec,
+                         char ***lines, int *line_argc, unsigned long count,
+                         char **work_argv, struct timings *timings)
+{
+    struct outcome outcome;
+    unsigned long round;
+    unsigned long iter;
+    clock_t start;
+
+    start = clock();
+    for (round = 0; round < rounds; round++)
+    {
+        for (iter = 0; iter < count; iter++)
+            run_dooshki(table, ctxt, NULL, line_argc[iter], lines[iter],
+                        work_argv, &outcome);
+    }
+    timings->linear += (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    start = clock();
+    for (round = 0; round < rounds; round++)
+    {
+        for (iter = 0; iter < count; iter++)
+            run_dooshki(table, ctxt, spec, line_argc[iter], lines[iter],
+                        work_argv, &outcome);
+    }
+    timings->compiled += (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    start = clock();
+    for (round = 0; round < rounds; round++)
+    {
+        for (iter = 0; iter < count; iter++)
+            run_getopt(table, 0, line_argc[iter], lines[iter], work_argv,
+                       &outcome);
+    }
+    timings->getopt += (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    start = clock();
+    for (round = 0; round < rounds; round++)
+    {
+        for (iter = 0; iter < count; iter++)
+            run_getopt(table, 1, line_argc[iter], lines[iter], work_argv,
+                       &outcome);
+    }
+    timings->shim += (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    for (iter = 0; iter < count; iter++)
+        timings->words += (unsigned long)(line_argc[iter] - 1);
+    timings->lines += count;
+}
+
+/* Print a throughput line. */
+static void print_throughput(const char *parser, double seconds,
+                             const struct timings *timings)
+{
+    double parses = (double)timings->lines * rounds;
+
+    printf("%-12s %14.1f %14.1f\n", parser,
+           seconds * 1e9 / parses,
+           seconds * 1e9 / parses / ((double)timings->words /
+                                     timings->lines));
+}
+
+int main(int argc, char **argv)
+{
+    static const struct dooshki_getopt_state initial_state =
+        DOOSHKI_GETOPT_STATE_INIT;
+    enum dooshki_args_ret arg_parse_ret;
+    struct dooshki_args cmp_args;
+    struct dooshki_args_spec *spec;
+    struct table *table;
+    struct outcome dooshki_outcome;
+    struct outcome getopt_outcome;
+    struct outcome shim_outcome;
+    struct catalog catalog;
+    struct timings timings;
+    char ***lines;
+    int *line_argc;
+    char **work_argv;
+    unsigned long accepted_count;
+    unsigned long both_rejected = 0;
+    unsigned long total = 0;
+    unsigned long differences = 0;
+    unsigned long shim_differences = 0;
+    unsigned long spec_iter;
+    unsigned long line_iter;
+    unsigned int iter;
+
+    arg_parse_ret = dooshki_args_parse(&argc, &argv, &cli_args_context);
+    switch(arg_parse_ret)
+    {
+        case DOOSHKI_ARGS_PARSE_OK:
+            break;
+
+        case DOOSHKI_ARGS_HELP_SHOWN:
+        case DOOSHKI_ARGS_VER_SHOWN:
+            return 0;
+
+        default:
+            return 1;
+    }
+    if (argc > 1)
+    {
+        fprintf(stderr, "%s: Unexpected argument `%s'.\n",
+                program_name, argv[1]);
+        dooshki_args_err_usage(&cli_args_context);
+        return 1;
+    }
+    if (spec_count == 0 || line_count == 0 || word_count == 0 ||
+        word_count > MAX_WORD_LEN - 2 || rounds == 0)
+    {
+        fprintf(stderr, "%s: The counts have to be non-zero, and there can "
+                "be at most %d words.\n", program_name, MAX_WORD_LEN - 2);
+        dooshki_args_err_usage(&cli_args_context);
+        return 1;
+    }
+
+    srand((unsigned int)seed);
+    memset(&catalog, 0, sizeof(catalog));
+    memset(&timings, 0, sizeof(timings));
+
+    table     = xmalloc(sizeof(*table));
+    table->shim_state = initial_state;
+    lines     = xmalloc(line_count * sizeof(*lines));
+    line_argc = xmalloc(line_count * sizeof(*line_argc));
+    work_argv = xmalloc((word_count + 2) * sizeof(*work_argv));
+
+    for (spec_iter = 0; spec_iter < spec_count; spec_iter++)
+    {
+        generate_table(table);
+
+        cmp_args = cli_args_context;
+        cmp_args.opt_desc = table->options;
+
+        spec = dooshki_args_compile(&cmp_args);
+        if (spec == NULL)
+        {
+            fprintf(stderr, "%s: Failed to compile a generated option "
+                    "table.\n", program_name);
+            return 1;
+        }
+
+        /* Compare, keeping the command lines both parsers accept. */
+        accepted_count = 0;
+        for (line_iter = 0; line_iter < line_count; line_iter++)
+        {
+            int gen_argc;
+            char **gen_argv = generate_argv(table, word_count, &gen_argc);
+            enum feature feature;
+
+            silence_output(1);
+            run_dooshki(table, &cmp_args, NULL, gen_argc, gen_argv,
+                        work_argv, &dooshki_outcome);
+            silence_output(0);
+
+            /* getopt_long permutes its copy, so it needs one of its own. */
+            {
+                char **getopt_argv = xmalloc((gen_argc + 1) *
+                                             sizeof(*getopt_argv));
+                char **shim_argv = xmalloc((gen_argc + 1) *
+                                           sizeof(*shim_argv));
+
+                run_getopt(table, 0, gen_argc, gen_argv, getopt_argv,
+                           &getopt_outcome);
+                run_getopt(table, 1, gen_argc, gen_argv, shim_argv,
+                           &shim_outcome);
+
+                if (! same_outcome(&shim_outcome, &getopt_outcome, 1))
+                {
+                    shim_differences++;
+                    if (verbose)
+                    {
+                        char text[MAX_WORD_LEN * 16];
+
+                        format_argv(text, gen_argc, gen_argv);
+                        printf("dooshki_getopt_long: %s\n", text);
+                        print_outcome("shim", table, &shim_outcome);
+                        print_outcome("getopt", table, &getopt_outcome);
+                    }
+                }
+
+                total++;
+                if (same_outcome(&dooshki_outcome, &getopt_outcome, 0))
+                {
+                    if (dooshki_outcome.accepted)
+                    {
+                        lines[accepted_count]       = gen_argv;
+                        line_argc[accepted_count++] = gen_argc;
+                        gen_argv = NULL;
+                    }
+                    else
+                        both_rejected++;
+                }
+                else
+                {
+                    differences++;
+                    feature = find_feature(table, gen_argc, gen_argv);
+                    if (catalog.counts[feature]++ == 0)
+                        format_argv(catalog.examples[feature],
+                                    gen_argc, gen_argv);
+
+                    if (verbose)
+                    {
+                        char text[MAX_WORD_LEN * 16];
+
+                        format_argv(text, gen_argc, gen_argv);
+                        printf("%s: %s\n", feature_names[feature], text);
+                        print_outcome("dooshki", table, &dooshki_outcome);
+                        print_outcome("getopt", table, &getopt_outcome);
+                    }
+                }
+                free(getopt_argv);
+                free(shim_argv);
+            }
+            if (gen_argv != NULL)
+                free_argv(gen_argc, gen_argv);
+        }
+
+        silence_output(1);
+        time_parsers(table, &cmp_args, spec, lines, line_argc,
+                     accepted_count, work_argv, &timings);
+        silence_output(0);
+
+        for (line_iter = 0; line_iter < accepted_count; line_iter++)
+            free_argv(line_argc[line_iter], lines[line_iter]);
+        dooshki_args_spec_free(spec);
+
+        /* The next table reuses the same arrays, drop their indexes. */
+        dooshki_getopt_state_free(&table->shim_state);
+        dooshki_args_auto_index_free();
+    }
+
+    printf("tables: %lu, command lines: %lu, words per command line: %lu\n\n",
+           spec_count, total, word_count);
+    printf("same result:      %lu (%lu accepted by both, %lu rejected by "
+           "both)\n", total - differences, timings.lines, both_rejected);
+    printf("different result: %lu\n", differences);
+
+    for (iter = 0; iter < FEATURE_COUNT; iter++)
+    {
+        if (catalog.counts[iter] == 0)
+            continue;
+
+        printf("    %-30s %8lu   e.g. %s\n", feature_names[iter],
+               catalog.counts[iter], catalog.examples[iter]);
+    }
+    printf("dooshki_getopt_long differing from getopt_long: %lu\n",
+           shim_differences);
+
+    if (timings.lines > 0)
+    {
+        printf("\nthroughput over the command lines accepted by both, "
+               "%lu rounds:\n\n", rounds);
+        printf("%-12s %14s %14s\n", "parser", "ns/parse", "ns/word");
+        print_throughput("linear", timings.linear, &timings);
+        print_throughput("compiled", timings.compiled, &timings);
+        print_throughput("getopt_long", timings.getopt, &timings);
+        print_throughput("shim", timings.shim, &timings);
+    }
+    return 0;
+}
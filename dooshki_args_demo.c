@@ -13,9 +13,20 @@
  * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
+/* The startup benchmark build reports to dooshki_args_startup via POSIX. */
+#ifdef DOOSHKI_ARGS_DEMO_STARTUP
+#define _POSIX_C_SOURCE 200112L
+#endif
+
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <time.h>
+#ifdef DOOSHKI_ARGS_DEMO_STARTUP
+#include <signal.h>
+#include <unistd.h>
+#endif
 #include "dooshki_args.h"
 
 #define PROG_NAME    "dooshki_args_demo"
@@ -38,6 +49,23 @@
 
 #define MAX_VERBOSE_LEVEL 3
 
+/* If set, names a file to which the used options are traced. */
+#define TRACE_ENV_VAR "DOOSHKI_ARGS_DEMO_TRACE"
+
+/* Size of the name buffer of a generated option (see generate_options). */
+#define GEN_NAME_SIZE 32
+
+/*
+ * Number of time samples and histogram buckets of the repeat mode, and
+ * the least number of clock() ticks a sample has to span, which is at
+ * least a millisecond.
+ */
+#define MAX_SAMPLES     1000
+#define MIN_BATCH_TICKS ((CLOCKS_PER_SEC / 1000 > 100)? \
+                         CLOCKS_PER_SEC / 1000 : 100)
+#define HIST_BUCKETS 30
+#define HIST_WIDTH   50
+
 
 static const char *program_name = PROG_NAME;
 
@@ -152,6 +180,11 @@ static char quality_set = 0;
 static unsigned int verbose_level = 0;
 static char verbose_level_set = 0;
 
+static char check_files = 0;
+static char dump_json = 0;
+static const char *export_path = NULL;
+static const char *completion_shell = NULL;
+
 
 /*
  * Option definitions.
@@ -187,6 +220,19 @@ static const struct dooshki_opt cli_options[] =
     { "q", "quality", "GOOD|BAD|UGLY", DOOSHKI_OPT_CB, &quality, &quality_set,
       "Quality of the projectiles to be used.", quality_arg_decode, NULL },
 
+    { "c", "check-files", NULL, DOOSHKI_OPT_BOOL, &check_files, NULL,
+      "Verify that the listed files exist and are readable.", NULL, NULL },
+
+    { "j", "json", NULL, DOOSHKI_OPT_BOOL, &dump_json, NULL,
+      "Display the retrieved options as JSON.", NULL, NULL },
+
+    { NULL, "export-spec", "FILE", DOOSHKI_OPT_STR, &export_path, NULL,
+      "Write a binary image of this program's options into FILE.",
+      NULL, NULL },
+
+    { NULL, "completion", "bash|zsh|fish", DOOSHKI_OPT_STR, &completion_shell,
+      NULL, "Print a completion script for the given shell.", NULL, NULL },
+
     { NULL }
 };
 
@@ -199,9 +245,361 @@ static struct dooshki_args cli_args_context =
     PROG_SUMMARY,
     PROG_DESCRIPTION,
 
-    cli_options
+    cli_options,
+
+    NULL,       /* no adaptive lookup order */
+    NULL, NULL, /* option tracing is set up in main() */
+    NULL,       /* no statistics */
+    NULL        /* English messages */
 };
 
+/*
+ * Write a binary image of the option specification into a file, `spec' is
+ * compiled here if it's NULL.
+ */
+static char export_spec(const struct dooshki_args_spec *spec, const char *path)
+{
+    struct dooshki_args_spec *own_spec = NULL;
+    unsigned char *image;
+    unsigned long image_size;
+    FILE *image_file;
+    char success;
+
+    if (spec == NULL)
+    {
+        spec = own_spec = dooshki_args_compile(&cli_args_context);
+        if (spec == NULL)
+        {
+            fprintf(stderr, "%s: Failed to compile the option table.\n",
+                    program_name);
+            return 0;
+        }
+    }
+
+    image_size = dooshki_args_export(spec, NULL, 0);
+    image = malloc(image_size);
+    if (image == NULL)
+    {
+        fprintf(stderr, "%s: Out of memory.\n", program_name);
+        dooshki_args_spec_free(own_spec);
+        return 0;
+    }
+    dooshki_args_export(spec, image, image_size);
+    dooshki_args_spec_free(own_spec);
+
+    image_file = fopen(path, "wb");
+    success = (image_file != NULL &&
+               fwrite(image, 1, image_size, image_file) == image_size);
+
+    if (image_file != NULL && fclose(image_file) != 0)
+        success = 0;
+
+    if (! success)
+        fprintf(stderr, "%s: Failed to write the spec image into `%s'.\n",
+                program_name, path);
+
+    free(image);
+    return success;
+}
+
+/* Storage of the options added by --gen-options. */
+static char gen_flag = 0;
+static const char *gen_string = NULL;
+
+/* Restore the values retrieved from the command line to their defaults. */
+static void reset_values(void)
+{
+    automatic = 0;
+    automatic_opt = 0;
+    manual_opt = 0;
+    label = NULL;
+    direction = 0;
+    direction_set = 0;
+    velocity = 0;
+    velocity_set = 0;
+    rating = 0.0;
+    rating_set = 0;
+    quality = QUALITY_GOOD;
+    quality_set = 0;
+    verbose_level = 0;
+    verbose_level_set = 0;
+    check_files = 0;
+    dump_json = 0;
+    export_path = NULL;
+    completion_shell = NULL;
+    gen_flag = 0;
+    gen_string = NULL;
+}
+
+/*
+ * Build an option table of `count' generated options followed by the demo's
+ * own ones, returns NULL if out of memory.
+ *
+ * The generated options come first, so that a linear lookup has to go past
+ * all of them to find the demo's own options.
+ */
+static struct dooshki_opt *generate_options(unsigned long count)
+{
+    size_t own_count = sizeof(cli_options) / sizeof(cli_options[0]);
+    struct dooshki_opt *table;
+    char *names;
+    unsigned long iter;
+
+    table = malloc((count + own_count) * sizeof(*table));
+    names = malloc(count * GEN_NAME_SIZE);
+    if (table == NULL || names == NULL)
+    {
+        free(table);
+        free(names);
+        return NULL;
+    }
+
+    for (iter = 0; iter < count; iter++)
+    {
+        struct dooshki_opt *option = &table[iter];
+        char *name = &names[iter * GEN_NAME_SIZE];
+
+        sprintf(name, "gen-option-%lu", iter);
+
+        option->short_name = NULL;
+        option->long_name = name;
+        if (iter % 2 == 0)
+        {
+            option->argument_template = NULL;
+            option->type = DOOSHKI_OPT_BOOL;
+            option->opt_storage = &gen_flag;
+        }
+        else
+        {
+            option->argument_template = "VALUE";
+            option->type = DOOSHKI_OPT_STR;
+            option->opt_storage = &gen_string;
+        }
+        option->opt_found = NULL;
+        option->description = "Generated option.";
+        option->callback = NULL;
+        option->callback_data = NULL;
+    }
+    memcpy(&table[count], cli_options, sizeof(cli_options));
+
+    return table;
+}
+
+/* Comparison of doubles, for qsort. */
+static int compare_doubles(const void *in_a, const void *in_b)
+{
+    double value_a = *(const double *)in_a;
+    double value_b = *(const double *)in_b;
+
+    return (value_a > value_b) - (value_a < value_b);
+}
+
+/*
+ * Parse the command line `count' times, with dooshki_args_parse if `spec' is
+ * NULL, returns the number of clock() ticks it took, or -1 if it didn't parse
+ * without errors or output.
+ */
+static long parse_batch(int argc, char **argv, char **work_argv,
+                        const struct dooshki_args_spec *spec,
+                        unsigned long count)
+{
+    clock_t start = clock();
+    unsigned long parse;
+
+    for (parse = 0; parse < count; parse++)
+    {
+        int work_argc = argc;
+        char **parse_argv = work_argv;
+
+        memcpy(work_argv, argv, (argc + 1) * sizeof(*work_argv));
+        reset_values();
+
+        if (((spec != NULL)?
+             dooshki_args_parse_spec(&work_argc, &parse_argv, spec) :
+             dooshki_args_parse(&work_argc, &parse_argv, &cli_args_context))
+            != DOOSHKI_ARGS_PARSE_OK)
+        {
+            return -1;
+        }
+    }
+    return (long)(clock() - start);
+}
+
+/*
+ * Parse the command line about `repeat' times without acting on it, and show
+ * a histogram of the time a parse takes.  Returns the exit status.
+ *
+ * clock() is too coarse to time a single parse, so the parses are timed
+ * in batches spanning at least MIN_BATCH_TICKS, and each sample is the mean
+ * of a batch.  The batch size is found by doubling it, the number of parses
+ * is then rounded to whole batches, of which there are at most MAX_SAMPLES.
+ * The command line has to parse without errors and without showing help
+ * or the version, so that nothing but the parser runs in the loop.
+ */
+static int repeat_parsing(int argc, char **argv,
+                          const struct dooshki_args_spec *spec,
+                          unsigned long repeat)
+{
+    unsigned long batch = 1;
+    unsigned long sample_count;
+    unsigned long buckets[HIST_BUCKETS];
+    unsigned long most = 0;
+    unsigned long iter;
+    unsigned int bucket;
+    unsigned int first_bucket = HIST_BUCKETS;
+    unsigned int last_bucket = 0;
+    char **work_argv;
+    double *samples;
+    long ticks;
+
+    work_argv = malloc((argc + 1) * sizeof(*work_argv));
+    if (work_argv == NULL)
+    {
+        fprintf(stderr, "%s: Out of memory.\n", program_name);
+        return 1;
+    }
+
+    while ((ticks = parse_batch(argc, argv, work_argv, spec, batch))
+           >= 0 && ticks < MIN_BATCH_TICKS)
+    {
+        batch *= 2;
+    }
+    if (ticks < 0)
+    {
+        fprintf(stderr, "%s: The repeat mode needs a command line "
+                "which parses without errors or output.\n", program_name);
+        free(work_argv);
+        return 1;
+    }
+
+    sample_count = (repeat > batch)? repeat / batch : 1;
+    if (sample_count > MAX_SAMPLES)
+    {
+        batch = repeat / MAX_SAMPLES;
+        sample_count = MAX_SAMPLES;
+    }
+
+    samples = malloc(sample_count * sizeof(*samples));
+    if (samples == NULL)
+    {
+        fprintf(stderr, "%s: Out of memory.\n", program_name);
+        free(work_argv);
+        return 1;
+    }
+
+    for (iter = 0; iter < sample_count; iter++)
+    {
+        ticks = parse_batch(argc, argv, work_argv, spec, batch);
+        samples[iter] = (double)ticks / CLOCKS_PER_SEC * 1e9 / batch;
+    }
+
+    /* Bucket `n' holds the samples from 2^n up to 2^(n+1) nanoseconds. */
+    for (bucket = 0; bucket < HIST_BUCKETS; bucket++)
+        buckets[bucket] = 0;
+
+    for (iter = 0; iter < sample_count; iter++)
+    {
+        double limit = 2.0;
+
+        for (bucket = 0; bucket < HIST_BUCKETS - 1 && samples[iter] >= limit;
+             bucket++)
+        {
+            limit *= 2.0;
+        }
+        buckets[bucket]++;
+
+        if (buckets[bucket] > most)
+            most = buckets[bucket];
+        if (bucket < first_bucket)
+            first_bucket = bucket;
+        if (bucket > last_bucket)
+            last_bucket = bucket;
+    }
+
+    qsort(samples, sample_count, sizeof(*samples), compare_doubles);
+
+    printf("Parsed the command line %lu times, in %lu batches of %lu.\n",
+           sample_count * batch, sample_count, batch);
+    printf("Batch mean time per parse (ns): min %.1f, p50 %.1f, p99 %.1f, "
+           "max %.1f\n\n", samples[0], samples[(sample_count - 1) / 2],
+           samples[(sample_count * 99 + 99) / 100 - 1],
+           samples[sample_count - 1]);
+
+    printf("%24s %10s\n", "batch mean (ns)", "batches");
+    for (bucket = first_bucket; bucket <= last_bucket; bucket++)
+    {
+        unsigned long bar = (buckets[bucket] * HIST_WIDTH + most - 1) / most;
+
+        printf("%11lu - %10lu %10lu  ",
+               (bucket > 0)? 1UL << bucket : 0UL, (2UL << bucket) - 1,
+               buckets[bucket]);
+        for (; bar > 0; bar--)
+            putchar('#');
+        putchar('\n');
+    }
+
+    free(work_argv);
+    free(samples);
+    return 0;
+}
+
+/*
+ * Hidden profiling switch, returns 1 if `word' is `prefix' followed by
+ * a number, which is stored into *value.
+ */
+static char hidden_switch(const char *word, const char *prefix,
+                          unsigned long *value)
+{
+    size_t prefix_len = strlen(prefix);
+    char *end;
+
+    if (strncmp(word, prefix, prefix_len) != 0 ||
+        ! isdigit((unsigned char)word[prefix_len]))
+    {
+        return 0;
+    }
+
+    *value = strtoul(&word[prefix_len], &end, 10);
+    return (*end == '\0')? 1 : 0;
+}
+
+/* Hidden switch without a value, returns 1 and sets *flag if `word' is it. */
+static char hidden_flag(const char *word, const char *name, char *flag)
+{
+    if (strcmp(word, name) != 0)
+        return 0;
+
+    *flag = 1;
+    return 1;
+}
+
+#ifdef DOOSHKI_ARGS_DEMO_STARTUP
+/* Names the descriptor to report the end of the startup to. */
+#define STARTUP_FD_ENV_VAR "DOOSHKI_ARGS_DEMO_STARTUP_FD"
+
+/*
+ * Report the end of the startup to dooshki_args_startup, which has
+ * the CLOCK_MONOTONIC time written to the descriptor it passed, and stop
+ * until it has read the hardware counters.
+ */
+static void report_startup_end(void)
+{
+    struct timespec now;
+    const char *fd_text;
+    double stamp;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    stamp = now.tv_sec + now.tv_nsec / 1e9;
+
+    fd_text = getenv(STARTUP_FD_ENV_VAR);
+    if (fd_text != NULL &&
+        write(atoi(fd_text), &stamp, sizeof(stamp)) == sizeof(stamp))
+    {
+        raise(SIGSTOP);
+    }
+}
+#endif
+
 #if 0
 static void list_argv(int argc, char **argv)
 {
@@ -227,14 +625,30 @@ static void list_argv(int argc, char **argv)
 #define list_argv(a, b)
 #endif
 
-int main(int argc, char **argv)
+/*
+ * Parse the command line, with dooshki_args_parse if `cli_spec' is NULL,
+ * and act on it, returns the exit status.
+ */
+static int process_command_line(int argc, char **argv,
+                                const struct dooshki_args_spec *cli_spec)
 {
     enum dooshki_args_ret arg_parse_ret;
 
     list_argv(argc, argv);
-    arg_parse_ret = dooshki_args_parse(&argc, &argv, &cli_args_context);
+    if (cli_spec != NULL)
+        arg_parse_ret = dooshki_args_parse_spec(&argc, &argv, cli_spec);
+    else
+        arg_parse_ret = dooshki_args_parse(&argc, &argv, &cli_args_context);
+#ifdef DOOSHKI_ARGS_DEMO_STARTUP
+    report_startup_end();
+#endif
     list_argv(argc, argv);
 
+#ifdef DOOSHKI_ARGS_DEMO_STARTUP
+    /* Build used by dooshki_args_startup, nothing else is needed. */
+    return (arg_parse_ret == DOOSHKI_ARGS_PARSE_OK)? 0 : 1;
+#endif
+
     switch(arg_parse_ret)
     {
         case DOOSHKI_ARGS_PARSE_OK:
@@ -248,17 +662,74 @@ int main(int argc, char **argv)
             return 0;
             break;
 
+        case DOOSHKI_ARGS_COMPLETION_SHOWN:
+            return 0;
+            break;
+
         case DOOSHKI_ARGS_PARSE_ERROR:
             return 1;
             break;
 
         default:
             fprintf(stderr,
-                    "%s: Unexpected return value %u from dooshki_args_parse().\n",
+                    "%s: Unexpected return value %u from the parser.\n",
                     program_name, (unsigned int)arg_parse_ret);
             return 1;
     }
 
+    if (check_files &&
+        dooshki_args_check_files(&cli_args_context, DOOSHKI_FILE_READABLE,
+                                 argc - 1, argv + 1, NULL)
+        != DOOSHKI_ARGS_PARSE_OK)
+    {
+        dooshki_args_err_usage(&cli_args_context);
+        return 1;
+    }
+
+    if (export_path != NULL)
+        return export_spec(cli_spec, export_path)? 0 : 1;
+
+    if (completion_shell != NULL)
+    {
+        enum dooshki_shell shell;
+
+        if (streq_ci(completion_shell, "bash"))
+            shell = DOOSHKI_SHELL_BASH;
+        else if (streq_ci(completion_shell, "zsh"))
+            shell = DOOSHKI_SHELL_ZSH;
+        else if (streq_ci(completion_shell, "fish"))
+            shell = DOOSHKI_SHELL_FISH;
+        else
+        {
+            fprintf(stderr, "%s: Unsupported shell `%s'.\n",
+                    program_name, completion_shell);
+            dooshki_args_err_usage(&cli_args_context);
+            return 1;
+        }
+
+        if (! dooshki_args_print_completion(&cli_args_context, shell))
+        {
+            fprintf(stderr, "%s: Out of memory.\n", program_name);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (dump_json)
+    {
+        char json[4096];
+
+        if (dooshki_args_dump_json(&cli_args_context, json, sizeof(json))
+            >= sizeof(json))
+        {
+            fprintf(stderr, "%s: The JSON dump doesn't fit into the buffer.\n",
+                    program_name);
+            return 1;
+        }
+        printf("%s\n", json);
+        return 0;
+    }
+
     printf("The following information was retrieved from the command line:\n");
 
     printf("    Label:          %s\n", (label != NULL)? label : "unspecified");
@@ -332,3 +803,82 @@ int main(int argc, char **argv)
 
     return 0;
 }
+
+int main(int argc, char **argv)
+{
+    struct dooshki_args_spec *cli_spec = NULL;
+    const char *trace_path = getenv(TRACE_ENV_VAR);
+    FILE *trace_file = NULL;
+    unsigned long repeat = 0;
+    unsigned long gen_count = 0;
+    char plain = 0;
+    int status;
+
+    /*
+     * Hidden switches making the demo a profiling target, accepted only
+     * as the first arguments and removed before the command line is parsed:
+     *
+     *   --gen-options=N  adds N generated options to the option table,
+     *                    for scaling runs with larger tables
+     *   --repeat=N       parses the rest of the command line N times without
+     *                    acting on it, and shows a histogram of the time
+     *                    a parse takes (see repeat_parsing())
+     *   --plain          parses with dooshki_args_parse instead of a compiled
+     *                    spec, for comparison (--complete isn't supported)
+     */
+    while (argc > 1 &&
+           (hidden_switch(argv[1], "--repeat=", &repeat) ||
+            hidden_switch(argv[1], "--gen-options=", &gen_count) ||
+            hidden_flag(argv[1], "--plain", &plain)))
+    {
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+    if (gen_count > 0)
+    {
+        cli_args_context.opt_desc = generate_options(gen_count);
+        if (cli_args_context.opt_desc == NULL)
+        {
+            fprintf(stderr, "%s: Out of memory.\n", program_name);
+            return 1;
+        }
+    }
+
+    /* Option usage tracing, to be processed by dooshki_args_pgo. */
+    if (trace_path != NULL && trace_path[0] != '\0')
+    {
+        trace_file = fopen(trace_path, "a");
+        if (trace_file == NULL)
+        {
+            fprintf(stderr, "%s: Failed to open trace file `%s'.\n",
+                    program_name, trace_path);
+            return 1;
+        }
+        cli_args_context.trace_hook = dooshki_args_trace_write;
+        cli_args_context.trace_data = trace_file;
+    }
+
+    /* The compiled spec also answers completion queries (--complete). */
+    if (! plain)
+    {
+        cli_spec = dooshki_args_compile(&cli_args_context);
+        if (cli_spec == NULL)
+        {
+            fprintf(stderr, "%s: Failed to compile the option table.\n",
+                    program_name);
+            return 1;
+        }
+    }
+
+    if (repeat > 0)
+        status = repeat_parsing(argc, argv, cli_spec, repeat);
+    else
+        status = process_command_line(argc, argv, cli_spec);
+
+    if (trace_file != NULL)
+        fclose(trace_file);
+
+    dooshki_args_spec_free(cli_spec);
+    return status;
+}
@@ -0,0 +1,768 @@
+/*
+ * Copyright (c) 2020 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <execinfo.h>
+#include "dooshki_args.h"
+
+#define PROG_NAME    "dooshki_args_noalloc"
+#define PROG_VERSION "0.1"
+#define PROG_USAGE   "[OPTIONS]"
+#define PROG_SUMMARY "Allocation check of the dooshki_args library"
+
+#define PROG_DESCRIPTION \
+                         \
+"This program parses a large corpus of generated command lines, valid\n" \
+"and erroneous, with every option lookup layout of the library, while\n" \
+"malloc, calloc, realloc and free are replaced by routines which print\n" \
+"the stack of any call made by the parser and fail the program.\n" \
+"\n" \
+"The first parse with each layout isn't checked, as it may compile\n" \
+"an index (DOOSHKI_ARGS_AUTO_INDEX), nor is the help screen of a compiled\n" \
+"spec, which caches its layout.  Messages printed are discarded.\n"
+
+
+/*
+ * Short option names available to the generated options, the ones reserved
+ * by dooshki_args for help and version are left out.
+ */
+#define SHORT_NAMES "abcdefgijklmnopqrstuwxyzABCDEFGIJKLMNOPQRSTUWXYZ0123456789"
+
+/*
+ * Maximum number of words and characters of a generated command line,
+ * including the program name.
+ */
+#define MAX_WORDS     24
+#define MAX_LINE_TEXT 1024
+
+/* Maximum depth of a reported stack. */
+#define MAX_FRAMES    64
+
+static const char *program_name = PROG_NAME;
+
+/* Values retrieved from the command line. */
+static unsigned long option_count = 200;
+static unsigned long line_count = 20000;
+static unsigned long seed = 1;
+
+static const struct dooshki_opt cli_options[] =
+{
+    { "o", "options", "COUNT", DOOSHKI_OPT_UINT, &option_count, NULL,
+      "Number of options in the generated table (default: 200).",
+      NULL, NULL },
+
+    { "l", "lines", "COUNT", DOOSHKI_OPT_UINT, &line_count, NULL,
+      "Number of generated command lines (default: 20000).", NULL, NULL },
+
+    { "s", "seed", "SEED", DOOSHKI_OPT_UINT, &seed, NULL,
+      "Seed of the random number generator (default: 1).", NULL, NULL },
+
+    { NULL }
+};
+
+static struct dooshki_args cli_args_context =
+{
+    PROG_NAME,
+    PROG_VERSION,
+    PROG_USAGE,
+    PROG_SUMMARY,
+    PROG_DESCRIPTION,
+
+    cli_options,
+
+    NULL,
+    NULL, NULL,
+    NULL,
+    NULL
+};
+
+
+/*
+ * Allocator interposition.
+ *
+ * The replacements forward to glibc's own allocator, unless the parser
+ * is running, in which case the call is reported and the program exits.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+/* Set while the parser runs. */
+static volatile char armed = 0;
+
+/* Where allocations are reported, stderr isn't discarded there. */
+static int report_fd = 2;
+
+/* What is being parsed, for the report. */
+static const char *current_layout = "";
+static unsigned long current_line = 0;
+
+/* Write a string onto the report descriptor, without using stdio. */
+static void report_text(const char *text)
+{
+    size_t length = strlen(text);
+    ssize_t written;
+
+    while (length > 0)
+    {
+        written = write(report_fd, text, length);
+        if (written <= 0)
+            return;
+
+        text   += written;
+        length -= (size_t)written;
+    }
+}
+
+/* Write a number onto the report descriptor. */
+static void report_number(unsigned long number)
+{
+    char digits[32];
+    unsigned int pos = sizeof(digits) - 1;
+
+    digits[pos] = '\0';
+    do
+    {
+        digits[--pos] = (char)('0' + number % 10);
+        number /= 10;
+    }
+    while (number > 0);
+
+    report_text(&digits[pos]);
+}
+
+/* Report an allocation made while parsing, and exit. */
+static void report_allocation(const char *routine)
+{
+    void *frames[MAX_FRAMES];
+    int depth;
+
+    armed = 0;
+
+    report_text(program_name);
+    report_text(": ");
+    report_text(routine);
+    report_text("() called while parsing command line ");
+    report_number(current_line);
+    report_text(" with the ");
+    report_text(current_layout);
+    report_text(" layout:\n");
+
+    depth = backtrace(frames, MAX_FRAMES);
+    backtrace_symbols_fd(frames, depth, report_fd);
+    _exit(1);
+}
+
+void *malloc(size_t size)
+{
+    if (armed)
+        report_allocation("malloc");
+
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    if (armed)
+        report_allocation("calloc");
+
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if (armed)
+        report_allocation("realloc");
+
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    if (armed && ptr != NULL)
+        report_allocation("free");
+
+    __libc_free(ptr);
+}
+
+
+/* Allocate memory, terminating the program on failure. */
+static void *xmalloc(size_t size)
+{
+    void *ptr = malloc((size > 0)? size : 1);
+
+    if (ptr == NULL)
+    {
+        fprintf(stderr, "%s: Out of memory.\n", program_name);
+        exit(1);
+    }
+    return ptr;
+}
+
+static unsigned int random_below(unsigned int limit)
+{
+    return (unsigned int)rand() % limit;
+}
+
+
+/* Storage of a generated option, of whichever type it has. */
+struct storage
+{
+    char flag;
+    const char *text;
+    long number;
+    unsigned long unsigned_number;
+    double real;
+};
+
+/* Callback of the generated options, refuses arguments starting with `!'. */
+static char check_argument(const char *argument_text, void *opt_storage,
+                           const char *opt_prefix, const char *opt_name,
+                           void *callback_data)
+{
+    (void)opt_storage;
+    (void)opt_prefix;
+    (void)opt_name;
+    (void)callback_data;
+
+    return (argument_text == NULL || argument_text[0] != '!');
+}
+
+/* Types the generated options cycle through. */
+static const enum dooshki_opt_type option_types[] =
+{
+    DOOSHKI_OPT_BOOL,
+    DOOSHKI_OPT_NEGBOOL,
+    DOOSHKI_OPT_STR,
+    DOOSHKI_OPT_INT,
+    DOOSHKI_OPT_UINT,
+    DOOSHKI_OPT_FLOAT,
+    DOOSHKI_OPT_CB,
+    DOOSHKI_OPT_CB_NOARG
+};
+#define TYPE_COUNT (sizeof(option_types) / sizeof(option_types[0]))
+
+/* Generate the option table, terminated by an all-NULL entry. */
+static struct dooshki_opt *generate_options(unsigned long count)
+{
+    struct dooshki_opt *options = xmalloc((count + 1) * sizeof(*options));
+    struct storage *storage = xmalloc(count * sizeof(*storage));
+    char *short_names = xmalloc(count * 2);
+    char *long_names = xmalloc(count * 16);
+    char *found = xmalloc(count);
+    unsigned long iter;
+
+    memset(options, 0, (count + 1) * sizeof(*options));
+    memset(storage, 0, count * sizeof(*storage));
+    for (iter = 0; iter < count; iter++)
+    {
+        struct dooshki_opt *option = &options[iter];
+        struct storage *value = &storage[iter];
+
+        if (iter < sizeof(SHORT_NAMES) - 1)
+        {
+            short_names[iter * 2]     = SHORT_NAMES[iter];
+            short_names[iter * 2 + 1] = '\0';
+            option->short_name = &short_names[iter * 2];
+        }
+        sprintf(&long_names[iter * 16], "option-%lu", iter);
+        option->long_name = &long_names[iter * 16];
+
+        option->type = option_types[iter % TYPE_COUNT];
+        switch (option->type)
+        {
+            case DOOSHKI_OPT_BOOL:
+            case DOOSHKI_OPT_NEGBOOL:
+                option->opt_storage = &value->flag;
+                break;
+
+            case DOOSHKI_OPT_STR:
+                option->opt_storage = (void *)&value->text;
+                break;
+
+            case DOOSHKI_OPT_INT:
+                option->opt_storage = &value->number;
+                break;
+
+            case DOOSHKI_OPT_UINT:
+                option->opt_storage = &value->unsigned_number;
+                break;
+
+            case DOOSHKI_OPT_FLOAT:
+                option->opt_storage = &value->real;
+                break;
+
+            default:
+                option->callback = check_argument;
+                break;
+        }
+        if (option->type != DOOSHKI_OPT_BOOL &&
+            option->type != DOOSHKI_OPT_NEGBOOL &&
+            option->type != DOOSHKI_OPT_CB_NOARG)
+            option->argument_template = "VALUE";
+
+        option->opt_found   = &found[iter];
+        option->description = "Generated option.";
+    }
+    return options;
+}
+
+
+/* A generated command line, its words are kept in `text'. */
+struct command_line
+{
+    int argc;
+    char **argv;
+    char *text;
+    unsigned int text_used;
+    char shows_help;
+};
+
+/* Append a word to a command line, unless it's full. */
+static void add_word(struct command_line *line, const char *word)
+{
+    size_t length = strlen(word) + 1;
+
+    if (line->argc >= MAX_WORDS || line->text_used + length > MAX_LINE_TEXT)
+        return;
+
+    memcpy(&line->text[line->text_used], word, length);
+    line->argv[line->argc++] = &line->text[line->text_used];
+    line->argv[line->argc] = NULL;
+    line->text_used += (unsigned int)length;
+}
+
+/* Argument for an option of the given type, a bad one if `bad' is set. */
+static const char *option_argument(enum dooshki_opt_type type, char bad)
+{
+    switch (type)
+    {
+        case DOOSHKI_OPT_INT:
+            return bad? "12x" : "-42";
+
+        case DOOSHKI_OPT_UINT:
+            return bad? "-1" : "42";
+
+        case DOOSHKI_OPT_FLOAT:
+            return bad? "1.5.5" : "2.5e3";
+
+        case DOOSHKI_OPT_CB:
+            return bad? "!value" : "value";
+
+        default:
+            return "text";
+    }
+}
+
+/* Add a use of an option to a command line, in a random form. */
+static void add_option(struct command_line *line,
+                       const struct dooshki_opt *option, char bad)
+{
+    const char *argument = NULL;
+    char word[64];
+
+    if (option->argument_template != NULL)
+        argument = option_argument(option->type, bad);
+
+    switch (random_below(4))
+    {
+        case 0:
+            sprintf(word, "--%s", option->long_name);
+            break;
+
+        case 1:
+            /* An abbreviation, which may well match another option. */
+            sprintf(word, "--%.*s", (int)strlen(option->long_name) - 1,
+                    option->long_name);
+            break;
+
+        case 2:
+            if (argument != NULL)
+            {
+                sprintf(word, "--%s=%s", option->long_name, argument);
+                argument = NULL;
+            }
+            else
+            {
+                sprintf(word, "--%s", option->long_name);
+            }
+            break;
+
+        default:
+            if (option->short_name == NULL)
+            {
+                sprintf(word, "--%s", option->long_name);
+            }
+            else if (argument != NULL && random_below(2) == 0)
+            {
+                sprintf(word, "-%s%s", option->short_name, argument);
+                argument = NULL;
+            }
+            else
+            {
+                sprintf(word, "-%s", option->short_name);
+            }
+            break;
+    }
+    add_word(line, word);
+    if (argument != NULL)
+        add_word(line, argument);
+}
+
+/*
+ * Generate a random command line, with an error in about one of eight.
+ *
+ * Errors are unknown options, bad arguments and missing arguments.
+ */
+static void generate_line(struct command_line *line,
+                          const struct dooshki_opt *options,
+                          unsigned long count)
+{
+    unsigned int words = 1 + random_below(MAX_WORDS - 4);
+    unsigned int error_at = (random_below(8) == 0)? random_below(words) :
+                                                    words;
+    const struct dooshki_opt *option;
+    unsigned int iter;
+    char word[64];
+
+    /* An option with its argument takes up to two words. */
+    for (iter = 0; iter < words && line->argc + 2 <= MAX_WORDS; iter++)
+    {
+        option = &options[random_below((unsigned int)count)];
+        switch ((iter == error_at)? 4 + random_below(3) : random_below(4))
+        {
+            case 0:
+                add_word(line, "positional");
+                break;
+
+            case 1:
+                add_word(line, (random_below(4) == 0)? "--" : "-");
+                break;
+
+            case 4:
+                add_word(line, (random_below(2) == 0)? "--unknown-option" :
+                                                       "-%");
+                break;
+
+            case 5:
+                add_option(line, option, 1);
+                break;
+
+            case 6:
+                /* An option taking an argument, which ends the line. */
+                if (option->argument_template != NULL)
+                {
+                    sprintf(word, "--%s", option->long_name);
+                    add_word(line, word);
+                    return;
+                }
+                add_word(line, "--unknown-option");
+                break;
+
+            default:
+                add_option(line, option, 0);
+                break;
+        }
+    }
+}
+
+/* Generate the corpus, beginning with lines showing version and help. */
+static struct command_line *generate_corpus(const struct dooshki_opt *options,
+                                            unsigned long count,
+                                            unsigned long lines)
+{
+    struct command_line *corpus = xmalloc(lines * sizeof(*corpus));
+    unsigned long iter;
+
+    for (iter = 0; iter < lines; iter++)
+    {
+        struct command_line *line = &corpus[iter];
+
+        line->argv = xmalloc((MAX_WORDS + 1) * sizeof(*line->argv));
+        line->text = xmalloc(MAX_LINE_TEXT);
+        line->text_used = 0;
+        line->argc = 0;
+        line->shows_help = (iter == 1);
+        add_word(line, PROG_NAME);
+
+        if (iter == 0)
+            add_word(line, "--version");
+        else if (iter == 1)
+            add_word(line, "--help");
+        else
+            generate_line(line, options, count);
+    }
+    return corpus;
+}
+
+
+/* Ways of looking up the options, each is checked separately. */
+enum layout
+{
+    LAYOUT_LINEAR,
+    LAYOUT_TRACED,
+    LAYOUT_ADAPTIVE,
+    LAYOUT_COMPILED,
+    LAYOUT_IMAGE,
+
+    LAYOUT_COUNT
+};
+
+static const char *layout_names[LAYOUT_COUNT] =
+{
+    "linear",
+    "traced",
+    "adaptive",
+    "compiled",
+    "image"
+};
+
+/* The generated option table, set up for each of the layouts. */
+struct layouts
+{
+    struct dooshki_args args[LAYOUT_COUNT];
+    struct dooshki_lookup_order lookup_order;
+    struct dooshki_args_spec *spec;
+    struct dooshki_args_image image;
+    unsigned long events;
+};
+
+/* Trace hook of the traced layout, only counts the events. */
+static void count_events(const struct dooshki_args *args_ctxt,
+                         const struct dooshki_trace_event *events,
+                         unsigned int event_count,
+                         void *trace_data)
+{
+    (void)args_ctxt;
+    (void)events;
+
+    *(unsigned long *)trace_data += event_count;
+}
+
+/* Set up the layouts, returns 0 on failure. */
+static char setup_layouts(struct layouts *layouts,
+                          const struct dooshki_opt *options,
+                          unsigned long count)
+{
+    unsigned char *image_data;
+    unsigned long image_size;
+    unsigned int iter;
+
+    for (iter = 0; iter < LAYOUT_COUNT; iter++)
+    {
+        layouts->args[iter] = cli_args_context;
+        layouts->args[iter].opt_desc = options;
+    }
+    layouts->events = 0;
+    layouts->args[LAYOUT_TRACED].trace_hook = count_events;
+    layouts->args[LAYOUT_TRACED].trace_data = &layouts->events;
+
+    layouts->lookup_order.order = xmalloc(count * sizeof(unsigned int));
+    layouts->lookup_order.hits  = xmalloc(count * sizeof(unsigned long));
+    layouts->args[LAYOUT_ADAPTIVE].lookup_order = &layouts->lookup_order;
+    dooshki_args_order_reset(&layouts->args[LAYOUT_ADAPTIVE]);
+
+    layouts->spec = dooshki_args_compile(&layouts->args[LAYOUT_COMPILED]);
+    if (layouts->spec == NULL)
+        return 0;
+
+    image_size = dooshki_args_export(layouts->spec, NULL, 0);
+    image_data = xmalloc(image_size);
+    dooshki_args_export(layouts->spec, image_data, image_size);
+
+    return dooshki_args_image_open(&layouts->image, image_data, image_size);
+}
+
+/* Parse a command line with the given layout. */
+static enum dooshki_args_ret parse_layout(const struct layouts *layouts,
+                                          enum layout layout,
+                                          int *argc, char ***argv)
+{
+    switch (layout)
+    {
+        case LAYOUT_COMPILED:
+            return dooshki_args_parse_spec(argc, argv, layouts->spec);
+
+        case LAYOUT_IMAGE:
+            return dooshki_args_parse_image(argc, argv,
+                                            &layouts->args[LAYOUT_IMAGE],
+                                            &layouts->image);
+
+        default:
+            return dooshki_args_parse(argc, argv, &layouts->args[layout]);
+    }
+}
+
+/*
+ * Parse the corpus with the given layout, with the allocator armed.
+ * Returns the number of command lines the parser accepted.
+ */
+static unsigned long check_layout(const struct layouts *layouts,
+                                  enum layout layout,
+                                  const struct command_line *corpus,
+                                  unsigned long lines)
+{
+    char **work_argv = xmalloc((MAX_WORDS + 1) * sizeof(*work_argv));
+    char *empty_argv[2];
+    unsigned long accepted = 0;
+    unsigned long iter;
+    int work_argc;
+    char **parse_argv;
+
+    current_layout = layout_names[layout];
+
+    /* The first parse may compile an index, see the program description. */
+    empty_argv[0] = PROG_NAME;
+    empty_argv[1] = NULL;
+    work_argc = 1;
+    parse_argv = empty_argv;
+    parse_layout(layouts, layout, &work_argc, &parse_argv);
+
+    for (iter = 0; iter < lines; iter++)
+    {
+        if (layout == LAYOUT_COMPILED && corpus[iter].shows_help)
+            continue;
+
+        memcpy(work_argv, corpus[iter].argv,
+               (corpus[iter].argc + 1) * sizeof(*work_argv));
+        work_argc = corpus[iter].argc;
+        parse_argv = work_argv;
+        current_line = iter + 1;
+
+        armed = 1;
+        if (parse_layout(layouts, layout, &work_argc, &parse_argv) ==
+            DOOSHKI_ARGS_PARSE_OK)
+            accepted++;
+        armed = 0;
+    }
+
+    free(work_argv);
+    return accepted;
+}
+
+/*
+ * Discard what is written onto stdout and stderr, or stop doing so.
+ *
+ * Allocations are still reported onto the original stderr, through
+ * report_fd.
+ */
+static char discard_output(char discard, int *saved_stdout)
+{
+    int null_fd;
+
+    fflush(stdout);
+    if (! discard)
+    {
+        dup2(*saved_stdout, 1);
+        dup2(report_fd, 2);
+        close(*saved_stdout);
+        close(report_fd);
+        report_fd = 2;
+        return 1;
+    }
+
+    null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd < 0)
+        return 0;
+
+    *saved_stdout = dup(1);
+    report_fd = dup(2);
+    dup2(null_fd, 1);
+    dup2(null_fd, 2);
+    close(null_fd);
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    enum dooshki_args_ret arg_parse_ret;
+    struct dooshki_opt *options;
+    struct command_line *corpus;
+    struct layouts layouts;
+    unsigned long accepted[LAYOUT_COUNT];
+    void *frames[1];
+    int saved_stdout;
+    unsigned int iter;
+
+    arg_parse_ret = dooshki_args_parse(&argc, &argv, &cli_args_context);
+    switch(arg_parse_ret)
+    {
+        case DOOSHKI_ARGS_PARSE_OK:
+            break;
+
+        case DOOSHKI_ARGS_HELP_SHOWN:
+        case DOOSHKI_ARGS_VER_SHOWN:
+            return 0;
+
+        default:
+            return 1;
+    }
+    if (argc > 1)
+    {
+        fprintf(stderr, "%s: Unexpected argument `%s'.\n",
+                program_name, argv[1]);
+        dooshki_args_err_usage(&cli_args_context);
+        return 1;
+    }
+    if (option_count < 1 || option_count > 100000 || line_count < 2)
+    {
+        fprintf(stderr, "%s: The number of options has to be between 1 and "
+                "100000, and there have to be at least 2 command lines.\n",
+                program_name);
+        dooshki_args_err_usage(&cli_args_context);
+        return 1;
+    }
+
+    srand((unsigned int)seed);
+    options = generate_options(option_count);
+    corpus = generate_corpus(options, option_count, line_count);
+    if (! setup_layouts(&layouts, options, option_count))
+    {
+        fprintf(stderr, "%s: Failed to compile the option table.\n",
+                program_name);
+        return 1;
+    }
+
+    /* Loading the unwinder allocates, so it's done before the checks. */
+    backtrace(frames, 1);
+
+    /* This also sets up the stdout buffer. */
+    printf("options: %lu, command lines: %lu, seed: %lu\n\n", option_count,
+           line_count, seed);
+
+    if (! discard_output(1, &saved_stdout))
+    {
+        fprintf(stderr, "%s: Failed to open /dev/null.\n", program_name);
+        return 1;
+    }
+    for (iter = 0; iter < LAYOUT_COUNT; iter++)
+        accepted[iter] = check_layout(&layouts, (enum layout)iter, corpus,
+                                      line_count);
+    discard_output(0, &saved_stdout);
+
+    printf("%-10s %14s\n", "layout", "accepted");
+    for (iter = 0; iter < LAYOUT_COUNT; iter++)
+        printf("%-10s %14lu\n", layout_names[iter], accepted[iter]);
+
+    printf("\nNo memory was allocated while parsing.\n");
+    return 0;
+}
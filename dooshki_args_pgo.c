@@ -0,0 +1,605 @@
+/*
+ * Copyright (c) 2020 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "dooshki_args.h"
+
+#define PROG_NAME    "dooshki_args_pgo"
+#define PROG_VERSION "0.1"
+#define PROG_USAGE   "[OPTIONS] [TRACE1 [TRACE2 [...]]]"
+#define PROG_SUMMARY "Profile-guided option ordering for dooshki_args"
+
+#define PROG_DESCRIPTION \
+                         \
+"This program reads option traces written by dooshki_args_trace_write (from\n" \
+"stdin if no trace files are given), and generates C code which orders the\n" \
+"traced program's options from the most used to the least used one.\n" \
+"\n" \
+"By default, an order and a hits array are generated, to be used to\n" \
+"initialize a struct dooshki_lookup_order.  If the source file containing\n" \
+"the option table is given, the table itself is reordered, which also\n" \
+"changes the order of the help screen.\n"
+
+#define MAX_LINE_LEN 1024
+
+/* Largest option index accepted from traces when -n isn't given. */
+#define MAX_TRACED_INDEX 65535
+
+
+static const char *program_name = PROG_NAME;
+
+/* Usage of a single option, as collected from the traces. */
+struct opt_usage
+{
+    unsigned long index;
+    unsigned long uses;
+
+    char *short_name;   /* NULL if the option was never seen */
+    char *long_name;
+};
+
+static struct opt_usage *usage = NULL;
+static unsigned long usage_count = 0;
+static unsigned long traced_total = 0;
+
+/* Values retrieved from the command line. */
+static unsigned long table_size = 0;
+static char table_size_set = 0;
+
+static const char *source_path = NULL;
+static const char *table_name  = NULL;
+static const char *prefix      = NULL;
+
+static const struct dooshki_opt cli_options[] =
+{
+    { "n", "options", "COUNT", DOOSHKI_OPT_UINT, &table_size, &table_size_set,
+      "Number of options in the traced program's table, options which were "
+      "never used are placed after the used ones.  Required unless the "
+      "source file is given, as the generated arrays have to cover "
+      "the whole table.", NULL, NULL },
+
+    { "s", "source", "FILE", DOOSHKI_OPT_STR, &source_path, NULL,
+      "C source file containing the option table, to be reordered.",
+      NULL, NULL },
+
+    { "t", "table", "NAME", DOOSHKI_OPT_STR, &table_name, NULL,
+      "Name of the option table, the first `struct dooshki_opt' array found "
+      "in the source file is used by default.", NULL, NULL },
+
+    { "p", "prefix", "NAME", DOOSHKI_OPT_STR, &prefix, NULL,
+      "Prefix of the names of the generated order and hits arrays.",
+      NULL, NULL },
+
+    { NULL }
+};
+
+static struct dooshki_args cli_args_context =
+{
+    PROG_NAME,
+    PROG_VERSION,
+    PROG_USAGE,
+    PROG_SUMMARY,
+    PROG_DESCRIPTION,
+
+    cli_options,
+
+    NULL,
+    NULL, NULL,
+    NULL,
+    NULL
+};
+
+
+/* Allocate memory, terminating the program on failure. */
+static void *xrealloc(void *ptr, size_t size)
+{
+    ptr = realloc(ptr, size);
+    if (ptr == NULL)
+    {
+        fprintf(stderr, "%s: Out of memory.\n", program_name);
+        exit(1);
+    }
+    return ptr;
+}
+
+/* Make a copy of a string, with `-' standing for a missing name. */
+static char *copy_name(const char *name)
+{
+    char *copy;
+
+    if (strcmp(name, "-") == 0)
+        name = "";
+
+    copy = xrealloc(NULL, strlen(name) + 1);
+    strcpy(copy, name);
+    return copy;
+}
+
+/* Grow the usage array to cover `new_count' options. */
+static void grow_usage(unsigned long new_count)
+{
+    usage = xrealloc(usage, new_count * sizeof(*usage));
+    for (; usage_count < new_count; usage_count++)
+    {
+        usage[usage_count].index      = usage_count;
+        usage[usage_count].uses       = 0;
+        usage[usage_count].short_name = NULL;
+        usage[usage_count].long_name  = NULL;
+    }
+}
+
+/* Record a single use of an option, returns 1 on success, 0 on failure. */
+static char record_use(unsigned long index, const char *short_name,
+                       const char *long_name)
+{
+    struct opt_usage *entry;
+
+    if (index >= usage_count)
+        grow_usage(index + 1);
+
+    entry = &usage[index];
+
+    if (entry->short_name == NULL)
+    {
+        entry->short_name = copy_name(short_name);
+        entry->long_name  = copy_name(long_name);
+    }
+    else if (strcmp(entry->short_name, (strcmp(short_name, "-") == 0)?
+                                       "" : short_name) != 0 ||
+             strcmp(entry->long_name, (strcmp(long_name, "-") == 0)?
+                                      "" : long_name) != 0)
+    {
+        return 0;
+    }
+
+    entry->uses  += 1;
+    traced_total += 1;
+    return 1;
+}
+
+/* Read a trace file, returns 1 on success, 0 on failure. */
+static char read_trace(FILE *trace, const char *trace_name)
+{
+    char line[MAX_LINE_LEN];
+    char short_name[MAX_LINE_LEN];
+    char long_name[MAX_LINE_LEN];
+    unsigned long index;
+    unsigned long line_num;
+
+    for (line_num = 1; fgets(line, sizeof(line), trace) != NULL; line_num++)
+    {
+        if (sscanf(line, "%lu %s %s", &index, short_name, long_name) != 3)
+        {
+            fprintf(stderr, "%s: %s:%lu: Malformed trace entry.\n",
+                    program_name, trace_name, line_num);
+            return 0;
+        }
+        if (index >= (table_size_set? table_size : MAX_TRACED_INDEX + 1))
+        {
+            fprintf(stderr,
+                    "%s: %s:%lu: Option index %lu is out of range%s.\n",
+                    program_name, trace_name, line_num, index,
+                    table_size_set? " of the table" : ", use -n if the table "
+                    "really is that large");
+            return 0;
+        }
+        if (! record_use(index, short_name, long_name))
+        {
+            fprintf(stderr,
+                    "%s: %s:%lu: Option %lu doesn't match earlier traces, "
+                    "were they taken from different program versions?\n",
+                    program_name, trace_name, line_num, index);
+            return 0;
+        }
+    }
+    if (ferror(trace))
+    {
+        fprintf(stderr, "%s: Failed to read `%s'.\n", program_name, trace_name);
+        return 0;
+    }
+    return 1;
+}
+
+/* Comparison routine, orders options by use count, then by table index. */
+static int compare_usage(const void *in_a, const void *in_b)
+{
+    const struct opt_usage *usage_a = in_a;
+    const struct opt_usage *usage_b = in_b;
+
+    if (usage_a->uses != usage_b->uses)
+        return (usage_a->uses > usage_b->uses)? -1 : 1;
+
+    if (usage_a->index != usage_b->index)
+        return (usage_a->index < usage_b->index)? -1 : 1;
+
+    return 0;
+}
+
+/* Describe an option by its names, for use in comments. */
+static void print_opt_names(const struct opt_usage *entry)
+{
+    if (entry->short_name == NULL)
+    {
+        printf("unused");
+        return;
+    }
+    if (entry->short_name[0] != '\0')
+        printf("-%s", entry->short_name);
+
+    if (entry->short_name[0] != '\0' && entry->long_name[0] != '\0')
+        printf(", ");
+
+    if (entry->long_name[0] != '\0')
+        printf("--%s", entry->long_name);
+}
+
+/* Generate the order and hits arrays. */
+static void print_order(const struct opt_usage *sorted)
+{
+    unsigned long iter;
+
+    printf("/*\n"
+           " * Option lookup order generated by %s from %lu traced options,\n"
+           " * to be used to initialize a struct dooshki_lookup_order.\n"
+           " */\n", PROG_NAME, traced_total);
+
+    printf("static unsigned int %s_order[] =\n{\n", prefix);
+    for (iter = 0; iter < usage_count; iter++)
+    {
+        char index_text[32];
+
+        sprintf(index_text, "%lu,", sorted[iter].index);
+        printf("    %-8s/* %lu uses: ", index_text, sorted[iter].uses);
+        print_opt_names(&sorted[iter]);
+        printf(" */\n");
+    }
+    printf("};\n\n");
+
+    printf("static unsigned long %s_hits[] =\n{\n", prefix);
+    for (iter = 0; iter < usage_count; iter++)
+        printf("    %lu,\n", usage[iter].uses);
+
+    printf("};\n");
+}
+
+
+/* Read a whole file into memory, returns NULL on failure. */
+static char *read_file(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    char *data = NULL;
+    size_t data_len = 0;
+    size_t read_len;
+
+    if (file == NULL)
+    {
+        fprintf(stderr, "%s: Failed to open `%s'.\n", program_name, path);
+        return NULL;
+    }
+
+    do
+    {
+        data = xrealloc(data, data_len + MAX_LINE_LEN + 1);
+        read_len = fread(data + data_len, 1, MAX_LINE_LEN, file);
+        data_len += read_len;
+
+    } while (read_len == MAX_LINE_LEN);
+
+    if (ferror(file))
+    {
+        fprintf(stderr, "%s: Failed to read `%s'.\n", program_name, path);
+        fclose(file);
+        free(data);
+        return NULL;
+    }
+    fclose(file);
+
+    data[data_len] = '\0';
+    return data;
+}
+
+/*
+ * Skip over a comment, string or character literal starting at `pos',
+ * returns the position right after it, or `pos' if there's none.
+ */
+static size_t skip_literal(const char *src, size_t pos)
+{
+    char quote;
+
+    if (src[pos] == '/' && src[pos + 1] == '*')
+    {
+        for (pos += 2; src[pos] != '\0' &&
+                       !(src[pos] == '*' && src[pos + 1] == '/'); pos++);
+
+        return (src[pos] != '\0')? pos + 2 : pos;
+    }
+    if (src[pos] == '/' && src[pos + 1] == '/')
+    {
+        for (; src[pos] != '\0' && src[pos] != '\n'; pos++);
+        return pos;
+    }
+    if (src[pos] != '"' && src[pos] != '\'')
+        return pos;
+
+    for (quote = src[pos++]; src[pos] != '\0' && src[pos] != quote; pos++)
+    {
+        if (src[pos] == '\\' && src[pos + 1] != '\0')
+            pos += 1;
+    }
+    return (src[pos] != '\0')? pos + 1 : pos;
+}
+
+/*
+ * Locate the option table in C source code.
+ *
+ *
+ * On success, *decl_start refers to the beginning of the line containing
+ * the table's declaration, and *body_start to its opening brace.
+ */
+static char find_table(const char *src, size_t *decl_start,
+                       size_t *body_start)
+{
+    static const char type_name[] = "struct dooshki_opt";
+    size_t pos = 0;
+
+    while (src[pos] != '\0')
+    {
+        size_t next = skip_literal(src, pos);
+        size_t name_start;
+        size_t name_end;
+
+        if (next != pos)
+        {
+            pos = next;
+            continue;
+        }
+        if (strncmp(&src[pos], type_name, sizeof(type_name) - 1) != 0 ||
+            (pos > 0 && (isalnum((unsigned char)src[pos - 1]) ||
+                         src[pos - 1] == '_')))
+        {
+            pos += 1;
+            continue;
+        }
+
+        for (name_start = pos + sizeof(type_name) - 1;
+             isspace((unsigned char)src[name_start]); name_start++);
+
+        for (name_end = name_start;
+             isalnum((unsigned char)src[name_end]) || src[name_end] == '_';
+             name_end++);
+
+        pos = name_end;
+        if (name_end == name_start || src[name_end] != '[')
+            continue;
+
+        if (table_name != NULL &&
+            (strlen(table_name) != name_end - name_start ||
+             strncmp(table_name, &src[name_start], name_end - name_start) != 0))
+            continue;
+
+        for (; src[pos] != '\0' && src[pos] != ';' && src[pos] != '{'; pos++);
+        if (src[pos] != '{')
+            continue;
+
+        *body_start = pos;
+        for (*decl_start = name_start; *decl_start > 0 &&
+                                       src[*decl_start - 1] != '\n';
+             *decl_start -= 1);
+
+        if (table_name == NULL)
+        {
+            char *name = xrealloc(NULL, name_end - name_start + 1);
+
+            memcpy(name, &src[name_start], name_end - name_start);
+            name[name_end - name_start] = '\0';
+            table_name = name;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+/* Generate the reordered option table, returns 1 on success, 0 on failure. */
+static char print_reordered_table(const struct opt_usage *sorted)
+{
+    char *src = read_file(source_path);
+    size_t *entry_start = NULL;
+    size_t *entry_end = NULL;
+    size_t entry_count = 0;
+    size_t decl_start;
+    size_t pos;
+    unsigned int depth;
+    unsigned long iter;
+
+    if (src == NULL)
+        return 0;
+
+    if (! find_table(src, &decl_start, &pos))
+    {
+        fprintf(stderr, "%s: No option table%s%s found in `%s'.\n",
+                program_name, (table_name != NULL)? " named " : "",
+                (table_name != NULL)? table_name : "", source_path);
+        return 0;
+    }
+
+    /* Split the table into its entries. */
+    for (pos += 1, depth = 1; src[pos] != '\0' && depth > 0;)
+    {
+        size_t next = skip_literal(src, pos);
+
+        if (next != pos)
+        {
+            pos = next;
+            continue;
+        }
+        if (src[pos] == '{')
+        {
+            if (depth == 1)
+            {
+                entry_start = xrealloc(entry_start,
+                                       (entry_count + 1) * sizeof(size_t));
+                entry_end   = xrealloc(entry_end,
+                                       (entry_count + 1) * sizeof(size_t));
+                entry_start[entry_count] = pos;
+            }
+            depth += 1;
+        }
+        else if (src[pos] == '}')
+        {
+            depth -= 1;
+            if (depth == 1)
+                entry_end[entry_count++] = pos + 1;
+        }
+        pos += 1;
+    }
+
+    if (depth > 0 || entry_count == 0)
+    {
+        fprintf(stderr, "%s: Failed to parse option table %s in `%s'.\n",
+                program_name, table_name, source_path);
+        return 0;
+    }
+    if (usage_count > entry_count - 1)
+    {
+        fprintf(stderr,
+                "%s: The traces refer to %lu options, but table %s in `%s' "
+                "only has %lu.\n", program_name, usage_count, table_name,
+                source_path, (unsigned long)(entry_count - 1));
+        return 0;
+    }
+
+    printf("/*\n"
+           " * %s reordered by %s from %lu traced options,\n"
+           " * the most used options are listed first.\n"
+           " */\n", table_name, PROG_NAME, traced_total);
+    fwrite(&src[decl_start], 1, entry_start[0] - decl_start, stdout);
+
+    /* Used options, then the unused ones in their original order. */
+    for (iter = 0; iter < usage_count && sorted[iter].uses > 0; iter++)
+    {
+        pos = sorted[iter].index;
+        fwrite(&src[entry_start[pos]], 1, entry_end[pos] - entry_start[pos],
+               stdout);
+        printf(",\n\n    ");
+    }
+    for (pos = 0; pos < entry_count - 1; pos++)
+    {
+        if (pos < usage_count && usage[pos].uses > 0)
+            continue;
+
+        fwrite(&src[entry_start[pos]], 1, entry_end[pos] - entry_start[pos],
+               stdout);
+        printf(",\n\n    ");
+    }
+    fwrite(&src[entry_start[pos]], 1, entry_end[pos] - entry_start[pos],
+           stdout);
+    printf("\n};\n");
+
+    free(entry_start);
+    free(entry_end);
+    free(src);
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    enum dooshki_args_ret arg_parse_ret;
+    struct opt_usage *sorted;
+    char retval;
+
+    arg_parse_ret = dooshki_args_parse(&argc, &argv, &cli_args_context);
+    switch(arg_parse_ret)
+    {
+        case DOOSHKI_ARGS_PARSE_OK:
+            break;
+
+        case DOOSHKI_ARGS_HELP_SHOWN:
+        case DOOSHKI_ARGS_VER_SHOWN:
+            return 0;
+
+        default:
+            return 1;
+    }
+
+    if (argc > 1)
+    {
+        int iter;
+
+        for (iter = 1; iter < argc; iter++)
+        {
+            FILE *trace = fopen(argv[iter], "r");
+
+            if (trace == NULL)
+            {
+                fprintf(stderr, "%s: Failed to open `%s'.\n",
+                        program_name, argv[iter]);
+                return 1;
+            }
+            retval = read_trace(trace, argv[iter]);
+            fclose(trace);
+
+            if (!retval)
+                return 1;
+        }
+    }
+    else if (! read_trace(stdin, "stdin"))
+        return 1;
+
+    /*
+     * The lookup order has to cover every option of the table, the traces
+     * only tell how far the used ones go.
+     */
+    if (source_path == NULL && ! table_size_set)
+    {
+        fprintf(stderr, "%s: The number of options in the table has to be "
+                "given (-n) to generate the lookup order.\n", program_name);
+        dooshki_args_err_usage(&cli_args_context);
+        return 1;
+    }
+
+    if (table_size_set)
+    {
+        if (table_size < usage_count)
+        {
+            fprintf(stderr,
+                    "%s: The traces refer to %lu options, but only %lu were "
+                    "specified.\n", program_name, usage_count, table_size);
+            return 1;
+        }
+        if (table_size > usage_count)
+            grow_usage(table_size);
+    }
+
+    sorted = xrealloc(NULL, (usage_count + 1) * sizeof(*sorted));
+    if (usage_count > 0)
+        memcpy(sorted, usage, usage_count * sizeof(*sorted));
+    qsort(sorted, usage_count, sizeof(*sorted), compare_usage);
+
+    if (source_path != NULL)
+        retval = print_reordered_table(sorted);
+    else
+    {
+        if (prefix == NULL)
+            prefix = (table_name != NULL)? table_name : "cli_options";
+
+        print_order(sorted);
+        retval = 1;
+    }
+
+    return retval? 0 : 1;
+}
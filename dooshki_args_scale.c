@@ -0,0 +1,481 @@
+/*
+ * Copyright (c) 2020 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "dooshki_args.h"
+
+#define PROG_NAME    "dooshki_args_scale"
+#define PROG_VERSION "0.1"
+#define PROG_USAGE   "[OPTIONS]"
+#define PROG_SUMMARY "Complexity check of the dooshki_args library"
+
+#define PROG_DESCRIPTION \
+                         \
+"This program parses adversarial command lines of geometrically growing\n" \
+"size, such as long runs of options whose arguments leave holes in argv,\n" \
+"huge clusters of short options and very long words, and fits the time\n" \
+"taken to a power of the size.  It fails if any of them grows faster than\n" \
+"the allowed exponent, which should be close to 1 for linear growth.\n"
+
+
+static const char *program_name = PROG_NAME;
+
+/* Values retrieved from the command line. */
+static unsigned long base_size = 1024;
+static unsigned long steps = 6;
+static unsigned long min_time_ms = 20;
+static double max_exponent = 1.25;
+
+static const struct dooshki_opt cli_options[] =
+{
+    { "b", "base", "WORDS", DOOSHKI_OPT_UINT, &base_size, NULL,
+      "Size of the smallest command lines, in words or characters "
+      "(default: 1024).", NULL, NULL },
+
+    { "k", "steps", "COUNT", DOOSHKI_OPT_UINT, &steps, NULL,
+      "Number of times the size is doubled (default: 6).", NULL, NULL },
+
+    { "m", "min-time", "MS", DOOSHKI_OPT_UINT, &min_time_ms, NULL,
+      "Minimum time spent measuring each size, in milliseconds "
+      "(default: 20).", NULL, NULL },
+
+    { "e", "max-exponent", "EXP", DOOSHKI_OPT_FLOAT, &max_exponent, NULL,
+      "Largest allowed growth exponent (default: 1.25).", NULL, NULL },
+
+    { NULL }
+};
+
+static struct dooshki_args cli_args_context =
+{
+    PROG_NAME,
+    PROG_VERSION,
+    PROG_USAGE,
+    PROG_SUMMARY,
+    PROG_DESCRIPTION,
+
+    cli_options,
+
+    NULL,
+    NULL, NULL,
+    NULL,
+    NULL
+};
+
+
+/* Storage of the options parsed by the scenarios. */
+static char flag_value;
+static const char *str_value;
+static long int_value;
+
+static const struct dooshki_opt scale_options[] =
+{
+    { "f", "flag", NULL, DOOSHKI_OPT_BOOL, &flag_value, NULL,
+      "Flag.", NULL, NULL },
+
+    { "s", "string", "TEXT", DOOSHKI_OPT_STR, &str_value, NULL,
+      "String.", NULL, NULL },
+
+    { "n", "number", "N", DOOSHKI_OPT_INT, &int_value, NULL,
+      "Number.", NULL, NULL },
+
+    { NULL, "string-list", "TEXT", DOOSHKI_OPT_STR, &str_value, NULL,
+      "Another string.", NULL, NULL },
+
+    { NULL }
+};
+
+/*
+ * A generated command line.
+ *
+ * Its size is the number of words, or the number of characters for scenarios
+ * built around a single long word, which is then allocated as `text'.
+ */
+struct command_line
+{
+    int argc;
+    char **argv;
+    char *text;
+};
+
+/* Generator of a scenario's command line of the given size. */
+typedef void (*generate_fn)(struct command_line *line, unsigned long size);
+
+struct scenario
+{
+    const char *name;
+    generate_fn generate;
+};
+
+/* Allocate memory, terminating the program on failure. */
+static void *xmalloc(size_t size)
+{
+    void *ptr = malloc((size > 0)? size : 1);
+
+    if (ptr == NULL)
+    {
+        fprintf(stderr, "%s: Out of memory.\n", program_name);
+        exit(1);
+    }
+    return ptr;
+}
+
+/* Set up a command line of `words' words, with no long word. */
+static void alloc_words(struct command_line *line, unsigned long words)
+{
+    line->argc = (int)words + 1;
+    line->argv = xmalloc((words + 2) * sizeof(*line->argv));
+    line->text = NULL;
+
+    line->argv[0] = PROG_NAME;
+    line->argv[words + 1] = NULL;
+}
+
+/*
+ * Options with their arguments in separate words, followed by as many
+ * positional arguments, so that every option leaves a hole in argv before
+ * the positional arguments which have to be moved over it.
+ */
+static void generate_holes(struct command_line *line, unsigned long size)
+{
+    unsigned long iter;
+
+    alloc_words(line, size);
+    for (iter = 0; iter < size; iter++)
+    {
+        if (iter < size / 2)
+            line->argv[iter + 1] = (iter % 2 == 0)? "-s" : "value";
+        else
+            line->argv[iter + 1] = "positional";
+    }
+}
+
+/*
+ * Fill a command line of `size' words by repeating a pattern of `length'
+ * words, an incomplete repetition at the end is replaced with positional
+ * arguments so that no option is left without its argument.
+ */
+static void fill_pattern(struct command_line *line, unsigned long size,
+                         char *const *pattern, unsigned long length)
+{
+    unsigned long iter;
+
+    alloc_words(line, size);
+    for (iter = 0; iter < size; iter++)
+    {
+        if (iter - iter % length + length > size)
+            line->argv[iter + 1] = "positional";
+        else
+            line->argv[iter + 1] = pattern[iter % length];
+    }
+}
+
+/* Positional arguments and options taking separate arguments, alternating. */
+static void generate_interleaved(struct command_line *line, unsigned long size)
+{
+    static char *const pattern[] = { "positional", "--string", "value",
+                                     "positional", "-n", "42" };
+
+    fill_pattern(line, size, pattern, sizeof(pattern) / sizeof(pattern[0]));
+}
+
+/* Abbreviated long options, each of which has to be resolved. */
+static void generate_abbreviations(struct command_line *line,
+                                   unsigned long size)
+{
+    static char *const pattern[] = { "--fl", "--str=value", "--num", "7",
+                                     "--string-l", "value" };
+
+    fill_pattern(line, size, pattern, sizeof(pattern) / sizeof(pattern[0]));
+}
+
+/* A stopper followed by positional arguments, some looking like options. */
+static void generate_stopper(struct command_line *line, unsigned long size)
+{
+    unsigned long iter;
+
+    alloc_words(line, size);
+    line->argv[1] = "--";
+    for (iter = 1; iter < size; iter++)
+        line->argv[iter + 1] = (iter % 2 == 0)? "-f" : "positional";
+}
+
+/* A single cluster of `size' short options. */
+static void generate_cluster(struct command_line *line, unsigned long size)
+{
+    alloc_words(line, 1);
+    line->text = xmalloc(size + 2);
+    line->text[0] = '-';
+    memset(&line->text[1], 'f', size);
+    line->text[size + 1] = '\0';
+    line->argv[1] = line->text;
+}
+
+/* A single long option with an argument `size' characters long. */
+static void generate_long_argument(struct command_line *line,
+                                   unsigned long size)
+{
+    alloc_words(line, 1);
+    line->text = xmalloc(size + sizeof("--string="));
+    strcpy(line->text, "--string=");
+    memset(&line->text[sizeof("--string=") - 1], 'x', size);
+    line->text[sizeof("--string=") - 1 + size] = '\0';
+    line->argv[1] = line->text;
+}
+
+/*
+ * A single cluster of `size' short options with the last one taking
+ * the next word as its argument.
+ */
+static void generate_cluster_argument(struct command_line *line,
+                                      unsigned long size)
+{
+    char *text;
+
+    generate_cluster(line, size);
+    text = line->text;
+    text[size] = 's';
+
+    free(line->argv);
+    alloc_words(line, 2);
+    line->text = text;
+    line->argv[1] = text;
+    line->argv[2] = "value";
+}
+
+static const struct scenario scenarios[] =
+{
+    { "holes",              generate_holes },
+    { "interleaved",        generate_interleaved },
+    { "abbreviations",      generate_abbreviations },
+    { "stopper",            generate_stopper },
+    { "cluster",            generate_cluster },
+    { "cluster-argument",   generate_cluster_argument },
+    { "long-argument",      generate_long_argument }
+};
+#define SCENARIO_COUNT (sizeof(scenarios) / sizeof(scenarios[0]))
+
+/* Release a generated command line. */
+static void free_command_line(struct command_line *line)
+{
+    free(line->argv);
+    free(line->text);
+}
+
+/*
+ * Measure how long it takes to parse a command line, returns the time
+ * of a single parse in seconds.
+ *
+ * The command line is parsed for at least min_time_ms milliseconds,
+ * three times over, and the fastest of the three results is used.
+ */
+static double time_parsing(const struct dooshki_args *args_ctxt,
+                           const struct dooshki_args_spec *spec,
+                           const struct command_line *line)
+{
+    char **work_argv = xmalloc((line->argc + 1) * sizeof(*work_argv));
+    double min_time = min_time_ms / 1000.0;
+    double best = -1.0;
+    double seconds;
+    unsigned long parses;
+    unsigned int attempt;
+    clock_t start;
+
+    for (attempt = 0; attempt < 3; attempt++)
+    {
+        parses = 0;
+        start = clock();
+        do
+        {
+            int work_argc = line->argc;
+            char **parse_argv = work_argv;
+            enum dooshki_args_ret ret;
+
+            memcpy(work_argv, line->argv,
+                   (line->argc + 1) * sizeof(*work_argv));
+
+            if (spec != NULL)
+                ret = dooshki_args_parse_spec(&work_argc, &parse_argv, spec);
+            else
+                ret = dooshki_args_parse(&work_argc, &parse_argv, args_ctxt);
+
+            if (ret != DOOSHKI_ARGS_PARSE_OK)
+            {
+                fprintf(stderr, "%s: Failed to parse a generated command "
+                        "line.\n", program_name);
+                exit(1);
+            }
+            parses++;
+            seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+        }
+        while (seconds < min_time);
+
+        seconds /= parses;
+        if (best < 0.0 || seconds < best)
+            best = seconds;
+    }
+
+    free(work_argv);
+    return best;
+}
+
+/*
+ * Fit times to a power of the sizes, returns the exponent.
+ *
+ * The slope of the least squares line through the points in log-log scale.
+ */
+static double fit_exponent(const double *sizes, const double *times,
+                           unsigned long count)
+{
+    double mean_x = 0.0;
+    double mean_y = 0.0;
+    double covariance = 0.0;
+    double variance = 0.0;
+    unsigned long iter;
+
+    for (iter = 0; iter < count; iter++)
+    {
+        mean_x += log(sizes[iter]);
+        mean_y += log(times[iter]);
+    }
+    mean_x /= count;
+    mean_y /= count;
+
+    for (iter = 0; iter < count; iter++)
+    {
+        double dist_x = log(sizes[iter]) - mean_x;
+
+        covariance += dist_x * (log(times[iter]) - mean_y);
+        variance   += dist_x * dist_x;
+    }
+    return covariance / variance;
+}
+
+/*
+ * Measure a scenario with the given layout (spec may be NULL), returns 1
+ * if its growth is within the allowed exponent.
+ */
+static char check_scenario(const struct scenario *scenario,
+                           const char *layout,
+                           const struct dooshki_args *args_ctxt,
+                           const struct dooshki_args_spec *spec,
+                           double *sizes, double *times)
+{
+    struct command_line line;
+    unsigned long size = base_size;
+    unsigned long iter;
+    double exponent;
+    char passed;
+
+    for (iter = 0; iter <= steps; iter++, size *= 2)
+    {
+        scenario->generate(&line, size);
+        sizes[iter] = (double)size;
+        times[iter] = time_parsing(args_ctxt, spec, &line);
+        free_command_line(&line);
+    }
+    exponent = fit_exponent(sizes, times, steps + 1);
+    passed = (exponent <= max_exponent);
+
+    printf("%-18s %-10s %14.1f %14.1f %10.2f   %s\n", scenario->name, layout,
+           times[0] * 1e9 / sizes[0], times[steps] * 1e9 / sizes[steps],
+           exponent, passed? "ok" : "FAILED");
+
+    return passed;
+}
+
+int main(int argc, char **argv)
+{
+    enum dooshki_args_ret arg_parse_ret;
+    struct dooshki_args scale_args;
+    struct dooshki_args_spec *spec;
+    double *sizes;
+    double *times;
+    unsigned int iter;
+    char passed = 1;
+
+    arg_parse_ret = dooshki_args_parse(&argc, &argv, &cli_args_context);
+    switch(arg_parse_ret)
+    {
+        case DOOSHKI_ARGS_PARSE_OK:
+            break;
+
+        case DOOSHKI_ARGS_HELP_SHOWN:
+        case DOOSHKI_ARGS_VER_SHOWN:
+            return 0;
+
+        default:
+            return 1;
+    }
+    if (argc > 1)
+    {
+        fprintf(stderr, "%s: Unexpected argument `%s'.\n",
+                program_name, argv[1]);
+        dooshki_args_err_usage(&cli_args_context);
+        return 1;
+    }
+    if (base_size < 2 || steps < 2 || steps > 16)
+    {
+        fprintf(stderr, "%s: The base size has to be at least 2, and the "
+                "number of steps between 2 and 16.\n", program_name);
+        dooshki_args_err_usage(&cli_args_context);
+        return 1;
+    }
+
+    scale_args = cli_args_context;
+    scale_args.opt_desc = scale_options;
+
+    spec = dooshki_args_compile(&scale_args);
+    if (spec == NULL)
+    {
+        fprintf(stderr, "%s: Failed to compile the option table.\n",
+                program_name);
+        return 1;
+    }
+
+    sizes = xmalloc((steps + 1) * sizeof(*sizes));
+    times = xmalloc((steps + 1) * sizeof(*times));
+
+    printf("sizes: %lu to %lu, allowed exponent: %.2f\n\n", base_size,
+           base_size << steps, max_exponent);
+    printf("%-18s %-10s %14s %14s %10s\n", "scenario", "layout",
+           "ns/unit min", "ns/unit max", "exponent");
+
+    for (iter = 0; iter < SCENARIO_COUNT; iter++)
+    {
+        if (! check_scenario(&scenarios[iter], "linear", &scale_args, NULL,
+                             sizes, times))
+            passed = 0;
+
+        if (! check_scenario(&scenarios[iter], "compiled", &scale_args, spec,
+                             sizes, times))
+            passed = 0;
+    }
+
+    dooshki_args_spec_free(spec);
+    free(sizes);
+    free(times);
+
+    if (! passed)
+    {
+        fprintf(stderr, "\n%s: Parsing time grows faster than allowed.\n",
+                program_name);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,607 @@
+/*
+ * Copyright (c) 2020 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include "dooshki_args.h"
+
+#define PROG_NAME    "dooshki_args_sigcheck"
+#define PROG_VERSION "0.1"
+#define PROG_USAGE   "[OPTIONS]"
+#define PROG_SUMMARY "Async-signal-safety check of the dooshki_args library"
+
+#define PROG_DESCRIPTION \
+                         \
+"This program is linked with a DOOSHKI_ARGS_SIGSAFE build of the library\n" \
+"and with stubs of the C library routines it must not call while parsing,\n" \
+"such as strtod, malloc, getenv, printf and setlocale, which abort when\n" \
+"called.  It parses a set of command lines, valid and erroneous, with\n" \
+"every lookup layout, both normally and from a signal handler, and also\n" \
+"fails if any of them is parsed with an unexpected result.\n"
+
+
+/* Maximum number of words of a checked command line. */
+#define MAX_WORDS 12
+
+static const char *program_name = PROG_NAME;
+
+/* Values retrieved from the command line. */
+static unsigned long repeat = 100;
+
+static const struct dooshki_opt cli_options[] =
+{
+    { "r", "repeat", "COUNT", DOOSHKI_OPT_UINT, &repeat, NULL,
+      "Number of times the command lines are parsed (default: 100).",
+      NULL, NULL },
+
+    { NULL }
+};
+
+static struct dooshki_args cli_args_context =
+{
+    PROG_NAME,
+    PROG_VERSION,
+    PROG_USAGE,
+    PROG_SUMMARY,
+    PROG_DESCRIPTION,
+
+    cli_options,
+
+    NULL,
+    NULL, NULL,
+    NULL,
+    NULL
+};
+
+
+/*
+ * Stubs of the C library.
+ *
+ * Neither the library's parse path nor this program may call any of these,
+ * a call is reported and the program aborts.  The allocator is also used
+ * by the C library itself, so it's only stubbed out while parsing, and
+ * forwards to glibc's own allocator otherwise.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+/* Set while the parser runs. */
+static volatile sig_atomic_t armed = 0;
+
+/* Where results are reported, stdout and stderr are discarded meanwhile. */
+static int report_fd = 2;
+
+/* Write a string onto the report descriptor. */
+static void report_text(const char *text)
+{
+    size_t length = strlen(text);
+    ssize_t written;
+
+    while (length > 0)
+    {
+        written = write(report_fd, text, length);
+        if (written <= 0)
+            return;
+
+        text   += written;
+        length -= (size_t)written;
+    }
+}
+
+/* Write a number onto the report descriptor. */
+static void report_number(unsigned long number)
+{
+    char digits[32];
+    unsigned int pos = sizeof(digits) - 1;
+
+    digits[pos] = '\0';
+    do
+    {
+        digits[--pos] = (char)('0' + number % 10);
+        number /= 10;
+    }
+    while (number > 0);
+
+    report_text(&digits[pos]);
+}
+
+/* Report a call of a stubbed routine, and abort. */
+static void stub_called(const char *routine)
+{
+    report_text(program_name);
+    report_text(": ");
+    report_text(routine);
+    report_text("() called, which isn't async-signal-safe.\n");
+    abort();
+}
+
+double strtod(const char *text, char **end)
+{
+    (void)text;
+    (void)end;
+    stub_called("strtod");
+    return 0.0;
+}
+
+long strtol(const char *text, char **end, int base)
+{
+    (void)text;
+    (void)end;
+    (void)base;
+    stub_called("strtol");
+    return 0;
+}
+
+unsigned long strtoul(const char *text, char **end, int base)
+{
+    (void)text;
+    (void)end;
+    (void)base;
+    stub_called("strtoul");
+    return 0;
+}
+
+double atof(const char *text)
+{
+    (void)text;
+    stub_called("atof");
+    return 0.0;
+}
+
+int atoi(const char *text)
+{
+    (void)text;
+    stub_called("atoi");
+    return 0;
+}
+
+long atol(const char *text)
+{
+    (void)text;
+    stub_called("atol");
+    return 0;
+}
+
+char *getenv(const char *name)
+{
+    (void)name;
+    stub_called("getenv");
+    return NULL;
+}
+
+char *strerror(int error)
+{
+    (void)error;
+    stub_called("strerror");
+    return NULL;
+}
+
+char *setlocale(int category, const char *locale)
+{
+    (void)category;
+    (void)locale;
+    stub_called("setlocale");
+    return NULL;
+}
+
+struct lconv *localeconv(void)
+{
+    stub_called("localeconv");
+    return NULL;
+}
+
+int printf(const char *format, ...)
+{
+    (void)format;
+    stub_called("printf");
+    return 0;
+}
+
+int fprintf(FILE *stream, const char *format, ...)
+{
+    (void)stream;
+    (void)format;
+    stub_called("fprintf");
+    return 0;
+}
+
+int sprintf(char *buffer, const char *format, ...)
+{
+    (void)buffer;
+    (void)format;
+    stub_called("sprintf");
+    return 0;
+}
+
+int vprintf(const char *format, va_list args)
+{
+    (void)format;
+    (void)args;
+    stub_called("vprintf");
+    return 0;
+}
+
+int vfprintf(FILE *stream, const char *format, va_list args)
+{
+    (void)stream;
+    (void)format;
+    (void)args;
+    stub_called("vfprintf");
+    return 0;
+}
+
+int vsprintf(char *buffer, const char *format, va_list args)
+{
+    (void)buffer;
+    (void)format;
+    (void)args;
+    stub_called("vsprintf");
+    return 0;
+}
+
+int fputs(const char *text, FILE *stream)
+{
+    (void)text;
+    (void)stream;
+    stub_called("fputs");
+    return 0;
+}
+
+int puts(const char *text)
+{
+    (void)text;
+    stub_called("puts");
+    return 0;
+}
+
+int fputc(int character, FILE *stream)
+{
+    (void)character;
+    (void)stream;
+    stub_called("fputc");
+    return 0;
+}
+
+size_t fwrite(const void *data, size_t size, size_t count, FILE *stream)
+{
+    (void)data;
+    (void)size;
+    (void)count;
+    (void)stream;
+    stub_called("fwrite");
+    return 0;
+}
+
+int fflush(FILE *stream)
+{
+    (void)stream;
+    stub_called("fflush");
+    return 0;
+}
+
+void *malloc(size_t size)
+{
+    if (armed)
+        stub_called("malloc");
+
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    if (armed)
+        stub_called("calloc");
+
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if (armed)
+        stub_called("realloc");
+
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    if (armed && ptr != NULL)
+        stub_called("free");
+
+    __libc_free(ptr);
+}
+
+
+/* Storage of the options parsed by the checked command lines. */
+static char flag_value;
+static const char *str_value;
+static long int_value;
+static unsigned long uint_value;
+static double float_value;
+
+/* Callback of the checked options, refuses arguments starting with `!'. */
+static char check_argument(const char *argument_text, void *opt_storage,
+                           const char *opt_prefix, const char *opt_name,
+                           void *callback_data)
+{
+    (void)opt_storage;
+    (void)opt_prefix;
+    (void)opt_name;
+    (void)callback_data;
+
+    return (argument_text == NULL || argument_text[0] != '!');
+}
+
+static const struct dooshki_opt check_options[] =
+{
+    { "f", "flag", NULL, DOOSHKI_OPT_BOOL, &flag_value, NULL,
+      "Flag.", NULL, NULL },
+
+    { "q", "quiet", NULL, DOOSHKI_OPT_NEGBOOL, &flag_value, NULL,
+      "Negated flag.", NULL, NULL },
+
+    { "s", "string", "TEXT", DOOSHKI_OPT_STR, &str_value, NULL,
+      "String.", NULL, NULL },
+
+    { "n", "number", "N", DOOSHKI_OPT_INT, &int_value, NULL,
+      "Number.", NULL, NULL },
+
+    { "u", "unsigned", "N", DOOSHKI_OPT_UINT, &uint_value, NULL,
+      "Unsigned number.", NULL, NULL },
+
+    { "x", "real", "X", DOOSHKI_OPT_FLOAT, &float_value, NULL,
+      "Real number.", NULL, NULL },
+
+    { "c", "callback", "ARG", DOOSHKI_OPT_CB, NULL, NULL,
+      "Callback.", check_argument, NULL },
+
+    { NULL, "callback-noarg", NULL, DOOSHKI_OPT_CB_NOARG, NULL, NULL,
+      "Callback without an argument.", check_argument, NULL },
+
+    { NULL }
+};
+#define CHECK_OPT_COUNT (sizeof(check_options) / sizeof(check_options[0]) - 1)
+
+/* A checked command line, without the program name. */
+struct check_line
+{
+    char *words[MAX_WORDS];
+    enum dooshki_args_ret expected;
+};
+
+static struct check_line check_lines[] =
+{
+    { { "-f", "--string=text", "-n", "-42", "--unsigned", "42", "--real",
+        "2.5e3", "positional", NULL }, DOOSHKI_ARGS_PARSE_OK },
+    { { "-fqs", "text", "-x1e-300", "--num=2147483647", "--callback=value",
+        "--callback-noarg", NULL }, DOOSHKI_ARGS_PARSE_OK },
+    { { "positional", "--", "-f", "--unknown", NULL }, DOOSHKI_ARGS_PARSE_OK },
+    { { "-x", "0.1", "--real=-.5E+2", "-u0", "-n", "+7", NULL },
+      DOOSHKI_ARGS_PARSE_OK },
+    { { "--unknown", NULL }, DOOSHKI_ARGS_PARSE_ERROR },
+    { { "-fz", NULL }, DOOSHKI_ARGS_PARSE_ERROR },
+    { { "--string", NULL }, DOOSHKI_ARGS_PARSE_ERROR },
+    { { "--number=12x", NULL }, DOOSHKI_ARGS_PARSE_ERROR },
+    { { "--number=99999999999999999999999", NULL },
+      DOOSHKI_ARGS_PARSE_ERROR },
+    { { "--unsigned=-1", NULL }, DOOSHKI_ARGS_PARSE_ERROR },
+    { { "--real=1.5.5", NULL }, DOOSHKI_ARGS_PARSE_ERROR },
+    { { "--real=0x1p3", NULL }, DOOSHKI_ARGS_PARSE_ERROR },
+    { { "--real=1e400", NULL }, DOOSHKI_ARGS_PARSE_ERROR },
+    { { "--callback=!value", NULL }, DOOSHKI_ARGS_PARSE_ERROR },
+    { { "--flag=yes", NULL }, DOOSHKI_ARGS_PARSE_ERROR },
+    { { "--help", NULL }, DOOSHKI_ARGS_HELP_SHOWN },
+    { { "-V", NULL }, DOOSHKI_ARGS_VER_SHOWN }
+};
+#define CHECK_LINE_COUNT (sizeof(check_lines) / sizeof(check_lines[0]))
+
+
+/* Ways of looking up the options, each is checked separately. */
+enum layout
+{
+    LAYOUT_LINEAR,
+    LAYOUT_COMPILED,
+    LAYOUT_IMAGE,
+
+    LAYOUT_COUNT
+};
+
+static const char *layout_names[LAYOUT_COUNT] =
+{
+    "linear",
+    "compiled",
+    "image"
+};
+
+static struct dooshki_args check_args;
+static struct dooshki_args_spec check_spec;
+static unsigned long check_spec_storage[
+                                DOOSHKI_ARGS_SPEC_STORAGE(CHECK_OPT_COUNT)];
+static unsigned char check_image_data[8192];
+static struct dooshki_args_image check_image;
+
+/* Number of mismatched results, and of command lines parsed. */
+static volatile unsigned long mismatches = 0;
+static volatile unsigned long parses = 0;
+
+/* Parse a command line with the given layout. */
+static enum dooshki_args_ret parse_layout(enum layout layout,
+                                          int *argc, char ***argv)
+{
+    switch (layout)
+    {
+        case LAYOUT_COMPILED:
+            return dooshki_args_parse_spec(argc, argv, &check_spec);
+
+        case LAYOUT_IMAGE:
+            return dooshki_args_parse_image(argc, argv, &check_args,
+                                            &check_image);
+
+        default:
+            return dooshki_args_parse(argc, argv, &check_args);
+    }
+}
+
+/*
+ * Parse all of the command lines with every layout, reporting those which
+ * give unexpected results.  Only async-signal-safe, as it's also run from
+ * a signal handler.
+ */
+static void parse_all(const char *context)
+{
+    char *work_argv[MAX_WORDS + 2];
+    char **parse_argv;
+    int work_argc;
+    enum dooshki_args_ret ret;
+    unsigned int layout;
+    unsigned int iter;
+
+    for (layout = 0; layout < LAYOUT_COUNT; layout++)
+    {
+        for (iter = 0; iter < CHECK_LINE_COUNT; iter++)
+        {
+            work_argv[0] = PROG_NAME;
+            for (work_argc = 1; check_lines[iter].words[work_argc - 1] != NULL;
+                 work_argc++)
+                work_argv[work_argc] = check_lines[iter].words[work_argc - 1];
+            work_argv[work_argc] = NULL;
+            parse_argv = work_argv;
+
+            armed = 1;
+            ret = parse_layout((enum layout)layout, &work_argc, &parse_argv);
+            armed = 0;
+
+            parses++;
+            if (ret != check_lines[iter].expected)
+            {
+                report_text(program_name);
+                report_text(": Command line ");
+                report_number(iter + 1);
+                report_text(" parsed with an unexpected result, with the ");
+                report_text(layout_names[layout]);
+                report_text(" layout, ");
+                report_text(context);
+                report_text(".\n");
+                mismatches++;
+            }
+        }
+    }
+}
+
+static void parse_in_handler(int signal_number)
+{
+    (void)signal_number;
+    parse_all("in a signal handler");
+}
+
+/*
+ * Discard what is written onto stdout and stderr, reports still go
+ * to the original stderr through report_fd.
+ */
+static char discard_output(void)
+{
+    int null_fd = open("/dev/null", O_WRONLY);
+
+    if (null_fd < 0)
+        return 0;
+
+    report_fd = dup(2);
+    dup2(null_fd, 1);
+    dup2(null_fd, 2);
+    close(null_fd);
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    enum dooshki_args_ret arg_parse_ret;
+    struct sigaction action;
+    unsigned long image_size;
+    unsigned long iter;
+
+    arg_parse_ret = dooshki_args_parse(&argc, &argv, &cli_args_context);
+    switch(arg_parse_ret)
+    {
+        case DOOSHKI_ARGS_PARSE_OK:
+            break;
+
+        case DOOSHKI_ARGS_HELP_SHOWN:
+        case DOOSHKI_ARGS_VER_SHOWN:
+            return 0;
+
+        default:
+            return 1;
+    }
+    if (argc > 1)
+    {
+        report_text(program_name);
+        report_text(": Unexpected argument `");
+        report_text(argv[1]);
+        report_text("'.\n");
+        dooshki_args_err_usage(&cli_args_context);
+        return 1;
+    }
+
+    check_args = cli_args_context;
+    check_args.opt_desc = check_options;
+
+    if (! dooshki_args_compile_into(&check_spec, &check_args,
+                                    check_spec_storage,
+                                    sizeof(check_spec_storage) /
+                                    sizeof(check_spec_storage[0])) ||
+        (image_size = dooshki_args_export(&check_spec, NULL, 0)) >
+        sizeof(check_image_data))
+    {
+        report_text(program_name);
+        report_text(": Failed to compile the option table.\n");
+        return 1;
+    }
+    dooshki_args_export(&check_spec, check_image_data, image_size);
+    dooshki_args_image_open(&check_image, check_image_data, image_size);
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = parse_in_handler;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGUSR1, &action, NULL) != 0 || ! discard_output())
+    {
+        report_text(program_name);
+        report_text(": Failed to set up the check.\n");
+        return 1;
+    }
+
+    for (iter = 0; iter < repeat; iter++)
+    {
+        parse_all("normally");
+        raise(SIGUSR1);
+    }
+
+    report_text("command lines parsed: ");
+    report_number(parses);
+    report_text(", with unexpected results: ");
+    report_number(mismatches);
+    report_text("\n");
+
+    return (mismatches == 0)? 0 : 1;
+}
@@ -0,0 +1,492 @@
+/*
+ * Copyright (c) 2020 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#define _POSIX_C_SOURCE 200112L
+
+/* syscall(), needed for perf_event_open. */
+#ifdef __linux__
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#include "dooshki_args.h"
+
+#define PROG_NAME    "dooshki_args_startup"
+#define PROG_VERSION "0.1"
+#define PROG_USAGE   "[OPTIONS] [-- PROGRAM [ARGUMENTS]]"
+#define PROG_SUMMARY "Process startup benchmark of the dooshki_args library"
+
+#define PROG_DESCRIPTION \
+                         \
+"This program repeatedly runs a program using the dooshki_args library\n" \
+"and reports the median and the 99th percentile of the time it takes and,\n" \
+"on Linux, of the cycles, instructions and cache misses it takes.\n" \
+"\n" \
+"By default, dooshki_args_demo_startup is run with a typical command line,\n" \
+"a build of the demo which reports when its command line is parsed, which\n" \
+"ends the measurement.  For other programs, it ends when they exit.\n"
+
+/* The program run by default, and its command line. */
+#define DEFAULT_PROGRAM "./dooshki_args_demo_startup"
+
+/*
+ * Names the descriptor to which dooshki_args_demo_startup reports the end
+ * of its startup, see run_once().
+ */
+#define STARTUP_FD_ENV_VAR "DOOSHKI_ARGS_DEMO_STARTUP_FD"
+
+static char *default_argv[] =
+{
+    DEFAULT_PROGRAM, "-a", "--label=projectile", "-r", "0.75",
+    "--direction", "-30", "-p", "120", "-vv", "--quality", "ugly",
+    "first.dat", "second.dat", NULL
+};
+
+
+static const char *program_name = PROG_NAME;
+
+/* Values retrieved from the command line. */
+static unsigned long runs = 1000;
+static unsigned long warmup_runs = 20;
+
+static const struct dooshki_opt cli_options[] =
+{
+    { "n", "runs", "COUNT", DOOSHKI_OPT_UINT, &runs, NULL,
+      "Number of measured runs (default: 1000).", NULL, NULL },
+
+    { "w", "warmup", "COUNT", DOOSHKI_OPT_UINT, &warmup_runs, NULL,
+      "Number of runs done before the measurement, to fill the caches "
+      "(default: 20).", NULL, NULL },
+
+    { NULL }
+};
+
+static struct dooshki_args cli_args_context =
+{
+    PROG_NAME,
+    PROG_VERSION,
+    PROG_USAGE,
+    PROG_SUMMARY,
+    PROG_DESCRIPTION,
+
+    cli_options,
+
+    NULL,
+    NULL, NULL,
+    NULL,
+    NULL
+};
+
+
+/* Measured quantities. */
+enum metric
+{
+    METRIC_WALL,
+    METRIC_CYCLES,
+    METRIC_INSTRUCTIONS,
+    METRIC_CACHE_MISSES,
+
+    METRIC_COUNT
+};
+
+static const char *metric_names[METRIC_COUNT] =
+{
+    "wall time (us)", "cycles", "instructions", "cache misses"
+};
+
+/*
+ * Availability of the hardware counters, decided on the first run: 1 when
+ * counting everything, 2 when counting user space only, 0 if unavailable.
+ */
+static char counter_mode[METRIC_COUNT];
+static char counters_probed = 0;
+
+/* Number of runs measured until the program exited, rather than reported. */
+static unsigned long unreported_runs = 0;
+
+/* Allocate memory, terminating the program on failure. */
+static void *xmalloc(size_t size)
+{
+    void *ptr = malloc((size > 0)? size : 1);
+
+    if (ptr == NULL)
+    {
+        fprintf(stderr, "%s: Out of memory.\n", program_name);
+        exit(1);
+    }
+    return ptr;
+}
+
+/* Current time in seconds, from an arbitrary point. */
+static double monotonic_time(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+#ifdef __linux__
+/*
+ * Open a hardware counter of a process which is yet to call exec, counting
+ * starts once it does.  Returns the file descriptor, or -1 on failure.
+ */
+static int open_counter(pid_t pid, enum metric metric, char user_only)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    switch (metric)
+    {
+        case METRIC_CYCLES:
+            attr.config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+
+        case METRIC_INSTRUCTIONS:
+            attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+
+        default:
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            break;
+    }
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.exclude_hv = 1;
+    attr.exclude_kernel = user_only;
+
+    return (int)syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0);
+}
+
+/*
+ * Open the counters of a process, the first time around each of them is
+ * tried with and without the kernel counted, and the outcome is remembered.
+ */
+static void open_counters(pid_t pid, int *fds)
+{
+    int metric;
+
+    for (metric = METRIC_CYCLES; metric < METRIC_COUNT; metric++)
+    {
+        fds[metric] = -1;
+
+        if (! counters_probed)
+        {
+            fds[metric] = open_counter(pid, metric, 0);
+            counter_mode[metric] = 1;
+            if (fds[metric] < 0)
+            {
+                fds[metric] = open_counter(pid, metric, 1);
+                counter_mode[metric] = (fds[metric] >= 0)? 2 : 0;
+            }
+        }
+        else if (counter_mode[metric] != 0)
+        {
+            fds[metric] = open_counter(pid, metric,
+                                       (char)(counter_mode[metric] == 2));
+        }
+    }
+    counters_probed = 1;
+}
+
+/* Read and close the counters, unavailable ones are left as they are. */
+static void close_counters(const int *fds, double *values)
+{
+    int metric;
+
+    for (metric = METRIC_CYCLES; metric < METRIC_COUNT; metric++)
+    {
+        __u64 count;
+
+        if (fds[metric] < 0)
+            continue;
+
+        if (read(fds[metric], &count, sizeof(count)) == sizeof(count))
+            values[metric] = (double)count;
+
+        close(fds[metric]);
+    }
+}
+#else
+static void open_counters(pid_t pid, int *fds)
+{
+    int metric;
+
+    (void)pid;
+    for (metric = METRIC_CYCLES; metric < METRIC_COUNT; metric++)
+        fds[metric] = -1;
+
+    counters_probed = 1;
+}
+
+static void close_counters(const int *fds, double *values)
+{
+    (void)fds;
+    (void)values;
+}
+#endif
+
+/* Wait for a child to exit or stop, returns 1 on success, 0 on failure. */
+static char wait_child(pid_t pid, int *status)
+{
+    while (waitpid(pid, status, WUNTRACED) < 0)
+    {
+        if (errno != EINTR)
+        {
+            fprintf(stderr, "%s: Failed to wait for the program.\n",
+                    program_name);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Run the program once, storing the measured values.  Returns 1 on success,
+ * 0 if it couldn't be run or didn't exit successfully.
+ *
+ * The child waits on a pipe until its counters are set up, the clock starts
+ * when it's released.  An instrumented program writes the CLOCK_MONOTONIC
+ * time at which its command line was parsed, as a double in seconds, to
+ * the descriptor named by STARTUP_FD_ENV_VAR and stops itself, so that its
+ * counters are read before it goes on to exit.  Other programs are measured
+ * until they're reaped.
+ */
+static char run_once(char **prog_argv, double *values)
+{
+    int fds[METRIC_COUNT];
+    int release_pipe[2];
+    int stamp_pipe[2];
+    int status;
+    double start;
+    double stamp;
+    pid_t pid;
+    char go = 1;
+
+    if (pipe(release_pipe) != 0)
+    {
+        fprintf(stderr, "%s: Failed to create a pipe.\n", program_name);
+        return 0;
+    }
+    if (pipe(stamp_pipe) != 0)
+    {
+        fprintf(stderr, "%s: Failed to create a pipe.\n", program_name);
+        close(release_pipe[0]);
+        close(release_pipe[1]);
+        return 0;
+    }
+
+    fflush(stdout);
+    pid = fork();
+    if (pid < 0)
+    {
+        fprintf(stderr, "%s: Failed to fork.\n", program_name);
+        close(release_pipe[0]);
+        close(release_pipe[1]);
+        close(stamp_pipe[0]);
+        close(stamp_pipe[1]);
+        return 0;
+    }
+    if (pid == 0)
+    {
+        int null_fd = open("/dev/null", O_WRONLY);
+        char fd_text[16];
+
+        close(release_pipe[1]);
+        close(stamp_pipe[0]);
+        if (null_fd >= 0)
+        {
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+            close(null_fd);
+        }
+        sprintf(fd_text, "%d", stamp_pipe[1]);
+        if (setenv(STARTUP_FD_ENV_VAR, fd_text, 1) == 0 &&
+            read(release_pipe[0], &go, 1) == 1)
+        {
+            execv(prog_argv[0], prog_argv);
+        }
+        _exit(127);
+    }
+    close(release_pipe[0]);
+    close(stamp_pipe[1]);
+
+    open_counters(pid, fds);
+
+    start = monotonic_time();
+    if (write(release_pipe[1], &go, 1) != 1)
+        kill(pid, SIGKILL);
+
+    close(release_pipe[1]);
+
+    /* Hits the end of the pipe if the program exits without a report. */
+    if (read(stamp_pipe[0], &stamp, sizeof(stamp)) == sizeof(stamp))
+    {
+        values[METRIC_WALL] = (stamp - start) * 1e6;
+
+        if (! wait_child(pid, &status))
+            return 0;
+
+        if (WIFSTOPPED(status))
+        {
+            close_counters(fds, values);
+            kill(pid, SIGCONT);
+            if (! wait_child(pid, &status))
+                return 0;
+        }
+        else
+            close_counters(fds, values);
+    }
+    else
+    {
+        if (! wait_child(pid, &status))
+            return 0;
+
+        values[METRIC_WALL] = (monotonic_time() - start) * 1e6;
+        close_counters(fds, values);
+        unreported_runs++;
+    }
+    close(stamp_pipe[0]);
+
+    if (! WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        fprintf(stderr, "%s: `%s' failed (%s %d), check that it exists and "
+                "accepts the given arguments.\n", program_name, prog_argv[0],
+                WIFEXITED(status)? "exit status" : "signal",
+                WIFEXITED(status)? WEXITSTATUS(status) : WTERMSIG(status));
+        return 0;
+    }
+    return 1;
+}
+
+/* Comparison of doubles, for qsort. */
+static int compare_doubles(const void *in_a, const void *in_b)
+{
+    double value_a = *(const double *)in_a;
+    double value_b = *(const double *)in_b;
+
+    return (value_a > value_b) - (value_a < value_b);
+}
+
+/* The given percentile of a sorted array, by the nearest rank. */
+static double percentile(const double *sorted, unsigned long count,
+                         unsigned int percent)
+{
+    unsigned long rank = (count * percent + 99) / 100;
+
+    return sorted[(rank > 0)? rank - 1 : 0];
+}
+
+int main(int argc, char **argv)
+{
+    enum dooshki_args_ret arg_parse_ret;
+    double *samples[METRIC_COUNT];
+    double values[METRIC_COUNT];
+    char **prog_argv;
+    unsigned long iter;
+    int metric;
+
+    arg_parse_ret = dooshki_args_parse(&argc, &argv, &cli_args_context);
+    switch(arg_parse_ret)
+    {
+        case DOOSHKI_ARGS_PARSE_OK:
+            break;
+
+        case DOOSHKI_ARGS_HELP_SHOWN:
+        case DOOSHKI_ARGS_VER_SHOWN:
+            return 0;
+
+        default:
+            return 1;
+    }
+    if (runs == 0)
+    {
+        fprintf(stderr, "%s: At least one run is needed.\n", program_name);
+        dooshki_args_err_usage(&cli_args_context);
+        return 1;
+    }
+    prog_argv = (argc > 1)? &argv[1] : default_argv;
+
+    for (iter = 0; iter < warmup_runs; iter++)
+    {
+        if (! run_once(prog_argv, values))
+            return 1;
+    }
+
+    for (metric = 0; metric < METRIC_COUNT; metric++)
+        samples[metric] = xmalloc(runs * sizeof(*samples[metric]));
+
+    unreported_runs = 0;
+
+    for (iter = 0; iter < runs; iter++)
+    {
+        for (metric = 0; metric < METRIC_COUNT; metric++)
+            values[metric] = 0.0;
+
+        if (! run_once(prog_argv, values))
+            return 1;
+
+        for (metric = 0; metric < METRIC_COUNT; metric++)
+            samples[metric][iter] = values[metric];
+    }
+
+    printf("program: %s, %lu runs after %lu warm-up runs\n",
+           prog_argv[0], runs, warmup_runs);
+    if (unreported_runs == 0)
+        printf("measured until the command line was parsed\n\n");
+    else if (unreported_runs == runs)
+        printf("measured until the program exited\n\n");
+    else
+        printf("measured until the program exited in %lu of the runs\n\n",
+               unreported_runs);
+    printf("%-16s %14s %14s %14s\n", "metric", "p50", "p99", "min");
+
+    for (metric = 0; metric < METRIC_COUNT; metric++)
+    {
+        qsort(samples[metric], runs, sizeof(*samples[metric]),
+              compare_doubles);
+
+        if (metric != METRIC_WALL && counter_mode[metric] == 0)
+        {
+            printf("%-16s %14s %14s %14s\n", metric_names[metric],
+                   "n/a", "n/a", "n/a");
+        }
+        else
+        {
+            printf("%-16s %14.1f %14.1f %14.1f%s\n", metric_names[metric],
+                   percentile(samples[metric], runs, 50),
+                   percentile(samples[metric], runs, 99),
+                   samples[metric][0],
+                   (counter_mode[metric] == 2)? "  (user space)" : "");
+        }
+        free(samples[metric]);
+    }
+    return 0;
+}
@@ -0,0 +1,642 @@
+/*
+ * Copyright (c) 2020 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dooshki_args.h"
+#include "dooshki_getopt.h"
+
+/* Argument handling of short options, as given by optstring. */
+enum short_mode
+{
+    SHORT_UNKNOWN,      /* not an option */
+    SHORT_NO_ARG,       /* "x"   */
+    SHORT_REQUIRED_ARG, /* "x:"  */
+    SHORT_OPTIONAL_ARG  /* "x::" */
+};
+
+/* Handling of arguments which aren't options, see dooshki_getopt.h. */
+enum ordering
+{
+    ORDER_PERMUTE,
+    ORDER_REQUIRE,      /* optstring starts with `+' */
+    ORDER_RETURN        /* optstring starts with `-' */
+};
+
+/*
+ * Lookup index of a pair of optstring and longopts arrays.
+ *
+ *
+ * The long options are described to the dooshki_args library by an option
+ * table with the same indices as longopts, which is compiled into a spec.
+ * When that isn't possible, `spec' is NULL and longopts is searched
+ * linearly instead.
+ *
+ * As the arrays may be built again at the same address, cached indexes
+ * keep a copy of optstring followed by the long names in `copy', which is
+ * compared with the arrays on the first use after starting over, while
+ * `checked' is unset.
+ */
+struct dooshki_getopt_index
+{
+    const char *optstring;
+    const struct dooshki_option *longopts;
+    unsigned int opt_count;
+    char *copy;
+    char checked;
+
+    enum ordering ordering;
+    char quiet;                 /* optstring starts with `:' */
+    unsigned char short_modes[256];
+
+    struct dooshki_opt *opt_desc;
+    struct dooshki_args args_ctxt;
+    struct dooshki_args_spec *spec;
+
+    struct dooshki_getopt_index *next;
+};
+
+int dooshki_optind = 1;
+char *dooshki_optarg = NULL;
+int dooshki_opterr = 1;
+int dooshki_optopt = '?';
+
+static struct dooshki_getopt_state global_state = DOOSHKI_GETOPT_STATE_INIT;
+
+
+/*
+ * Set up the index of an optstring and longopts pair.
+ *
+ *
+ * The spec is only compiled if `compile' is set, the index then has to be
+ * released with free_index.
+ */
+static void build_index(struct dooshki_getopt_index *index,
+                        const char *optstring,
+                        const struct dooshki_option *longopts,
+                        const char *program_name, char compile)
+{
+    const char *iter;
+    unsigned int opt_count = 0;
+    unsigned int opt_iter;
+
+    index->optstring = optstring;
+    index->longopts  = longopts;
+    index->copy      = NULL;
+    index->checked   = 1;
+    index->ordering  = ORDER_PERMUTE;
+    index->quiet     = 0;
+    index->opt_desc  = NULL;
+    index->spec      = NULL;
+    index->next      = NULL;
+
+    if (optstring[0] == '+')
+        index->ordering = ORDER_REQUIRE;
+    else if (optstring[0] == '-')
+        index->ordering = ORDER_RETURN;
+
+    iter = (index->ordering != ORDER_PERMUTE)? optstring + 1 : optstring;
+    if (*iter == ':')
+    {
+        index->quiet = 1;
+        iter++;
+    }
+
+    memset(index->short_modes, SHORT_UNKNOWN, sizeof(index->short_modes));
+    for (; *iter != '\0'; iter++)
+    {
+        unsigned char name = (unsigned char)*iter;
+
+        if (name == ':' || name == ';')
+            continue;
+
+        if (iter[1] != ':')
+            index->short_modes[name] = SHORT_NO_ARG;
+        else if (iter[2] != ':')
+            index->short_modes[name] = SHORT_REQUIRED_ARG;
+        else
+            index->short_modes[name] = SHORT_OPTIONAL_ARG;
+    }
+
+    if (longopts != NULL)
+        for (; longopts[opt_count].name != NULL; opt_count++);
+    index->opt_count = opt_count;
+
+    if (! compile || opt_count == 0)
+        return;
+
+    index->opt_desc = calloc(opt_count + 1, sizeof(*index->opt_desc));
+    if (index->opt_desc == NULL)
+        return;
+
+    for (opt_iter = 0; opt_iter < opt_count; opt_iter++)
+    {
+        index->opt_desc[opt_iter].long_name = longopts[opt_iter].name;
+        index->opt_desc[opt_iter].type      = DOOSHKI_OPT_CB_NOARG;
+    }
+
+    memset(&index->args_ctxt, 0, sizeof(index->args_ctxt));
+    index->args_ctxt.program_name = program_name;
+    index->args_ctxt.opt_desc     = index->opt_desc;
+
+    index->spec = dooshki_args_compile(&index->args_ctxt);
+}
+
+/* Release the memory held by an index. */
+static void free_index(struct dooshki_getopt_index *index)
+{
+    dooshki_args_spec_free(index->spec);
+    free(index->opt_desc);
+    free(index->copy);
+    free(index);
+}
+
+/*
+ * Store a copy of optstring and the long names in an index, returns 0 if
+ * no memory could be allocated.
+ */
+static char copy_index(struct dooshki_getopt_index *index)
+{
+    const struct dooshki_option *longopts = index->longopts;
+    size_t size = strlen(index->optstring) + 1;
+    char *iter;
+    int opt_iter;
+
+    for (opt_iter = 0; longopts != NULL && longopts[opt_iter].name != NULL;
+         opt_iter++)
+        size += strlen(longopts[opt_iter].name) + 1;
+
+    index->copy = malloc(size);
+    if (index->copy == NULL)
+        return 0;
+
+    strcpy(index->copy, index->optstring);
+    iter = index->copy + strlen(index->optstring) + 1;
+
+    for (opt_iter = 0; longopts != NULL && longopts[opt_iter].name != NULL;
+         opt_iter++)
+    {
+        strcpy(iter, longopts[opt_iter].name);
+        iter += strlen(iter) + 1;
+    }
+    return 1;
+}
+
+/* Check whether the arrays of an index still match its copy of them. */
+static char is_unchanged(const struct dooshki_getopt_index *index)
+{
+    const struct dooshki_option *longopts = index->longopts;
+    const char *iter = index->copy;
+    unsigned int opt_count = 0;
+    int opt_iter;
+
+    if (strcmp(iter, index->optstring) != 0)
+        return 0;
+    iter += strlen(iter) + 1;
+
+    for (opt_iter = 0; longopts != NULL && longopts[opt_iter].name != NULL;
+         opt_iter++)
+    {
+        if (opt_count++ == index->opt_count ||
+            strcmp(iter, longopts[opt_iter].name) != 0)
+            return 0;
+        iter += strlen(iter) + 1;
+    }
+    return opt_count == index->opt_count;
+}
+
+/*
+ * Find the index of an optstring and longopts pair in the cache of a state,
+ * building it if it's not there yet.
+ *
+ *
+ * If no memory can be allocated for a new index, `fallback' is set up as one
+ * without a compiled spec, and returned instead.
+ */
+static struct dooshki_getopt_index *find_index(
+                                    struct dooshki_getopt_state *state,
+                                    const char *optstring,
+                                    const struct dooshki_option *longopts,
+                                    const char *program_name,
+                                    struct dooshki_getopt_index *fallback)
+{
+    struct dooshki_getopt_index **link;
+    struct dooshki_getopt_index *index;
+
+    for (link = &state->indexes; *link != NULL; link = &(*link)->next)
+    {
+        index = *link;
+        if (index->optstring != optstring || index->longopts != longopts)
+            continue;
+
+        if (index->checked)
+            return index;
+
+        if (is_unchanged(index))
+        {
+            index->checked = 1;
+            return index;
+        }
+
+        /* The arrays were built again at the same address. */
+        *link = index->next;
+        free_index(index);
+        break;
+    }
+
+    index = malloc(sizeof(*index));
+    if (index != NULL)
+    {
+        build_index(index, optstring, longopts, program_name, 1);
+        if (! copy_index(index))
+        {
+            free_index(index);
+            index = NULL;
+        }
+    }
+    if (index == NULL)
+    {
+        build_index(fallback, optstring, longopts, program_name, 0);
+        return fallback;
+    }
+
+    index->next = state->indexes;
+    state->indexes = index;
+    return index;
+}
+
+/*
+ * Find a long option, returns its index in longopts, or -1.
+ *
+ *
+ * `matches' receives the number of options matched, see
+ * dooshki_args_spec_find_long.
+ */
+static int find_long(const struct dooshki_getopt_index *index,
+                     const char *name, unsigned int name_len,
+                     unsigned int *matches)
+{
+    const struct dooshki_option *longopts = index->longopts;
+    int found = -1;
+    int iter;
+
+    if (index->spec != NULL)
+        return dooshki_args_spec_find_long(index->spec, name, name_len,
+                                           matches);
+
+    *matches = 0;
+    if (longopts == NULL || name_len == 0)
+        return -1;
+
+    for (iter = 0; longopts[iter].name != NULL; iter++)
+    {
+        if (strncmp(longopts[iter].name, name, name_len) == 0)
+        {
+            if (longopts[iter].name[name_len] == '\0')
+            {
+                *matches = 1;
+                return iter;
+            }
+            if (found < 0)
+                found = iter;
+
+            *matches += 1;
+        }
+    }
+    return found;
+}
+
+/*
+ * Check whether an abbreviated long name is ambiguous.
+ *
+ *
+ * Like glibc, an abbreviation matching several options is accepted when
+ * all of them are handled the same way as the first one, `found'.
+ */
+static char is_ambiguous(const struct dooshki_option *longopts, int found,
+                         const char *name, unsigned int name_len)
+{
+    const struct dooshki_option *first = &longopts[found];
+    int iter;
+
+    for (iter = found + 1; longopts[iter].name != NULL; iter++)
+    {
+        if (strncmp(longopts[iter].name, name, name_len) == 0 &&
+            (longopts[iter].has_arg != first->has_arg ||
+             longopts[iter].flag    != first->flag ||
+             longopts[iter].val     != first->val))
+            return 1;
+    }
+    return 0;
+}
+
+/* Report an ambiguous abbreviation, listing the options it matches. */
+static void print_ambiguous(const char *program_name, const char *word,
+                            const struct dooshki_option *longopts,
+                            unsigned int name_len)
+{
+    int iter;
+
+    fprintf(stderr, "%s: option '%s' is ambiguous; possibilities:",
+            program_name, word);
+
+    for (iter = 0; longopts[iter].name != NULL; iter++)
+    {
+        if (strncmp(longopts[iter].name, word + 2, name_len) == 0)
+            fprintf(stderr, " '--%s'", longopts[iter].name);
+    }
+    fprintf(stderr, "\n");
+}
+
+/* Process the long option in argv[state->optind]. */
+static int process_long_opt(int argc, char *const argv[],
+                            const struct dooshki_getopt_index *index,
+                            int *longindex, struct dooshki_getopt_state *state)
+{
+    const char *word = argv[state->optind];
+    const char *name = word + 2;
+    unsigned int name_len = (unsigned int)strcspn(name, "=");
+    const struct dooshki_option *option;
+    char print_errors = (state->opterr && ! index->quiet);
+    unsigned int matches;
+    int found;
+
+    state->optind++;
+
+    found = find_long(index, name, name_len, &matches);
+    if (found < 0)
+    {
+        if (print_errors)
+            fprintf(stderr, "%s: unrecognized option '%s'\n", argv[0], word);
+
+        state->optopt = 0;
+        return '?';
+    }
+    if (matches > 1 && is_ambiguous(index->longopts, found, name, name_len))
+    {
+        if (print_errors)
+            print_ambiguous(argv[0], word, index->longopts, name_len);
+
+        state->optopt = 0;
+        return '?';
+    }
+    option = &index->longopts[found];
+
+    if (name[name_len] == '=')
+    {
+        if (option->has_arg == dooshki_no_argument)
+        {
+            if (print_errors)
+                fprintf(stderr, "%s: option '--%s' doesn't allow an "
+                        "argument\n", argv[0], option->name);
+
+            state->optopt = option->val;
+            return '?';
+        }
+        state->optarg = (char *)&name[name_len + 1];
+    }
+    else if (option->has_arg == dooshki_required_argument)
+    {
+        if (state->optind >= argc)
+        {
+            if (print_errors)
+                fprintf(stderr, "%s: option '--%s' requires an argument\n",
+                        argv[0], option->name);
+
+            state->optopt = option->val;
+            return index->quiet? ':' : '?';
+        }
+        state->optarg = argv[state->optind++];
+    }
+
+    if (longindex != NULL)
+        *longindex = found;
+
+    if (option->flag != NULL)
+    {
+        *option->flag = option->val;
+        return 0;
+    }
+    return option->val;
+}
+
+/* Move on to the word after the current cluster of short options. */
+static void end_cluster(struct dooshki_getopt_state *state)
+{
+    state->optind++;
+    state->cluster_pos = 0;
+}
+
+/* Process the next option in the cluster of short options at optind. */
+static int process_short_opt(int argc, char *const argv[],
+                             const struct dooshki_getopt_index *index,
+                             struct dooshki_getopt_state *state)
+{
+    const char *word = argv[state->optind];
+    char name = word[state->cluster_pos++];
+    enum short_mode mode = (enum short_mode)
+                           index->short_modes[(unsigned char)name];
+    char print_errors = (state->opterr && ! index->quiet);
+
+    if (mode == SHORT_UNKNOWN)
+    {
+        if (print_errors)
+            fprintf(stderr, "%s: invalid option -- '%c'\n", argv[0], name);
+
+        if (word[state->cluster_pos] == '\0')
+            end_cluster(state);
+
+        state->optopt = (unsigned char)name;
+        return '?';
+    }
+
+    if (word[state->cluster_pos] == '\0')
+    {
+        end_cluster(state);
+
+        if (mode == SHORT_REQUIRED_ARG)
+        {
+            if (state->optind >= argc)
+            {
+                if (print_errors)
+                    fprintf(stderr, "%s: option requires an argument -- "
+                            "'%c'\n", argv[0], name);
+
+                state->optopt = (unsigned char)name;
+                return index->quiet? ':' : '?';
+            }
+            state->optarg = argv[state->optind++];
+        }
+    }
+    else if (mode != SHORT_NO_ARG)
+    {
+        state->optarg = (char *)&word[state->cluster_pos];
+        end_cluster(state);
+    }
+    return (unsigned char)name;
+}
+
+/*
+ * Move the words from argv[middle] to argv[end - 1] in front of those from
+ * argv[first] to argv[middle - 1], which are arguments skipped over while
+ * looking for options.
+ */
+static void permute_words(char *const argv[], int first, int middle, int end)
+{
+    char **words = (char **)argv;
+    char *word;
+    int iter;
+
+    for (; middle < end; first++, middle++)
+    {
+        word = words[middle];
+        for (iter = middle; iter > first; iter--)
+            words[iter] = words[iter - 1];
+
+        words[first] = word;
+    }
+}
+
+/* Check whether a word is an option, or a cluster of them. */
+#define IS_OPTION(word) ((word)[0] == '-' && (word)[1] != '\0')
+
+int dooshki_getopt_long_r(int argc, char *const argv[], const char *optstring,
+                          const struct dooshki_option *longopts,
+                          int *longindex, struct dooshki_getopt_state *state)
+{
+    struct dooshki_getopt_index fallback;
+    const struct dooshki_getopt_index *index;
+    enum ordering ordering;
+    int skipped_from;
+    int opt_word;
+    int ret;
+
+    if (state->optind == 0 || ! state->initialized)
+    {
+        struct dooshki_getopt_index *cached;
+
+        /* The arrays may have changed since they were last seen. */
+        for (cached = state->indexes; cached != NULL; cached = cached->next)
+            cached->checked = 0;
+
+        state->optind = 1;
+        state->cluster_pos = 0;
+        state->posixly_correct = (getenv("POSIXLY_CORRECT") != NULL);
+        state->initialized = 1;
+    }
+    state->optarg = NULL;
+
+    index = find_index(state, optstring, longopts, argv[0], &fallback);
+
+    ordering = index->ordering;
+    if (ordering == ORDER_PERMUTE && state->posixly_correct)
+        ordering = ORDER_REQUIRE;
+
+    if (state->optind >= argc || argv[state->optind] == NULL)
+        return -1;
+
+    if (state->cluster_pos != 0)
+    {
+        skipped_from = state->skipped_from;
+        opt_word = state->optind;
+    }
+    else
+    {
+        skipped_from = opt_word = state->optind;
+        if (ordering == ORDER_PERMUTE)
+        {
+            for (; opt_word < argc && argv[opt_word] != NULL &&
+                   ! IS_OPTION(argv[opt_word]); opt_word++);
+
+            if (opt_word >= argc || argv[opt_word] == NULL)
+                return -1;
+
+            state->optind = opt_word;
+        }
+        else if (! IS_OPTION(argv[opt_word]))
+        {
+            if (ordering == ORDER_REQUIRE)
+                return -1;
+
+            state->optarg = argv[state->optind++];
+            return 1;
+        }
+    }
+
+    if (state->cluster_pos != 0)
+        ret = process_short_opt(argc, argv, index, state);
+
+    else if (strcmp(argv[opt_word], "--") == 0)
+    {
+        state->optind++;
+        ret = -1;
+    }
+    else if (argv[opt_word][1] == '-')
+        ret = process_long_opt(argc, argv, index, longindex, state);
+
+    else
+    {
+        state->cluster_pos = 1;
+        ret = process_short_opt(argc, argv, index, state);
+    }
+
+    /*
+     * Move the words processed in front of the arguments skipped over,
+     * a cluster of short options is only moved once it's done with, as
+     * the last option in it may take the next word as its argument.
+     */
+    if (state->cluster_pos != 0)
+        state->skipped_from = skipped_from;
+
+    else if (opt_word > skipped_from)
+    {
+        int processed = state->optind - opt_word;
+
+        permute_words(argv, skipped_from, opt_word, state->optind);
+        state->optind = skipped_from + processed;
+    }
+    return ret;
+}
+
+int dooshki_getopt_long(int argc, char *const argv[], const char *optstring,
+                        const struct dooshki_option *longopts,
+                        int *longindex)
+{
+    int ret;
+
+    global_state.optind = dooshki_optind;
+    global_state.opterr = dooshki_opterr;
+
+    ret = dooshki_getopt_long_r(argc, argv, optstring, longopts, longindex,
+                                &global_state);
+
+    dooshki_optind = global_state.optind;
+    dooshki_optarg = global_state.optarg;
+    dooshki_optopt = global_state.optopt;
+    return ret;
+}
+
+void dooshki_getopt_state_free(struct dooshki_getopt_state *state)
+{
+    struct dooshki_getopt_index *next;
+
+    while (state->indexes != NULL)
+    {
+        next = state->indexes->next;
+        free_index(state->indexes);
+        state->indexes = next;
+    }
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2020 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Dooshki's getopt_long compatibility layer.
+ *
+ * An implementation of the GNU getopt_long interface on top of the lookup
+ * index of the dooshki_args library, for programs which already use
+ * getopt_long and want faster option lookup without being rewritten.
+ * It requires dooshki_args.c, built without DOOSHKI_ARGS_NO_HEAP.
+ *
+ * The first time a pair of optstring and longopts arrays is seen, a compiled
+ * dooshki_args spec is built for the long options, along with a table
+ * of the short ones, and it is kept for later calls using the same arrays.
+ * It's found by the addresses of the arrays, and a copy of optstring and
+ * the long names is compared with them each time optind is set to 0, so
+ * arrays built again at the same address (eg. on the stack of a function
+ * called repeatedly) are indexed anew.  Other changes to the arrays aren't
+ * noticed, so they have to stay unchanged between such restarts.
+ *
+ * The behavior matches glibc: arguments are permuted so that options come
+ * first (unless optstring starts with `+' or POSIXLY_CORRECT is set, or
+ * with `-', which returns the other arguments as the arguments of option 1),
+ * a leading `:' in optstring makes missing arguments return ':', long names
+ * may be abbreviated as long as the abbreviation isn't ambiguous, and setting
+ * optind to 0 starts over.  The `W;' extension isn't supported.
+ *
+ * Existing code can be switched over by defining DOOSHKI_GETOPT_REPLACE and
+ * including this header in place of <getopt.h>, which renames getopt_long,
+ * struct option and the optind, optarg, opterr and optopt variables to their
+ * counterparts in this file.
+ */
+
+#ifndef DOOSHKI_GETOPT_H
+#define DOOSHKI_GETOPT_H 1
+
+/* Values of the `has_arg' field of dooshki_option. */
+#define dooshki_no_argument         0
+#define dooshki_required_argument   1
+#define dooshki_optional_argument   2
+
+/* Long option description, same as `struct option' of getopt_long. */
+struct dooshki_option
+{
+    const char *name;
+    int has_arg;
+    int *flag;
+    int val;
+};
+
+/*
+ * Parsing state of dooshki_getopt_long_r, initialize it with
+ * DOOSHKI_GETOPT_STATE_INIT.
+ *
+ * The first four fields work just like the global variables of getopt_long,
+ * the rest are considered private.  Each state keeps its own cache of option
+ * indexes, release them with dooshki_getopt_state_free once done.
+ */
+struct dooshki_getopt_index;
+
+struct dooshki_getopt_state
+{
+    int optind;         /* index of the next argument to process */
+    char *optarg;       /* argument of the last option found */
+    int opterr;         /* whether to print error messages */
+    int optopt;         /* the last unrecognized option character */
+
+    char initialized;
+    char posixly_correct;
+    int cluster_pos;    /* position within a cluster of short options */
+    int skipped_from;   /* first argument skipped before the cluster */
+
+    struct dooshki_getopt_index *indexes;
+};
+
+#define DOOSHKI_GETOPT_STATE_INIT { 1, 0, 1, '?', 0, 0, 0, 0, 0 }
+
+/* Variables of dooshki_getopt_long, see getopt_long. */
+extern int dooshki_optind;
+extern char *dooshki_optarg;
+extern int dooshki_opterr;
+extern int dooshki_optopt;
+
+/*
+ * Process the next command-line option.
+ *
+ *
+ * A drop-in replacement for getopt_long, using the global variables above.
+ * Returns the option character, the `val' field of a long option (or 0 if
+ * its `flag' field is non-NULL, `val' is then stored to *flag), '?' or ':'
+ * on errors, or -1 when there are no more options.
+ */
+int dooshki_getopt_long(int argc, char *const argv[], const char *optstring,
+                        const struct dooshki_option *longopts,
+                        int *longindex);
+
+/*
+ * Process the next command-line option, reentrant variant.
+ *
+ *
+ * Works like dooshki_getopt_long, with the variables and the index cache kept
+ * in `state', so that separate threads or argument vectors can be processed
+ * at the same time using separate states.
+ */
+int dooshki_getopt_long_r(int argc, char *const argv[], const char *optstring,
+                          const struct dooshki_option *longopts,
+                          int *longindex, struct dooshki_getopt_state *state);
+
+/* Release the index cache of a state, which may be used again afterwards. */
+void dooshki_getopt_state_free(struct dooshki_getopt_state *state);
+
+#ifdef DOOSHKI_GETOPT_REPLACE
+#define option              dooshki_option
+#define no_argument         dooshki_no_argument
+#define required_argument   dooshki_required_argument
+#define optional_argument   dooshki_optional_argument
+#define getopt_long         dooshki_getopt_long
+#define optind              dooshki_optind
+#define optarg              dooshki_optarg
+#define opterr              dooshki_opterr
+#define optopt              dooshki_optopt
+#endif
+
+#endif /* DOOSHKI_GETOPT_H */